@@ -0,0 +1,99 @@
+#ifndef INCLUDE_HLL_CONCURRENT_HYPERLOGLOG_HPP_
+#define INCLUDE_HLL_CONCURRENT_HYPERLOGLOG_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#include "hyperloglog.hpp"
+
+namespace hll {
+// A HyperLogLog++ counter that can be shared between threads. `insert()` and
+// `estimate()` can be called concurrently from any number of threads.
+//
+// While sparse, items are staged in a number of mutex-protected shards, each
+// thread always using the same shard. Once the shards hold as many entries as
+// fit in the bytes of the dense registers, i.e. 2^precision / 4 entries, or
+// 2^precision / 8 if sparse_precision > 26, one inserting thread allocates the
+// dense registers, switches the counter to dense and drains the shards into
+// them. Other threads keep inserting into the dense registers meanwhile. Dense
+// registers are updated with a lock-free compare-and-swap maximum.
+//
+// Shards are deduplicated only from time to time and not against each other,
+// so an item inserted repeatedly, or by several threads, may be counted more
+// than once towards the conversion point. Estimates agree with those of an
+// `hll::hyperloglog` that saw the same items whenever both counters have the
+// same representation, e.g. always when every item is inserted once.
+template <typename T, std::uint8_t precision = 14,
+          std::uint8_t sparse_precision = 24>
+class concurrent_hyperloglog {
+  static_assert(precision > 3, "Precision should be 4 or greater");
+  static_assert(precision <= 18, "precision should be 18 or less");
+  static_assert(sparse_precision <= 58,
+                "Sparse precision should be 58 or less");
+  static_assert(precision < sparse_precision,
+                "Precision should be less than sparse_precision");
+
+public:
+  static constexpr std::uint8_t dense_prec = precision;
+  static constexpr std::uint8_t sparse_prec = sparse_precision;
+
+  explicit concurrent_hyperloglog(bool create_dense = false,
+                                  std::uint64_t seed = 0x9E3779B97F4A7C15);
+
+  concurrent_hyperloglog(const concurrent_hyperloglog &) = delete;
+  concurrent_hyperloglog &operator=(const concurrent_hyperloglog &) = delete;
+
+  void insert(const T &item);
+  void insert_hash(std::uint64_t hash);
+
+  bool is_sparse() const;
+  double estimate() const;
+
+private:
+  constexpr static std::size_t shard_count = 16;
+  constexpr static int rank_bits = 6; // == log2(64)
+  // The same conversion point as `hll::hyperloglog` with byte registers, whose
+  // sparse entries take 32 bits when they fit. Shards always stage 64-bit
+  // entries.
+  using sparse_entry =
+      typename std::conditional<sparse_precision + rank_bits <= 32,
+                                std::uint32_t, std::uint64_t>::type;
+  constexpr static std::size_t sparse_list_max =
+      hll::byte_registers::bytes_for(1ul << precision) / sizeof(sparse_entry);
+
+  struct shard {
+    std::mutex lock;
+    std::vector<std::uint64_t> entries;
+    std::size_t compacted_size = 0;
+  };
+
+  std::uint64_t seed;
+  std::atomic<bool> sparse;
+  std::atomic<bool> promoting;
+  std::atomic<bool> drained;
+  std::atomic<std::size_t> staged;
+
+  std::unique_ptr<std::atomic<std::uint8_t>[]> dense_storage;
+  std::atomic<std::atomic<std::uint8_t> *> dense;
+
+  mutable std::array<shard, shard_count> shards;
+
+  static std::size_t shard_index();
+  static void compact(std::vector<std::uint64_t> &entries);
+
+  void update_register(std::uint64_t index, std::uint8_t rank);
+  void promote();
+
+  double sparse_estimate() const;
+  double dense_estimate() const;
+};
+} // namespace hll
+
+#include "../../src/concurrent_hyperloglog.tpp"
+
+#endif // INCLUDE_HLL_CONCURRENT_HYPERLOGLOG_HPP_
@@ -0,0 +1,142 @@
+#ifndef INCLUDE_HLL_DYNAMIC_HYPERLOGLOG_HPP_
+#define INCLUDE_HLL_DYNAMIC_HYPERLOGLOG_HPP_
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "hyperloglog.hpp"
+
+namespace hll {
+// A counter like `hll::hyperloglog` whose precisions are chosen at run time.
+// It uses the same algorithms and bias tables: inserting the same items into a
+// `dynamic_hyperloglog` with precisions (p, sp) and into a
+// `hyperloglog<T, p, sp>` gives the same estimates, and both serialize to the
+// same format.
+//
+// The precision of a counter can be lowered with `reduce_precision()`, and
+// counters of different precisions can be merged. The result of a merge has
+// the lower of the precisions of the two counters.
+template <typename T, typename Hash = hll::murmur_hash>
+class dynamic_hyperloglog {
+public:
+  using hasher = Hash;
+
+  // Throws `std::invalid_argument` unless 4 <= precision <= 18 and
+  // precision < sparse_precision <= 58.
+  explicit dynamic_hyperloglog(std::uint8_t precision = 14,
+                               std::uint8_t sparse_precision = 24,
+                               bool create_dense = false,
+                               std::uint64_t seed = 0x9E3779B97F4A7C15);
+
+  std::uint8_t precision() const;
+  std::uint8_t sparse_precision() const;
+  std::uint64_t seed() const;
+
+  void insert(const T &item);
+  template <typename InputIt> void insert(InputIt first, InputIt last);
+
+  // Inserts a string given by its bytes into a counter of `std::string`s
+  // without copying it.
+  template <typename U = T, typename = typename std::enable_if<
+                                std::is_same<U, std::string>::value>::type>
+  void insert(const char *data, std::size_t size);
+
+  // Insert items that are already hashed, e.g. with `Hash` and the same seed.
+  void insert_hash(std::uint64_t hash);
+  void insert_hashes(const std::uint64_t *hashes, std::size_t count);
+
+  // Lowers the precision to `new_precision` in a single pass over the
+  // registers, or over the sparse entries of a sparse counter. The result is
+  // the counter that would have been built with the lower precision from the
+  // start. The second overload also lowers the sparse precision. Throws
+  // `std::invalid_argument` if a precision would grow or become invalid.
+  void reduce_precision(std::uint8_t new_precision);
+  void reduce_precision(std::uint8_t new_precision,
+                        std::uint8_t new_sparse_precision);
+
+  // Merges counters of any precisions. This counter is first reduced to the
+  // lower precisions of the two, and the other one is folded into it on the
+  // fly.
+  void merge(const hll::dynamic_hyperloglog<T, Hash> &other);
+  void merge(const hll::sketch_view &other);
+
+  // Serializes the counter in the format described in `sketch_view.hpp`.
+  std::vector<std::uint8_t> serialize() const;
+  // Reads a counter of any precisions.
+  static hll::dynamic_hyperloglog<T, Hash> deserialize(const void *data,
+                                                       std::size_t size);
+
+  bool is_sparse() const;
+  double estimate() const;
+  double estimate(hll::estimation_method method) const;
+
+  // dense registers, one byte each
+  const std::vector<std::uint8_t> &dense_vec() const;
+
+  // Representation, memory and register histogram of the counter, see
+  // `instrumentation.hpp`.
+  hll::sketch_stats stats() const;
+
+private:
+  constexpr static int rank_bits = 6; // == log2(64)
+  constexpr static std::size_t batch_size = 64;
+
+  std::uint8_t dense_prec;
+  std::uint8_t sparse_prec;
+  // The sparse list is converted to dense registers at the same sizes as in
+  // `hll::hyperloglog` with these precisions.
+  std::size_t sparse_list_max;
+  std::size_t temporary_list_max;
+
+  bool sparse;
+  std::uint64_t hash_seed;
+  hll::byte_registers dense;
+  // harmonic sum of the dense registers, kept up to date on every change
+  simd::register_sums sums;
+  // Sparse entries (index << rank_bits | rank) of type `E`. As in
+  // `hll::hyperloglog`, entries take 4 bytes if sparse_precision + rank_bits
+  // <= 32 and 8 bytes otherwise, and only the lists of that width are used.
+  template <typename E> struct sparse_lists {
+    using entry = E;
+    std::vector<E> sparse;
+    std::vector<E> temporary;
+    // reused for sorting entries in non-const methods
+    std::vector<E> scratch;
+
+    std::size_t bytes() const;
+    void release();
+  };
+  sparse_lists<std::uint32_t> narrow;
+  sparse_lists<std::uint64_t> wide;
+  // number of distinct sparse entries, computed lazily after inserts
+  detail::lazy_count sparse_count;
+
+  bool narrow_entries() const;
+  // calls `f(lists)` with the sparse lists of the current width
+  template <typename F> decltype(auto) with_lists(F f);
+  template <typename F> decltype(auto) with_lists(F f) const;
+
+  void set_precisions(std::uint8_t precision, std::uint8_t sparse_precision);
+  void convert_to_dense();
+  void merge_temp();
+
+  void insert_sparse_block(const std::uint64_t *hashes, std::size_t count);
+  void insert_dense_block(const std::uint64_t *hashes, std::size_t count);
+  void update_register(std::uint64_t index, std::uint8_t rank);
+
+  // Merge the entries of a sparse counter with sparse precision `other_sp`,
+  // given as `for_each(f)` calling `f(index, rank)`, or the registers of a
+  // dense counter with precision `other_p`, given as `get(index)`.
+  template <typename ForEach>
+  void merge_sparse(std::uint8_t other_sp, ForEach for_each);
+  template <typename Get>
+  void merge_dense(std::uint8_t other_p, Get get);
+};
+} // namespace hll
+
+#include "../../src/dynamic_hyperloglog.tpp"
+
+#endif // INCLUDE_HLL_DYNAMIC_HYPERLOGLOG_HPP_
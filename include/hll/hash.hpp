@@ -0,0 +1,102 @@
+#ifndef INCLUDE_HLL_HASH_HPP_
+#define INCLUDE_HLL_HASH_HPP_
+
+// Hash policies, the last template argument of `hll::hyperloglog`. A policy
+// `H` is a function object with
+//
+//   std::uint64_t operator()(const K &key, std::uint64_t seed) const;
+//   std::uint64_t operator()(const char *data, std::size_t size,
+//                            std::uint64_t seed) const;
+//   void hash_many(const K *keys, std::size_t count, std::uint64_t seed,
+//                  std::uint64_t *out) const;
+//   static constexpr std::uint8_t id;
+//
+// for each key type `K` it supports. The second overload hashes a string
+// given by its bytes and gives the same hash as the equal `std::string`.
+// `hash_many` gives the same hashes as calling the policy on each key. `id` is
+// stored in serialized sketches, so that sketches of different policies are
+// never merged.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+namespace hll {
+// MurmurHash3 of a key, used by `hll::murmur_hash`. Specialize it to count
+// other types of keys.
+template <typename T> struct hash {
+  std::uint64_t operator()(const T &, std::uint64_t seed) const;
+};
+
+// MurmurHash3 of keys with `hll::hash<K>`. This was the only hash before
+// hash policies were added.
+//
+// `terminated_strings` is a compatibility flag: when true, strings are hashed
+// as if their NUL terminator were part of them, which is what `hll::hash`
+// always did. Keep it true to merge with sketches of strings made before, or
+// set it to false to hash only the bytes of strings.
+template <bool terminated_strings> struct basic_murmur_hash {
+  static constexpr std::uint8_t id = terminated_strings ? 0 : 1;
+
+  template <typename K>
+  std::uint64_t operator()(const K &key, std::uint64_t seed) const;
+  std::uint64_t operator()(const std::string &key, std::uint64_t seed) const;
+#if __cplusplus >= 201703L
+  std::uint64_t operator()(std::string_view key, std::uint64_t seed) const;
+#endif
+  std::uint64_t operator()(const char *data, std::size_t size,
+                           std::uint64_t seed) const;
+
+  template <typename K>
+  void hash_many(const K *keys, std::size_t count, std::uint64_t seed,
+                 std::uint64_t *out) const;
+};
+
+using murmur_hash = basic_murmur_hash<true>;
+
+// A 64-bit hash in the style of wyhash. Much faster than MurmurHash3 for
+// short keys. Supports arithmetic types and strings.
+struct wy_hash {
+  static constexpr std::uint8_t id = 2;
+
+  template <typename K>
+  std::uint64_t operator()(const K &key, std::uint64_t seed) const;
+  std::uint64_t operator()(const std::string &key, std::uint64_t seed) const;
+#if __cplusplus >= 201703L
+  std::uint64_t operator()(std::string_view key, std::uint64_t seed) const;
+#endif
+  std::uint64_t operator()(const char *data, std::size_t size,
+                           std::uint64_t seed) const;
+
+  template <typename K>
+  void hash_many(const K *keys, std::size_t count, std::uint64_t seed,
+                 std::uint64_t *out) const;
+};
+
+// Mixes integer keys of up to 64 bits with a bijective finalizer, the fastest
+// of the policies. `hash_many` hashes several keys at once in SIMD lanes.
+struct integer_hash {
+  static constexpr std::uint8_t id = 3;
+
+  template <typename K>
+  std::uint64_t operator()(const K &key, std::uint64_t seed) const;
+
+  template <typename K>
+  void hash_many(const K *keys, std::size_t count, std::uint64_t seed,
+                 std::uint64_t *out) const;
+};
+
+// Hashes `keys[0]` to `keys[count - 1]` into `out` with policy `Hash`.
+template <typename Hash = hll::murmur_hash, typename K>
+void hash_many(const K *keys, std::size_t count, std::uint64_t seed,
+               std::uint64_t *out);
+} // namespace hll
+
+#include "../../src/hash.tpp"
+
+#endif // INCLUDE_HLL_HASH_HPP_
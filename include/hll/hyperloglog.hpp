@@ -1,16 +1,84 @@
 #ifndef INCLUDE_HLL_HYPERLOGLOG_HPP_
 #define INCLUDE_HLL_HYPERLOGLOG_HPP_
 
+#include <atomic>
 #include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "hash.hpp"
+#include "instrumentation.hpp"
+#include "registers.hpp"
+#include "sketch_view.hpp"
+#include "thread_pool.hpp"
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
 namespace hll {
-template <typename T> struct hash {
-  std::uint64_t operator()(const T &, std::uint64_t seed) const;
+namespace detail {
+// A count that const methods compute on demand and keep until it is reset.
+// Threads that compute it at the same time all store the same value.
+class lazy_count {
+public:
+  lazy_count() = default;
+  lazy_count(const lazy_count &other)
+      : value(other.value.load(std::memory_order_relaxed)) {}
+  lazy_count &operator=(const lazy_count &other) {
+    value.store(other.value.load(std::memory_order_relaxed),
+                std::memory_order_relaxed);
+    return *this;
+  }
+
+  // the count, calling `compute()` if it is not known
+  template <typename F> std::size_t get(F compute) const {
+    std::size_t count = value.load(std::memory_order_relaxed);
+    if (count == unknown) {
+      count = compute();
+      value.store(count, std::memory_order_relaxed);
+    }
+    return count;
+  }
+  void set(std::size_t count) {
+    value.store(count, std::memory_order_relaxed);
+  }
+  void reset() { value.store(unknown, std::memory_order_relaxed); }
+
+private:
+  static constexpr std::size_t unknown =
+      std::numeric_limits<std::size_t>::max();
+  mutable std::atomic<std::size_t> value{unknown};
+};
+} // namespace detail
+
+// Estimators of dense counters. Sparse counters always use linear counting
+// over the sparse entries.
+enum class estimation_method {
+  // HyperLogLog++: the raw estimate corrected with the empirical bias tables
+  // in `src/biases/`, or linear counting below the threshold of the precision
+  bias_corrected,
+  // Ertl's improved raw estimator, "New cardinality estimation algorithms for
+  // HyperLogLog sketches" (2017), computed from the histogram of the
+  // registers without any tables. It is unbiased over the whole range of
+  // cardinalities, but reads every register on each estimate.
+  improved,
 };
 
+// `Registers` is the storage policy of the dense registers, see
+// `registers.hpp`. All memory, sparse and dense, is allocated through
+// `Allocator`, e.g. a `std::pmr::polymorphic_allocator` backed by an arena.
+// `Hash` is the hash function of the items, see `hash.hpp`.
 template <typename T, std::uint8_t precision = 14,
-          std::uint8_t sparse_precision = 24>
+          std::uint8_t sparse_precision = 24,
+          typename Registers = hll::byte_registers,
+          typename Allocator = std::allocator<std::uint8_t>,
+          typename Hash = hll::murmur_hash>
 class hyperloglog {
   static_assert(precision > 3, "Precision should be 4 or greater");
   static_assert(precision <= 18, "precision should be 18 or less");
@@ -19,56 +87,152 @@ class hyperloglog {
   static_assert(precision < sparse_precision,
                 "Precision should be less than sparse_precision");
 
+  using registers_type = typename Registers::template rebind<Allocator>;
+
 public:
+  using allocator_type = Allocator;
+  using hasher = Hash;
+
   static constexpr std::uint8_t dense_prec = precision;
   static constexpr std::uint8_t sparse_prec = sparse_precision;
 
   explicit hyperloglog(bool create_dense = false,
-                       std::uint64_t seed = 0x9E3779B97F4A7C15);
-
-  void insert(T item);
-  void merge(const hll::hyperloglog<T, precision, sparse_precision> &other);
+                       std::uint64_t seed = 0x9E3779B97F4A7C15,
+                       const Allocator &alloc = Allocator());
+
+  allocator_type get_allocator() const;
+
+  void insert(const T &item);
+  template <typename InputIt> void insert(InputIt first, InputIt last);
+
+  // Inserts a string given by its bytes into a counter of `std::string`s
+  // without copying it.
+  template <typename U = T, typename = typename std::enable_if<
+                                std::is_same<U, std::string>::value>::type>
+  void insert(const char *data, std::size_t size);
+
+#if __cplusplus >= 201703L
+  // Inserts a string into a counter of `std::string`s without copying it.
+  template <typename S, typename = std::enable_if_t<
+                            std::is_same<S, std::string_view>::value &&
+                            std::is_same<T, std::string>::value>>
+  void insert(S item);
+#endif
+
+  // Insert items that are already hashed, e.g. with `Hash` and the same seed.
+  // Hashes are processed in blocks of `batch_size`.
+  void insert_hash(std::uint64_t hash);
+  void insert_hashes(const std::uint64_t *hashes, std::size_t count);
+
+  void merge(const hll::hyperloglog<T, precision, sparse_precision, Registers,
+                                   Allocator, Hash> &other);
+  void merge(const hll::sketch_view &other);
+
+  // Merges all counters in [first, last), given either as counters or as
+  // pointers to counters, into this one. Sparse counters are combined in a
+  // single k-way merge and dense registers in a single pass, instead of one
+  // `merge()` per counter. With a pool, the dense registers are split into
+  // slices that are merged in parallel.
+  template <typename InputIt> void merge(InputIt first, InputIt last);
+  template <typename InputIt>
+  void merge(InputIt first, InputIt last, hll::thread_pool &pool);
+
+  // Serializes the counter in the format described in `sketch_view.hpp`.
+  std::vector<std::uint8_t> serialize() const;
+  static hll::hyperloglog<T, precision, sparse_precision, Registers, Allocator,
+                          Hash>
+  deserialize(const void *data, std::size_t size,
+              const Allocator &alloc = Allocator());
 
   bool is_sparse() const;
   double estimate() const;
+  double estimate(hll::estimation_method method) const;
   double measure_error(std::size_t original_cardinality) const;
-  const std::vector<std::uint8_t> &dense_vec() const;
+
+  // dense registers, one byte each
+  auto dense_vec() const
+      -> decltype(std::declval<const registers_type &>().values());
+
+  // Representation, memory and register histogram of the counter, see
+  // `instrumentation.hpp`.
+  hll::sketch_stats stats() const;
 
 private:
+  constexpr static int rank_bits = 6; // == log2(64)
+
+  // Sparse entries (index << rank_bits | rank) take 32 bits when they fit.
+  using sparse_entry =
+      typename std::conditional<sparse_precision + rank_bits <= 32,
+                                std::uint32_t, std::uint64_t>::type;
+  using entry_vector = std::vector<
+      sparse_entry, typename std::allocator_traits<
+                        Allocator>::template rebind_alloc<sparse_entry>>;
+
+  // The sparse list is converted to dense registers once it takes as many
+  // bytes as the registers would.
   constexpr static std::size_t sparse_list_max =
-      (1ul << precision) / sizeof(std::uint64_t);
+      Registers::bytes_for(1ul << precision) / sizeof(sparse_entry);
   constexpr static std::size_t temporary_list_max = sparse_list_max / 10;
-  constexpr static int rank_bits = 6; // == log2(64)
+  constexpr static std::size_t batch_size = 64;
 
   bool sparse;
   std::uint64_t seed;
-  std::vector<std::uint8_t> dense;
-  std::vector<std::uint64_t> sparse_list;
-  std::vector<std::uint64_t> temporary_list;
-
-  std::vector<std::uint8_t> converted_to_dense() const;
+  registers_type dense;
+  // harmonic sum of the dense registers, kept up to date on every change
+  simd::register_sums sums;
+  entry_vector sparse_list;
+  entry_vector temporary_list;
+  // reused for sorting entries in non-const methods
+  entry_vector scratch;
+  // number of distinct sparse entries, computed lazily after inserts
+  detail::lazy_count sparse_count;
+
+  registers_type converted_to_dense() const;
   void convert_to_dense();
   void merge_temp();
 
-  std::vector<std::uint64_t> merged_temp_list() const;
-  std::vector<std::uint64_t>
-  merged_sorted_list(const std::vector<std::uint64_t> &other) const;
-
-  double estimate_bias(double biassed_estimate) const;
+  void insert_sparse_block(const std::uint64_t *hashes, std::size_t count);
+  void insert_dense_block(const std::uint64_t *hashes, std::size_t count);
+  void update_register(std::uint64_t index, std::uint8_t rank);
 
-  std::pair<std::uint64_t, std::uint8_t>
-  get_hash_rank(std::uint64_t hash) const;
 
   std::pair<std::uint64_t, std::uint8_t> decode_hash(std::uint64_t hash) const;
 
-  std::uint64_t encode_hash(uint64_t index, uint8_t rank) const;
+  sparse_entry encode_hash(uint64_t index, uint8_t rank) const;
 
   std::pair<double, std::size_t> raw_estimate() const;
-  double linear_estimate(std::size_t non_zero) const;
 
-  constexpr double threshold() const;
-  constexpr double alpha() const;
+  using sorted_range = std::pair<const sparse_entry *, const sparse_entry *>;
+
+  entry_vector merged_temp_list() const;
+
+  template <typename InputIt>
+  void merge_range(InputIt first, InputIt last, hll::thread_pool *pool);
+  void merge_many(const std::vector<const hyperloglog *> &others,
+                  hll::thread_pool *pool);
+  static bool merge_sorted_lists(const std::vector<sorted_range> &lists,
+                                 entry_vector &out,
+                                 std::size_t max_entries);
 };
+
+namespace detail {
+// counter type of an iterator over counters or pointers to counters
+template <typename InputIt>
+using counter_of = typename std::remove_cv<typename std::remove_pointer<
+    typename std::iterator_traits<InputIt>::value_type>::type>::type;
+} // namespace detail
+
+// Union of the counters in [first, last), given either as counters or as
+// pointers to counters. Throws `std::invalid_argument` if the range is empty.
+template <typename InputIt>
+detail::counter_of<InputIt> merge_all(InputIt first, InputIt last);
+template <typename InputIt>
+detail::counter_of<InputIt> merge_all(InputIt first, InputIt last,
+                                      hll::thread_pool &pool);
+
+// Union of the given counters, all of the same type.
+template <typename H, typename... Rest>
+H union_of(const H &first, const Rest &...rest);
 } // namespace hll
 
 #include "../../src/hyperloglog.tpp"
@@ -0,0 +1,118 @@
+#ifndef INCLUDE_HLL_INSTRUMENTATION_HPP_
+#define INCLUDE_HLL_INSTRUMENTATION_HPP_
+
+// Introspection of counters, and opt-in counting and timing of their hot
+// paths.
+//
+// `stats()` of a counter describes its representation, memory and registers
+// at any time. The hot paths of `hll::hyperloglog` and
+// `hll::dynamic_hyperloglog` are only counted and timed when
+// `HLL_ENABLE_INSTRUMENTATION` is defined, e.g. with the CMake option of the
+// same name, and compile to nothing otherwise. It has to be defined the same
+// way in every translation unit that uses the counters.
+//
+// Events are counted per thread without contention and summed over all
+// threads by `snapshot()`, e.g. to export them to a metrics system. The time
+// of an event includes the events it triggers, e.g. inserts include the
+// merges of the temporary list and conversions they cause.
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace hll {
+struct sketch_stats {
+  bool sparse = true;
+  // entries of the sorted sparse list and of the unsorted temporary list, and
+  // the sizes at which the temporary list is merged into the sparse list and
+  // the sparse list is converted to dense registers
+  std::size_t sparse_entries = 0;
+  std::size_t temporary_entries = 0;
+  std::size_t temporary_entries_max = 0;
+  std::size_t sparse_entries_max = 0;
+  // bytes allocated for the sparse lists, including their spare capacity,
+  // and for the dense registers
+  std::size_t sparse_bytes = 0;
+  std::size_t dense_bytes = 0;
+  // `register_histogram[r]` registers have rank r, counting the registers a
+  // sparse counter would convert to
+  std::array<std::size_t, 64> register_histogram{};
+
+  std::size_t bytes() const { return sparse_bytes + dense_bytes; }
+};
+
+namespace instrumentation {
+enum class event : std::uint8_t {
+  insert, // counts items
+  merge_temp,
+  convert_to_dense,
+  // merges of a counter or sketch into another, by their representations
+  merge_sparse_sparse,
+  merge_sparse_dense,
+  merge_dense_dense,
+};
+constexpr std::size_t event_count = 6;
+
+struct totals {
+  std::uint64_t count = 0;
+  std::uint64_t nanoseconds = 0;
+};
+
+const char *name(event e);
+
+// Totals of every event over all threads since the start of the program or
+// the last `reset()`, indexed by event.
+std::array<totals, event_count> snapshot();
+void reset();
+
+// adds to the totals of the calling thread
+void record(event e, std::uint64_t count, std::uint64_t nanoseconds);
+
+// Records `count` events and the time until the end of the scope. Scopes
+// with a count of zero record nothing.
+class scope {
+public:
+  scope(event e, std::uint64_t count) : e(e), count(count) {
+    if (count > 0)
+      start = std::chrono::steady_clock::now();
+  }
+
+  ~scope() {
+    if (count == 0)
+      return;
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    record(e, count,
+           static_cast<std::uint64_t>(
+               std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                   .count()));
+  }
+
+  scope(const scope &) = delete;
+  scope &operator=(const scope &) = delete;
+
+private:
+  event e;
+  std::uint64_t count;
+  std::chrono::steady_clock::time_point start;
+};
+
+// event of a merge of counters with these representations
+inline event merge_event(bool sparse, bool other_sparse) {
+  if (sparse && other_sparse)
+    return event::merge_sparse_sparse;
+  if (!sparse && !other_sparse)
+    return event::merge_dense_dense;
+  return event::merge_sparse_dense;
+}
+} // namespace instrumentation
+} // namespace hll
+
+#ifdef HLL_ENABLE_INSTRUMENTATION
+#define HLL_INSTRUMENT(event, count)                                           \
+  ::hll::instrumentation::scope hll_instrumentation_scope((event), (count))
+#else
+#define HLL_INSTRUMENT(event, count) static_cast<void>(0)
+#endif
+
+#endif // INCLUDE_HLL_INSTRUMENTATION_HPP_
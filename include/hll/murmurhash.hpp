@@ -5,11 +5,18 @@
 // the reference implementation, this version only returns the first 64bits of
 // the result, as well as receiving a 64-bit seed instead of a 32-bit seed.
 
+#include <cstddef>
 #include <cstdint>
 
 namespace hll {
   std::uint64_t murmurhash3_x64_128(
       const void* key, int len, std::uint64_t seed);
+
+  // Same as `murmurhash3_x64_128(key, len + 1, seed)` where `key[len]` is a
+  // zero byte, i.e. the hash of a NUL-terminated string including its
+  // terminator, but without reading the terminator.
+  std::uint64_t murmurhash3_x64_128_terminated(
+      const void* key, std::size_t len, std::uint64_t seed);
 }  // namespace hll
 
 #endif  // INCLUDE_HLL_MURMURHASH_HPP_
@@ -0,0 +1,115 @@
+#ifndef INCLUDE_HLL_REGISTERS_HPP_
+#define INCLUDE_HLL_REGISTERS_HPP_
+
+// Storage policies for the dense registers of `hll::hyperloglog`. A policy
+// holds a fixed number of zero-initialised registers, each up to 6 bits, and
+// provides:
+//
+//   // rebinds the policy to another allocator
+//   template <typename Allocator> using rebind = ...;
+//   X(std::size_t count, const Allocator &alloc);
+//   // bytes taken by `count` registers
+//   static constexpr std::size_t bytes_for(std::size_t count);
+//   std::size_t size() const;
+//   std::size_t size_in_bytes() const;
+//   std::uint8_t get(std::size_t index) const;
+//   // sets the register to max(current, rank), returning the previous value
+//   std::uint8_t update(std::size_t index, std::uint8_t rank);
+//   void prefetch(std::size_t index) const;
+//   void merge(const X &other);                        // register-wise max
+//   // register-wise max of registers [first, last) with all of `others`,
+//   // `first` being a multiple of 64
+//   void merge(const X *const *others, std::size_t count, std::size_t first,
+//              std::size_t last);
+//   hll::simd::register_sums sums() const;
+//   values() const;                                    // one byte a register
+//
+// `sums()` accumulates all registers into an `hll::simd::register_sums`, so
+// every policy gives exactly the same harmonic sum for the same registers.
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "simd.hpp"
+
+namespace hll {
+// One byte per register. Fastest to update, but two bits of every register
+// are never used.
+template <typename Allocator = std::allocator<std::uint8_t>>
+class basic_byte_registers {
+public:
+  template <typename A> using rebind = basic_byte_registers<A>;
+
+  explicit basic_byte_registers(std::size_t count = 0,
+                                const Allocator &alloc = Allocator());
+
+  static constexpr std::size_t bytes_for(std::size_t count) { return count; }
+
+  std::size_t size() const;
+  std::size_t size_in_bytes() const;
+  std::uint8_t get(std::size_t index) const;
+  std::uint8_t update(std::size_t index, std::uint8_t rank);
+  void prefetch(std::size_t index) const;
+  void merge(const basic_byte_registers &other);
+  void merge(const basic_byte_registers *const *others, std::size_t count,
+             std::size_t first, std::size_t last);
+  simd::register_sums sums() const;
+  const std::vector<std::uint8_t, Allocator> &values() const;
+
+private:
+  std::vector<std::uint8_t, Allocator> registers;
+};
+
+// Registers packed back to back into 6 bits, i.e. 32 registers in every three
+// 64-bit words, using 25% less memory than `byte_registers`. Within a group
+// of three words each word holds ten whole registers, at bit offsets 0, 2 and
+// 4 respectively, and the remaining two registers straddle the word
+// boundaries. Merges compare ten registers at a time inside each word.
+template <typename Allocator = std::allocator<std::uint8_t>>
+class basic_packed_registers {
+public:
+  template <typename A> using rebind = basic_packed_registers<A>;
+
+  explicit basic_packed_registers(std::size_t count = 0,
+                                  const Allocator &alloc = Allocator());
+
+  static constexpr std::size_t bytes_for(std::size_t count) {
+    return (count + 31) / 32 * 3 * sizeof(std::uint64_t);
+  }
+
+  std::size_t size() const;
+  std::size_t size_in_bytes() const;
+  std::uint8_t get(std::size_t index) const;
+  std::uint8_t update(std::size_t index, std::uint8_t rank);
+  void prefetch(std::size_t index) const;
+  void merge(const basic_packed_registers &other);
+  void merge(const basic_packed_registers *const *others, std::size_t count,
+             std::size_t first, std::size_t last);
+  simd::register_sums sums() const;
+  std::vector<std::uint8_t> values() const;
+
+private:
+  constexpr static int register_bits = 6;
+  constexpr static std::uint64_t register_mask = (1u << register_bits) - 1;
+
+  using word_allocator = typename std::allocator_traits<
+      Allocator>::template rebind_alloc<std::uint64_t>;
+
+  std::size_t count;
+  std::vector<std::uint64_t, word_allocator> words;
+
+  void set(std::size_t index, std::uint8_t rank);
+  void merge_words(const std::uint64_t *other, std::size_t first,
+                   std::size_t last);
+};
+
+using byte_registers = basic_byte_registers<>;
+using packed_registers = basic_packed_registers<>;
+} // namespace hll
+
+#include "../../src/registers.tpp"
+
+#endif // INCLUDE_HLL_REGISTERS_HPP_
@@ -0,0 +1,111 @@
+#ifndef INCLUDE_HLL_SIMD_HPP_
+#define INCLUDE_HLL_SIMD_HPP_
+
+// Vectorised kernels over arrays of one-byte registers and of integer keys.
+// The implementation is chosen once at runtime based on the instruction sets
+// the CPU supports, with a portable fallback for other compilers and
+// architectures.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace hll {
+namespace simd {
+enum class instruction_set { portable, sse2, avx2, avx512 };
+
+// Harmonic sum of registers, accumulated exactly in fixed point: a register
+// r <= 32 adds 2^(32 - r) to `high` and a larger one adds 2^(63 - r) to `low`.
+// The result therefore does not depend on the order or the kernel that the
+// registers were summed with. Neither sum overflows below 2^31 registers.
+struct register_sums {
+  std::uint64_t high = 0;
+  std::uint64_t low = 0;
+  std::size_t non_zeros = 0;
+
+  void add(std::uint8_t rank) {
+    non_zeros += rank > 0;
+    high += high_part(rank);
+    low += low_part(rank);
+  }
+
+  void remove(std::uint8_t rank) {
+    non_zeros -= rank > 0;
+    high -= high_part(rank);
+    low -= low_part(rank);
+  }
+
+  // sum of 2^-r over the accumulated registers
+  double harmonic_sum() const {
+    return std::ldexp(static_cast<double>(high), -32) +
+           std::ldexp(static_cast<double>(low), -63);
+  }
+
+  // branch-free, as registers are close to random
+  static std::uint64_t high_part(std::uint8_t rank) {
+    return (std::uint64_t{1} << 32) >> rank;
+  }
+
+  static std::uint64_t low_part(std::uint8_t rank) {
+    std::uint64_t is_low = rank > 32;
+    return ((std::uint64_t{1} << 63) >> rank) & (0 - is_low);
+  }
+};
+
+struct kernels {
+  instruction_set isa;
+
+  // dst[i] = max(dst[i], src[i])
+  void (*max_registers)(std::uint8_t *dst, const std::uint8_t *src,
+                        std::size_t count);
+
+  // dst[i] = max(dst[i], srcs[0][i], ..., srcs[sources - 1][i]) in a single
+  // pass over `dst`
+  void (*max_registers_many)(std::uint8_t *dst,
+                             const std::uint8_t *const *srcs,
+                             std::size_t sources, std::size_t count);
+
+  // adds `count` registers, each at most 63, to `sums`
+  void (*accumulate)(const std::uint8_t *registers, std::size_t count,
+                     register_sums &sums);
+
+  // out[i] = hll::integer_hash{}(keys[i], seed), see `hash.hpp`
+  void (*integer_hashes)(const std::uint64_t *keys, std::size_t count,
+                         std::uint64_t seed, std::uint64_t *out);
+};
+
+// most capable instruction set supported by this CPU
+instruction_set best_instruction_set();
+bool is_supported(instruction_set isa);
+const char *name(instruction_set isa);
+
+// kernels of the best supported instruction set
+const kernels &best_kernels();
+
+// kernels of a specific instruction set, mostly for tests and benchmarks.
+// Throws `std::invalid_argument` if the CPU does not support it.
+const kernels &kernels_for(instruction_set isa);
+
+inline void max_registers(std::uint8_t *dst, const std::uint8_t *src,
+                          std::size_t count) {
+  best_kernels().max_registers(dst, src, count);
+}
+
+inline void max_registers(std::uint8_t *dst, const std::uint8_t *const *srcs,
+                          std::size_t sources, std::size_t count) {
+  best_kernels().max_registers_many(dst, srcs, sources, count);
+}
+
+inline void accumulate(const std::uint8_t *registers, std::size_t count,
+                       register_sums &sums) {
+  best_kernels().accumulate(registers, count, sums);
+}
+
+inline void integer_hashes(const std::uint64_t *keys, std::size_t count,
+                           std::uint64_t seed, std::uint64_t *out) {
+  best_kernels().integer_hashes(keys, count, seed, out);
+}
+} // namespace simd
+} // namespace hll
+
+#endif // INCLUDE_HLL_SIMD_HPP_
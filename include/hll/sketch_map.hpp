@@ -0,0 +1,139 @@
+#ifndef INCLUDE_HLL_SKETCH_MAP_HPP_
+#define INCLUDE_HLL_SKETCH_MAP_HPP_
+
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "hyperloglog.hpp"
+
+namespace hll {
+// One counter of `T`s per key, for millions of keys that mostly see a few
+// items each, e.g. distinct visitors per URL.
+//
+// A `hll::hyperloglog` per key costs three vectors and a reserved temporary
+// list before its first item. Here the sparse entries of all keys share one
+// arena, split into blocks of 2, 4, 8, ... entries that are reused through
+// free lists, and a key only takes a block of 2^precision dense registers once
+// its sparse entries would take as many bytes, as in `hll::hyperloglog`.
+//
+// New entries are appended to the block of a key and only sorted and
+// deduplicated when the block is full, before it grows to the next size.
+template <typename Key, typename T, std::uint8_t precision = 14,
+          std::uint8_t sparse_precision = 24,
+          typename Hash = hll::murmur_hash, typename KeyHash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>>
+class sketch_map {
+  static_assert(precision > 3, "Precision should be 4 or greater");
+  static_assert(precision <= 18, "precision should be 18 or less");
+  static_assert(sparse_precision <= 58,
+                "Sparse precision should be 58 or less");
+  static_assert(precision < sparse_precision,
+                "Precision should be less than sparse_precision");
+
+public:
+  using key_type = Key;
+  using hasher = Hash;
+
+  static constexpr std::uint8_t dense_prec = precision;
+  static constexpr std::uint8_t sparse_prec = sparse_precision;
+
+  explicit sketch_map(std::uint64_t seed = 0x9E3779B97F4A7C15);
+
+  // number of keys
+  std::size_t size() const;
+  bool contains(const Key &key) const;
+  // number of keys with dense registers
+  std::size_t dense_count() const;
+  // Approximate bytes used by the keys, the arena and the dense registers.
+  std::size_t memory_usage() const;
+  void reserve(std::size_t keys);
+
+  void insert(const Key &key, const T &item);
+  // Inserts the (key, item) pairs of [first, last), forward iterators over
+  // e.g. `std::pair<Key, T>`. Items are hashed in blocks and runs of the same
+  // key are looked up once.
+  template <typename InputIt,
+            typename = decltype(std::declval<typename std::iterator_traits<
+                                    InputIt>::value_type>()
+                                    .first)>
+  void insert(InputIt first, InputIt last);
+  // Insert an item that is already hashed, e.g. with `Hash` and the same seed.
+  void insert_hash(const Key &key, std::uint64_t hash);
+
+  // Merges the counters of every key of `other` into those of this map.
+  void merge(const hll::sketch_map<Key, T, precision, sparse_precision, Hash,
+                                   KeyHash, KeyEqual> &other);
+
+  // Estimate of the number of distinct items of `key`, 0 if it has none.
+  double estimate(const Key &key) const;
+  // Calls `f(key, estimate)` for every key, in no particular order.
+  template <typename F> void for_each_estimate(F f) const;
+
+  // Serializes the counter of `key` in the format described in
+  // `sketch_view.hpp`, e.g. to deserialize it as a `hll::hyperloglog`.
+  // Throws `std::invalid_argument` if the key has no items.
+  std::vector<std::uint8_t> serialize(const Key &key) const;
+
+private:
+  constexpr static int rank_bits = 6; // == log2(64)
+  constexpr static std::size_t batch_size = 64;
+  constexpr static std::size_t registers = std::size_t{1} << precision;
+
+  using sparse_entry =
+      typename std::conditional<sparse_precision + rank_bits <= 32,
+                                std::uint32_t, std::uint64_t>::type;
+
+  constexpr static std::size_t sparse_list_max =
+      hll::byte_registers::bytes_for(registers) / sizeof(sparse_entry);
+  constexpr static std::size_t min_block = 2;
+
+  struct slot {
+    // first entry of the block in `arena`, or index of the dense block
+    std::uint32_t offset = 0;
+    // entries in the block, of which the first `sorted` are sorted and
+    // deduplicated
+    std::uint32_t size = 0;
+    std::uint32_t sorted = 0;
+    // the block holds `min_block << size_class` entries
+    std::uint8_t size_class = 0;
+    bool dense = false;
+  };
+
+  std::uint64_t seed;
+  std::unordered_map<Key, slot, KeyHash, KeyEqual> slots;
+  std::vector<sparse_entry> arena;
+  // offsets of free blocks of each size class
+  std::vector<std::vector<std::uint32_t>> free_blocks;
+  std::vector<std::uint8_t> dense_registers;
+  // harmonic sums of each dense block, kept up to date on every change
+  std::vector<simd::register_sums> dense_sums;
+
+  static std::size_t capacity(const slot &s);
+  std::uint32_t allocate_block(std::uint8_t size_class);
+  void free_block(const slot &s);
+
+  slot &slot_of(const Key &key);
+  void insert_hash(slot &s, std::uint64_t hash);
+  void prefetch(const slot &s, std::uint64_t hash) const;
+  void update_register(const slot &s, std::uint64_t index, std::uint8_t rank);
+  void compact(slot &s);
+  void grow(slot &s);
+  void convert_to_dense(slot &s);
+  std::size_t sparse_count(const slot &s) const;
+  double estimate(const slot &s) const;
+
+  template <typename InputIt>
+  void insert_range(InputIt first, InputIt last, std::true_type);
+  template <typename InputIt>
+  void insert_range(InputIt first, InputIt last, std::false_type);
+};
+} // namespace hll
+
+#include "../../src/sketch_map.tpp"
+
+#endif // INCLUDE_HLL_SKETCH_MAP_HPP_
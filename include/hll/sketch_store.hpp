@@ -0,0 +1,170 @@
+#ifndef INCLUDE_HLL_SKETCH_STORE_HPP_
+#define INCLUDE_HLL_SKETCH_STORE_HPP_
+
+// A file of sketches of many series over time, e.g. an hourly counter of
+// distinct visitors per page, that answers the number of distinct items of a
+// series over any range of time straight from a memory mapping of the file.
+//
+// The file starts with a 64-byte header, all integers little-endian:
+//
+//   offset  size  field
+//        0     8  magic, "HLLSTORE"
+//        8     1  format version
+//        9     1  precision
+//       10     1  sparse precision
+//       11     1  hash function, the `id` of the hash policy, see `hash.hpp`
+//       12     1  number of rollup levels, at most 4
+//       13     3  reserved, zero
+//       16     8  seed
+//       24     8  end of the last complete record
+//       32    32  width of the periods of each rollup level
+//
+// followed by records, each a 32-byte header and a payload padded to a
+// multiple of 8 bytes:
+//
+//   offset  size  field
+//        0     1  kind, see `record_kind`
+//        1     1  rollup level
+//        2     2  reserved, zero
+//        4     4  series, numbered in order of their name records
+//        8     8  timestamp, or the start of the period of a rollup
+//       16     8  payload size in bytes
+//       24     8  number of sparse entries
+//
+// A dense payload is a fixed-size block of 2^precision one-byte registers,
+// merged with the same SIMD kernels as in-memory registers. A sparse payload
+// is the sorted, deduplicated sparse entries (index << 6 | rank), 4 bytes
+// each if sparse precision + 6 <= 32 and 8 bytes otherwise.
+//
+// Records are only appended, except for the dense registers of rollups, which
+// merge every sketch of their period and are updated in place. The end offset
+// in the header is written after the record, so a record that was cut short
+// is ignored on the next open. The index from (series, timestamp) to records
+// is rebuilt from the record headers when a file is opened.
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hash.hpp"
+#include "sketch_view.hpp"
+
+namespace hll {
+class sketch_store {
+public:
+  struct settings {
+    std::uint8_t precision = 14;
+    std::uint8_t sparse_precision = 24;
+    // `id` of the hash policy of the sketches
+    std::uint8_t hash_id = hll::murmur_hash::id;
+    std::uint64_t seed = 0x9E3779B97F4A7C15;
+    // Widths of the periods of the rollups, each a multiple of the one before,
+    // e.g. {24, 168} for days and weeks of hourly timestamps. Periods start
+    // at multiples of their width.
+    std::vector<std::uint64_t> rollups;
+  };
+
+  // Creates a store at `path`, throwing `std::runtime_error` if the file
+  // exists or cannot be created and `std::invalid_argument` if `s` is invalid.
+  static hll::sketch_store create(const std::string &path, const settings &s);
+
+  // Opens an existing store. A read-only store can be opened by many
+  // processes at once, but throws `std::logic_error` on `append()`.
+  explicit sketch_store(const std::string &path, bool read_only = false);
+  ~sketch_store();
+
+  sketch_store(sketch_store &&other) noexcept;
+  sketch_store &operator=(sketch_store &&other) noexcept;
+  sketch_store(const sketch_store &) = delete;
+  sketch_store &operator=(const sketch_store &) = delete;
+
+  std::uint8_t precision() const;
+  std::uint8_t sparse_precision() const;
+  std::uint8_t hash_id() const;
+  std::uint64_t seed() const;
+  const std::vector<std::uint64_t> &rollups() const;
+
+  // number of sketches appended
+  std::size_t size() const;
+  bool contains(const std::string &series) const;
+
+  // Appends the sketch of `series` at `time` and merges it into the rollups
+  // of its periods. Several sketches of the same series and time are all
+  // kept. Throws `std::invalid_argument` unless the sketch has the precisions,
+  // hash function and seed of the store, e.g. after
+  // `dynamic_hyperloglog::reduce_precision()`.
+  void append(const std::string &series, std::uint64_t time,
+              const hll::sketch_view &sketch);
+
+  // Writes the changes to the file before returning.
+  void flush();
+
+  // Union of the sketches of `series` with timestamps in [from, to),
+  // serialized in the format of `sketch_view.hpp`. Whole rollup periods in
+  // the range are read from the rollups instead of the sketches. The result
+  // is sparse only if all sketches read are sparse and their union fits in
+  // as many bytes as the dense registers, like a `dynamic_hyperloglog` that
+  // merged them; using a rollup makes it dense.
+  std::vector<std::uint8_t> union_range(const std::string &series,
+                                        std::uint64_t from,
+                                        std::uint64_t to) const;
+  // estimate of `union_range(series, from, to)`
+  double estimate(const std::string &series, std::uint64_t from,
+                  std::uint64_t to) const;
+
+  enum class record_kind : std::uint8_t {
+    series = 0, // the payload is the name of the series
+    sparse = 1,
+    dense = 2,
+    rollup = 3, // dense registers of a rollup period
+  };
+
+private:
+  struct mapping;
+  struct series_index {
+    // offsets of the records of sketches by timestamp
+    std::multimap<std::uint64_t, std::uint64_t> sketches;
+    // offsets of the rollup records of each level by start of period
+    std::vector<std::map<std::uint64_t, std::uint64_t>> rollups;
+  };
+  class range_union;
+
+  std::unique_ptr<mapping> file;
+  bool read_only;
+  std::uint8_t p, sp, hash;
+  std::uint64_t hash_seed;
+  std::vector<std::uint64_t> widths;
+  std::size_t sketches;
+
+  std::unordered_map<std::string, std::uint32_t> series_ids;
+  std::vector<series_index> index;
+
+  sketch_store();
+
+  std::size_t registers() const;
+  std::size_t entry_bytes() const;
+  std::uint64_t end() const;
+  void set_end(std::uint64_t end);
+
+  void load();
+  void index_record(std::uint64_t offset);
+  // appends a record and its payload, written by `fill(payload)`
+  template <typename Fill>
+  std::uint64_t append_record(record_kind kind, std::uint8_t level,
+                              std::uint32_t series, std::uint64_t time,
+                              std::uint64_t payload, std::uint64_t entries,
+                              Fill fill);
+  std::uint32_t series_id(const std::string &series);
+  std::uint8_t *rollup_registers(std::uint32_t series, std::size_t level,
+                                 std::uint64_t start);
+
+  void merge_range(const std::string &series, std::uint64_t from,
+                   std::uint64_t to, range_union &result) const;
+};
+} // namespace hll
+
+#endif // INCLUDE_HLL_SKETCH_STORE_HPP_
@@ -0,0 +1,118 @@
+#ifndef INCLUDE_HLL_SKETCH_VIEW_HPP_
+#define INCLUDE_HLL_SKETCH_VIEW_HPP_
+
+// Wire format of a serialized `hll::hyperloglog`, all integers little-endian:
+//
+//   offset  size  field
+//        0     2  magic, "HL"
+//        2     1  format version
+//        3     1  precision
+//        4     1  sparse precision
+//        5     1  representation, 0 for sparse and 1 for dense
+//        6     1  hash function, the `id` of the hash policy, see `hash.hpp`
+//        7     1  reserved, zero
+//        8     8  seed
+//       16        payload
+//
+// The sparse payload is the number of entries followed by the sorted,
+// deduplicated sparse entries (index << 6 | rank), each stored as the
+// difference to the previous entry. All of these are unsigned LEB128 varints.
+//
+// The dense payload is the 2^precision registers packed into 6 bits each,
+// starting from the least significant bits of the first byte.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace hll {
+namespace format {
+constexpr std::uint8_t magic[2] = {'H', 'L'};
+constexpr std::uint8_t version = 1;
+constexpr std::size_t header_size = 16;
+constexpr int rank_bits = 6;
+
+enum class representation : std::uint8_t { sparse = 0, dense = 1 };
+
+constexpr std::size_t dense_payload_size(std::uint8_t precision) {
+  return ((std::size_t{1} << precision) * rank_bits + 7) / 8;
+}
+} // namespace format
+
+// Read-only view of a serialized sketch. The view does not copy or own the
+// buffer, which has to outlive it. The buffer is validated once on
+// construction, throwing `std::invalid_argument` if it is malformed.
+class sketch_view {
+public:
+  sketch_view(const void *data, std::size_t size);
+
+  std::uint8_t precision() const;
+  std::uint8_t sparse_precision() const;
+  std::uint64_t seed() const;
+  // `id` of the hash policy of the sketch, 0 for `hll::murmur_hash`
+  std::uint8_t hash_id() const;
+  bool is_sparse() const;
+
+  // number of bytes of the buffer taken by this sketch
+  std::size_t size() const;
+
+  double estimate() const;
+
+  // register `index` of a dense sketch
+  std::uint8_t dense_register(std::size_t index) const;
+
+  // number of entries of a sparse sketch
+  std::size_t sparse_size() const;
+
+  // calls `f(index, rank)` for each entry of a sparse sketch in increasing
+  // order of index
+  template <typename F> void for_each_sparse(F f) const;
+
+private:
+  const std::uint8_t *data;
+  std::size_t total_size;
+  std::size_t entries;
+  std::uint8_t p, sp;
+  bool sparse;
+
+  std::size_t payload_offset;
+};
+
+namespace format {
+// reads an unsigned LEB128 varint at `data[offset]`, advancing `offset`.
+// Returns false if the buffer ends before the varint does.
+inline bool read_varint(const std::uint8_t *data, std::size_t size,
+                        std::size_t &offset, std::uint64_t &value) {
+  value = 0;
+  for (int shift = 0; shift < 64 && offset < size; shift += 7) {
+    std::uint8_t byte = data[offset++];
+    value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+inline void write_varint(std::vector<std::uint8_t> &out, std::uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<std::uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<std::uint8_t>(value));
+}
+} // namespace format
+
+template <typename F> void sketch_view::for_each_sparse(F f) const {
+  std::size_t offset = payload_offset;
+  std::uint64_t entry = 0;
+  for (std::size_t i = 0; i < entries; i++) {
+    std::uint64_t delta;
+    format::read_varint(data, total_size, offset, delta);
+    entry += delta;
+    f(entry >> format::rank_bits,
+      static_cast<std::uint8_t>(entry & ((1u << format::rank_bits) - 1)));
+  }
+}
+} // namespace hll
+
+#endif // INCLUDE_HLL_SKETCH_VIEW_HPP_
@@ -0,0 +1,120 @@
+#ifndef INCLUDE_HLL_SLIDING_HYPERLOGLOG_HPP_
+#define INCLUDE_HLL_SLIDING_HYPERLOGLOG_HPP_
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "hyperloglog.hpp"
+
+namespace hll {
+// Counts distinct items in sliding time windows, as in Sliding HyperLogLog
+// (Chabchoub and Hebrail, 2010). Instead of a rank, each register keeps the
+// (timestamp, rank) pairs that could still be its maximum in some window
+// ending at the latest timestamp: a pair is dropped once a newer pair with an
+// equal or higher rank arrives. A window of any length up to `max_window` is
+// then estimated in a single pass over the registers, with the estimator of a
+// dense `hll::hyperloglog`.
+//
+// Timestamps are in any unit, e.g. seconds, and should be less than 2^58.
+// Items may arrive out of order. Pairs older than `max_window` before the
+// latest timestamp are evicted whenever their register is updated, on
+// merges, and one register per inserted hash in turn, so that registers that
+// are not updated any more do not keep them.
+//
+// The pairs of all registers share one arena, split into blocks of 2, 4, ...
+// 64 pairs that are reused through free lists, as in `hll::sketch_map`. A
+// register keeps at most 64 - precision pairs, as their ranks decrease, and
+// an empty register takes no block.
+template <typename T, std::uint8_t precision = 14,
+          typename Hash = hll::murmur_hash>
+class sliding_hyperloglog {
+  static_assert(precision > 3, "Precision should be 4 or greater");
+  static_assert(precision <= 18, "precision should be 18 or less");
+
+public:
+  using hasher = Hash;
+  using timestamp = std::uint64_t;
+
+  static constexpr std::uint8_t dense_prec = precision;
+
+  explicit sliding_hyperloglog(timestamp max_window,
+                               std::uint64_t seed = 0x9E3779B97F4A7C15);
+
+  timestamp max_window() const;
+  // latest timestamp inserted so far, 0 if none
+  timestamp latest() const;
+
+  void insert(const T &item, timestamp time);
+  // inserts all items in [first, last) at the same time
+  template <typename InputIt>
+  void insert(InputIt first, InputIt last, timestamp time);
+
+  // Inserts a string given by its bytes into a counter of `std::string`s
+  // without copying it.
+  template <typename U = T, typename = typename std::enable_if<
+                                std::is_same<U, std::string>::value>::type>
+  void insert(const char *data, std::size_t size, timestamp time);
+
+  // Insert items that are already hashed, e.g. with `Hash` and the same seed.
+  void insert_hash(std::uint64_t hash, timestamp time);
+  void insert_hashes(const std::uint64_t *hashes, std::size_t count,
+                     timestamp time);
+
+  // Union of the two streams, keeping the smaller `max_window`.
+  void merge(const hll::sliding_hyperloglog<T, precision, Hash> &other);
+
+  // Number of distinct items inserted at or after `since`. Throws
+  // `std::invalid_argument` if `since` is further than `max_window` before
+  // the latest timestamp, and is zero if `since` is after it. The second
+  // overload estimates the whole window.
+  double estimate(timestamp since) const;
+  double estimate() const;
+
+  // dense registers of the window starting at `since`, one byte each, i.e.
+  // those of a `hll::hyperloglog` that counted only the items of the window
+  std::vector<std::uint8_t> dense_vec(timestamp since) const;
+
+  // number of (timestamp, rank) pairs kept by all registers
+  std::size_t candidates() const;
+
+private:
+  constexpr static int rank_bits = 6; // == log2(64)
+  constexpr static std::size_t batch_size = 64;
+
+  constexpr static std::size_t min_block = 2;
+  constexpr static std::size_t size_classes = 6;
+
+  // Pairs (timestamp << rank_bits | rank) of a register, sorted by increasing
+  // timestamp and so by decreasing rank.
+  struct pair_list {
+    // first pair of the block in `arena`
+    std::uint32_t offset = 0;
+    std::uint8_t size = 0;
+    // the block holds `min_block << size_class` pairs
+    std::uint8_t size_class = 0;
+  };
+
+  timestamp window;
+  timestamp newest;
+  std::uint64_t seed;
+  std::vector<pair_list> registers;
+  std::vector<std::uint64_t> arena;
+  // offsets of free blocks of each size class
+  std::vector<std::vector<std::uint32_t>> free_blocks;
+  // next register evicted by inserts
+  std::size_t sweep;
+
+  timestamp oldest_kept() const;
+  void check_window(timestamp since) const;
+  std::uint32_t allocate_block(std::uint8_t size_class);
+  void evict(std::size_t index);
+  void update_register(std::uint64_t index, std::uint8_t rank, timestamp time);
+  std::uint8_t rank_since(const pair_list &pairs, timestamp since) const;
+};
+} // namespace hll
+
+#include "../../src/sliding_hyperloglog.tpp"
+
+#endif // INCLUDE_HLL_SLIDING_HYPERLOGLOG_HPP_
@@ -0,0 +1,57 @@
+#ifndef INCLUDE_HLL_THREAD_POOL_HPP_
+#define INCLUDE_HLL_THREAD_POOL_HPP_
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hll {
+// A fixed set of worker threads for data-parallel loops, e.g. for merging many
+// counters with `hll::merge_all()`.
+class thread_pool {
+public:
+  // `threads` counts the calling thread as well, so a pool of size one does
+  // all the work on the calling thread. Zero uses the number of hardware
+  // threads.
+  explicit thread_pool(std::size_t threads = 0);
+  ~thread_pool();
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  std::size_t size() const;
+
+  // Calls `f(i)` for every `i` in [0, count) on the workers and the calling
+  // thread and returns once all calls are done. The first exception thrown by
+  // `f` is rethrown here. Concurrent calls run one after the other, so `f`
+  // should not call `parallel_for()` on the same pool.
+  template <typename F> void parallel_for(std::size_t count, F &&f) {
+    run(count, std::function<void(std::size_t)>(std::ref(f)));
+  }
+
+private:
+  std::vector<std::thread> workers;
+
+  std::mutex run_lock; // serialises `run()`
+  std::mutex lock;     // guards everything below
+  std::condition_variable wake;
+  std::condition_variable done;
+  bool stopping = false;
+
+  const std::function<void(std::size_t)> *job = nullptr;
+  std::size_t job_size = 0;
+  std::size_t next = 0;
+  std::size_t finished = 0;
+  std::exception_ptr error;
+
+  void run(std::size_t count, const std::function<void(std::size_t)> &f);
+  void work();
+  void process(std::unique_lock<std::mutex> &guard);
+};
+} // namespace hll
+
+#endif // INCLUDE_HLL_THREAD_POOL_HPP_
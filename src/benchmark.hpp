@@ -0,0 +1,42 @@
+#ifndef SRC_BENCHMARK_HPP_
+#define SRC_BENCHMARK_HPP_
+
+// Small timing helpers shared by the benchmark executables.
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace bench {
+  // Keeps the compiler from discarding a computed value.
+  template <typename V>
+  void keep(const V& value) {
+    static volatile V sink;
+    sink = value;
+  }
+
+  // The splitmix64 finalizer, a cheap bijective mix of 64-bit numbers, so
+  // that generated data does not depend on the standard library.
+  inline std::uint64_t splitmix64(std::uint64_t z) {
+    z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27))*0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+
+  // Runs `f` `repeats` times and returns the fastest run in seconds.
+  template <typename F>
+  double best_of(std::size_t repeats, F&& f) {
+    double best = 0;
+    for (std::size_t r = 0; r < repeats; r++) {
+      auto start = std::chrono::steady_clock::now();
+      f();
+      std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+      if (r == 0 || elapsed.count() < best)
+        best = elapsed.count();
+    }
+    return best;
+  }
+}  // namespace bench
+
+#endif  // SRC_BENCHMARK_HPP_
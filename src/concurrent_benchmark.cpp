@@ -0,0 +1,62 @@
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/hll/concurrent_hyperloglog.hpp"
+#include "../include/hll/hyperloglog.hpp"
+#include "benchmark.hpp"
+
+// Inserts `count` distinct items into one shared counter from a growing
+// number of threads and reports throughput relative to a single-threaded
+// `hll::hyperloglog`.
+template <std::uint8_t precision>
+void benchmark_threads(std::size_t count, std::size_t repeats,
+    std::size_t max_threads) {
+  double baseline = bench::best_of(repeats, [&]() {
+    hll::hyperloglog<std::uint64_t, precision, 25> h;
+    for (std::size_t i = 0; i < count; i++)
+      h.insert(i);
+    bench::keep(h.estimate());
+  });
+  double n = static_cast<double>(count);
+  std::cout << "p=" << +precision << " hyperloglog: " << std::fixed
+    << std::setprecision(2) << n/baseline/1e6 << " M items/s\n";
+
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    double elapsed = bench::best_of(repeats, [&]() {
+      hll::concurrent_hyperloglog<std::uint64_t, precision, 25> h;
+      std::vector<std::thread> workers;
+      for (std::size_t t = 0; t < threads; t++)
+        workers.emplace_back([&h, count, threads, t]() {
+          for (std::size_t i = t; i < count; i += threads)
+            h.insert(i);
+        });
+      for (auto& w: workers)
+        w.join();
+      bench::keep(h.estimate());
+    });
+
+    std::cout << "p=" << +precision << " concurrent, " << std::setw(2)
+      << threads << " threads: " << n/elapsed/1e6 << " M items/s (x"
+      << baseline/elapsed << ")\n";
+  }
+}
+
+int main(int argc, char* argv[]) {
+  std::size_t count = 1ul << 24;
+  std::size_t repeats = 3;
+  std::size_t max_threads = 64;
+  if (argc > 1)
+    count = std::stoul(argv[1]);
+  if (argc > 2)
+    repeats = std::stoul(argv[2]);
+  if (argc > 3)
+    max_threads = std::stoul(argv[3]);
+
+  benchmark_threads<14>(count, repeats, max_threads);
+  benchmark_threads<18>(count, repeats, max_threads);
+  return 0;
+}
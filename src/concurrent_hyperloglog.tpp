@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <thread>
+
+template <typename T, std::uint8_t p, std::uint8_t sp>
+hll::concurrent_hyperloglog<T, p, sp>::concurrent_hyperloglog(
+    bool create_dense, std::uint64_t seed)
+    : seed(seed), sparse(!create_dense), promoting(create_dense),
+      drained(create_dense), staged(0), dense(nullptr) {
+  if (create_dense) {
+    dense_storage.reset(new std::atomic<std::uint8_t>[1ul << p]());
+    dense.store(dense_storage.get(), std::memory_order_release);
+  }
+}
+
+template <typename T, std::uint8_t p, std::uint8_t sp>
+bool hll::concurrent_hyperloglog<T, p, sp>::is_sparse() const {
+  return sparse.load(std::memory_order_acquire);
+}
+
+// Threads are assigned shards round-robin the first time they insert.
+template <typename T, std::uint8_t p, std::uint8_t sp>
+std::size_t hll::concurrent_hyperloglog<T, p, sp>::shard_index() {
+  static std::atomic<std::size_t> next_shard{0};
+  thread_local std::size_t index =
+      next_shard.fetch_add(1, std::memory_order_relaxed) % shard_count;
+  return index;
+}
+
+// sorts the entries and keeps the highest rank of each index
+template <typename T, std::uint8_t p, std::uint8_t sp>
+void hll::concurrent_hyperloglog<T, p, sp>::compact(
+    std::vector<std::uint64_t> &entries) {
+  std::sort(entries.begin(), entries.end());
+  std::size_t out = 0;
+  for (std::size_t i = 0; i < entries.size(); i++) {
+    if (out > 0 && (entries[out - 1] >> rank_bits) == (entries[i] >> rank_bits))
+      entries[out - 1] = entries[i];
+    else
+      entries[out++] = entries[i];
+  }
+  entries.resize(out);
+}
+
+template <typename T, std::uint8_t p, std::uint8_t sp>
+void hll::concurrent_hyperloglog<T, p, sp>::insert(const T &item) {
+  insert_hash(hll::hash<T>{}(item, seed));
+}
+
+template <typename T, std::uint8_t p, std::uint8_t sp>
+void hll::concurrent_hyperloglog<T, p, sp>::insert_hash(std::uint64_t hash) {
+  std::uint64_t index;
+  std::uint8_t rank;
+
+  if (sparse.load(std::memory_order_acquire)) {
+    std::tie(index, rank) = detail::hash_rank(hash, sp);
+    bool staged_entry = false;
+    std::size_t total = 0;
+    {
+      shard &s = shards[shard_index()];
+      std::lock_guard<std::mutex> guard(s.lock);
+      // the promoting thread switches to dense before draining any shard
+      if (sparse.load(std::memory_order_acquire)) {
+        s.entries.push_back((index << rank_bits) | rank);
+        staged_entry = true;
+        total = staged.fetch_add(1, std::memory_order_relaxed) + 1;
+
+        if (s.entries.size() >= 2 * s.compacted_size + 64) {
+          std::size_t before = s.entries.size();
+          compact(s.entries);
+          s.compacted_size = s.entries.size();
+          total = staged.fetch_sub(before - s.compacted_size,
+                                   std::memory_order_relaxed) -
+                  (before - s.compacted_size);
+        }
+      }
+    }
+
+    if (staged_entry) {
+      if (total >= sparse_list_max)
+        promote();
+      return;
+    }
+  }
+
+  std::tie(index, rank) = detail::hash_rank(hash, p);
+  update_register(index, rank);
+}
+
+template <typename T, std::uint8_t p, std::uint8_t sp>
+void hll::concurrent_hyperloglog<T, p, sp>::update_register(
+    std::uint64_t index, std::uint8_t rank) {
+  std::atomic<std::uint8_t> &reg = dense.load(std::memory_order_acquire)[index];
+  std::uint8_t current = reg.load(std::memory_order_relaxed);
+  while (rank > current &&
+         !reg.compare_exchange_weak(current, rank, std::memory_order_relaxed)) {
+  }
+}
+
+template <typename T, std::uint8_t p, std::uint8_t sp>
+void hll::concurrent_hyperloglog<T, p, sp>::promote() {
+  bool expected = false;
+  if (!promoting.compare_exchange_strong(expected, true))
+    return; // another thread is already promoting
+
+  dense_storage.reset(new std::atomic<std::uint8_t>[1ul << p]());
+  dense.store(dense_storage.get(), std::memory_order_release);
+  sparse.store(false, std::memory_order_release);
+
+  for (auto &s : shards) {
+    std::lock_guard<std::mutex> guard(s.lock);
+    for (const auto entry : s.entries) {
+      std::uint64_t index;
+      std::uint8_t rank;
+      std::tie(index, rank) = detail::sparse_to_dense(
+          entry >> rank_bits,
+          static_cast<std::uint8_t>(entry & ((1u << rank_bits) - 1)), p, sp);
+      update_register(index, rank);
+    }
+    std::vector<std::uint64_t>().swap(s.entries);
+  }
+  drained.store(true, std::memory_order_release);
+}
+
+template <typename T, std::uint8_t p, std::uint8_t sp>
+double hll::concurrent_hyperloglog<T, p, sp>::estimate() const {
+  if (drained.load(std::memory_order_acquire))
+    return dense_estimate();
+
+  // Holding every shard lock makes for a consistent snapshot: either the
+  // counter is still sparse, or the promotion is waiting for a shard lock and
+  // each entry is either in a shard or already in the dense registers.
+  std::array<std::unique_lock<std::mutex>, shard_count> locks;
+  for (std::size_t i = 0; i < shard_count; i++)
+    locks[i] = std::unique_lock<std::mutex>(shards[i].lock);
+
+  if (sparse.load(std::memory_order_acquire))
+    return sparse_estimate();
+  else
+    return dense_estimate();
+}
+
+// expects the shard locks to be held
+template <typename T, std::uint8_t p, std::uint8_t sp>
+double hll::concurrent_hyperloglog<T, p, sp>::sparse_estimate() const {
+  std::vector<std::uint64_t> indices;
+  for (const auto &s : shards)
+    for (const auto entry : s.entries)
+      indices.push_back(entry >> rank_bits);
+  std::sort(indices.begin(), indices.end());
+  std::size_t distinct = static_cast<std::size_t>(
+      std::unique(indices.begin(), indices.end()) - indices.begin());
+  return detail::linear_estimate(sp, distinct);
+}
+
+// expects the shard locks to be held unless the shards are already drained
+template <typename T, std::uint8_t p, std::uint8_t sp>
+double hll::concurrent_hyperloglog<T, p, sp>::dense_estimate() const {
+  const std::atomic<std::uint8_t> *registers =
+      dense.load(std::memory_order_acquire);
+
+  std::vector<std::uint8_t> pending;
+  if (!drained.load(std::memory_order_acquire)) {
+    pending.assign(1ul << p, std::uint8_t{});
+    for (const auto &s : shards)
+      for (const auto entry : s.entries) {
+        std::uint64_t index;
+        std::uint8_t rank;
+        std::tie(index, rank) = detail::sparse_to_dense(
+            entry >> rank_bits,
+            static_cast<std::uint8_t>(entry & ((1u << rank_bits) - 1)), p,
+            sp);
+        pending[index] = std::max(pending[index], rank);
+      }
+  }
+
+  simd::register_sums sums;
+  constexpr std::size_t block = 1024;
+  std::uint8_t values[block];
+  for (std::size_t i = 0; i < (1ul << p); i += block) {
+    std::size_t count = std::min(block, (1ul << p) - i);
+    for (std::size_t j = 0; j < count; j++)
+      values[j] = registers[i + j].load(std::memory_order_relaxed);
+    if (!pending.empty())
+      simd::max_registers(values, pending.data() + i, count);
+    simd::accumulate(values, count, sums);
+  }
+
+  return detail::dense_estimate(
+      p, detail::raw_estimate(p, sums.harmonic_sum()), sums.non_zeros);
+}
@@ -0,0 +1,450 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+template <typename T, typename H>
+hll::dynamic_hyperloglog<T, H>::dynamic_hyperloglog(
+    std::uint8_t precision, std::uint8_t sparse_precision, bool create_dense,
+    std::uint64_t seed)
+    : sparse(!create_dense), hash_seed(seed) {
+  set_precisions(precision, sparse_precision);
+  if (create_dense)
+    convert_to_dense();
+  else
+    with_lists([this](auto &lists) {
+      lists.temporary.reserve(temporary_list_max + batch_size);
+    });
+}
+
+template <typename T, typename H>
+template <typename E>
+std::size_t
+hll::dynamic_hyperloglog<T, H>::sparse_lists<E>::bytes() const {
+  return (sparse.capacity() + temporary.capacity() + scratch.capacity()) *
+         sizeof(E);
+}
+
+template <typename T, typename H>
+template <typename E>
+void hll::dynamic_hyperloglog<T, H>::sparse_lists<E>::release() {
+  detail::release(sparse);
+  detail::release(temporary);
+  detail::release(scratch);
+}
+
+template <typename T, typename H>
+bool hll::dynamic_hyperloglog<T, H>::narrow_entries() const {
+  return sparse_prec + rank_bits <= 32;
+}
+
+template <typename T, typename H>
+template <typename F>
+decltype(auto) hll::dynamic_hyperloglog<T, H>::with_lists(F f) {
+  return narrow_entries() ? f(narrow) : f(wide);
+}
+
+template <typename T, typename H>
+template <typename F>
+decltype(auto) hll::dynamic_hyperloglog<T, H>::with_lists(F f) const {
+  return narrow_entries() ? f(narrow) : f(wide);
+}
+
+template <typename T, typename H>
+void hll::dynamic_hyperloglog<T, H>::set_precisions(
+    std::uint8_t precision, std::uint8_t sparse_precision) {
+  if (precision < 4 || precision > 18)
+    throw std::invalid_argument("precision should be between 4 and 18, not " +
+                                std::to_string(precision));
+  if (sparse_precision > 58)
+    throw std::invalid_argument("sparse precision should be 58 or less");
+  if (precision >= sparse_precision)
+    throw std::invalid_argument(
+        "precision should be less than sparse precision");
+
+  dense_prec = precision;
+  sparse_prec = sparse_precision;
+  std::size_t entry_bytes = narrow_entries() ? 4 : 8;
+  sparse_list_max =
+      hll::byte_registers::bytes_for(1ul << precision) / entry_bytes;
+  temporary_list_max = sparse_list_max / 10;
+}
+
+template <typename T, typename H>
+std::uint8_t hll::dynamic_hyperloglog<T, H>::precision() const {
+  return dense_prec;
+}
+
+template <typename T, typename H>
+std::uint8_t hll::dynamic_hyperloglog<T, H>::sparse_precision() const {
+  return sparse_prec;
+}
+
+template <typename T, typename H>
+std::uint64_t hll::dynamic_hyperloglog<T, H>::seed() const {
+  return hash_seed;
+}
+
+template <typename T, typename H>
+bool hll::dynamic_hyperloglog<T, H>::is_sparse() const {
+  return sparse;
+}
+
+template <typename T, typename H>
+const std::vector<std::uint8_t> &
+hll::dynamic_hyperloglog<T, H>::dense_vec() const {
+  return dense.values();
+}
+
+template <typename T, typename H>
+hll::sketch_stats hll::dynamic_hyperloglog<T, H>::stats() const {
+  hll::sketch_stats s;
+  s.sparse = sparse;
+  with_lists([&s](const auto &lists) {
+    s.sparse_entries = lists.sparse.size();
+    s.temporary_entries = lists.temporary.size();
+  });
+  s.temporary_entries_max = temporary_list_max;
+  s.sparse_entries_max = sparse_list_max;
+  s.sparse_bytes = narrow.bytes() + wide.bytes();
+  s.dense_bytes = hll::byte_registers::bytes_for(dense.size());
+
+  if (sparse) {
+    with_lists([&](const auto &lists) {
+      s.register_histogram = detail::sparse_histogram(
+          lists.sparse, lists.temporary, dense_prec, sparse_prec);
+    });
+    return s;
+  }
+  for (std::size_t i = 0; i < dense.size(); i++)
+    s.register_histogram[dense.get(i)]++;
+  return s;
+}
+
+template <typename T, typename H>
+void hll::dynamic_hyperloglog<T, H>::insert(const T &item) {
+  insert_hash(H{}(item, hash_seed));
+}
+
+template <typename T, typename H>
+template <typename U, typename>
+void hll::dynamic_hyperloglog<T, H>::insert(const char *data,
+                                            std::size_t size) {
+  insert_hash(H{}(data, size, hash_seed));
+}
+
+template <typename T, typename H>
+template <typename InputIt>
+void hll::dynamic_hyperloglog<T, H>::insert(InputIt first, InputIt last) {
+  detail::hash_range<T, H, batch_size>(
+      first, last, hash_seed,
+      [this](const std::uint64_t *hashes, std::size_t count) {
+        insert_hashes(hashes, count);
+      },
+      std::is_arithmetic<T>{});
+}
+
+template <typename T, typename H>
+void hll::dynamic_hyperloglog<T, H>::insert_hash(std::uint64_t hash) {
+  insert_hashes(&hash, 1);
+}
+
+template <typename T, typename H>
+void hll::dynamic_hyperloglog<T, H>::insert_hashes(const std::uint64_t *hashes,
+                                                   std::size_t count) {
+  HLL_INSTRUMENT(instrumentation::event::insert, count);
+  while (count > 0) {
+    std::size_t block = count < batch_size ? count : batch_size;
+    if (sparse)
+      insert_sparse_block(hashes, block);
+    else
+      insert_dense_block(hashes, block);
+    hashes += block;
+    count -= block;
+  }
+}
+
+template <typename T, typename H>
+void hll::dynamic_hyperloglog<T, H>::insert_sparse_block(
+    const std::uint64_t *hashes, std::size_t count) {
+  sparse_count.reset();
+  bool full = with_lists([&](auto &lists) {
+    return detail::insert_sparse_hashes(lists.sparse, lists.temporary, hashes,
+                                        count, sparse_prec, sparse_list_max,
+                                        temporary_list_max);
+  });
+  if (full)
+    convert_to_dense();
+}
+
+template <typename T, typename H>
+void hll::dynamic_hyperloglog<T, H>::insert_dense_block(
+    const std::uint64_t *hashes, std::size_t count) {
+  detail::insert_dense_hashes(
+      dense, hashes, count, dense_prec,
+      [this](std::uint64_t index, std::uint8_t rank) {
+        update_register(index, rank);
+      });
+}
+
+template <typename T, typename H>
+void hll::dynamic_hyperloglog<T, H>::update_register(std::uint64_t index,
+                                                     std::uint8_t rank) {
+  std::uint8_t previous = dense.update(index, rank);
+  if (rank > previous) {
+    sums.remove(previous);
+    sums.add(rank);
+  }
+}
+
+template <typename T, typename H>
+void hll::dynamic_hyperloglog<T, H>::merge_temp() {
+  with_lists([](auto &lists) {
+    detail::merge_temporary_list(lists.sparse, lists.temporary);
+  });
+}
+
+template <typename T, typename H>
+void hll::dynamic_hyperloglog<T, H>::convert_to_dense() {
+  // counters created dense are not converted
+  HLL_INSTRUMENT(instrumentation::event::convert_to_dense, sparse ? 1 : 0);
+  hll::byte_registers new_dense(1ul << dense_prec);
+  with_lists([&](const auto &lists) {
+    detail::add_sparse_entries(lists.sparse, lists.temporary, dense_prec,
+                               sparse_prec, new_dense);
+  });
+  dense = std::move(new_dense);
+  sums = dense.sums();
+
+  sparse = false;
+  narrow.release();
+  wide.release();
+}
+
+template <typename T, typename H>
+void hll::dynamic_hyperloglog<T, H>::reduce_precision(
+    std::uint8_t new_precision) {
+  reduce_precision(new_precision, sparse_prec);
+}
+
+// Folding a register of precision p into precision p' < p uses the same
+// mapping as converting a sparse entry to a register: the p - p' lowest bits
+// of the index become the leading bits of the rest of the hash.
+template <typename T, typename H>
+void hll::dynamic_hyperloglog<T, H>::reduce_precision(
+    std::uint8_t new_precision, std::uint8_t new_sparse_precision) {
+  if (new_precision > dense_prec || new_sparse_precision > sparse_prec)
+    throw std::invalid_argument("precisions can only be reduced");
+  std::uint8_t old_p = dense_prec;
+  std::uint8_t old_sp = sparse_prec;
+  bool was_narrow = narrow_entries();
+  if (sparse)
+    merge_temp();
+  set_precisions(new_precision, new_sparse_precision);
+
+  if (sparse) {
+    // folds the sorted entries of `from` into `to`, in place if they are the
+    // same list
+    auto fold = [&](auto &from, auto &to) {
+      using entry = typename std::decay<decltype(to)>::type::value_type;
+      to.resize(from.size());
+      for (std::size_t i = 0; i < from.size(); i++) {
+        std::uint64_t index;
+        std::uint8_t rank;
+        std::tie(index, rank) = detail::sparse_to_dense(
+            from[i] >> rank_bits,
+            static_cast<std::uint8_t>(from[i] & ((1u << rank_bits) - 1)),
+            new_sparse_precision, old_sp);
+        to[i] = static_cast<entry>(index << rank_bits | rank);
+      }
+      entry *first = to.data();
+      to.resize(static_cast<std::size_t>(
+          detail::sort_unique_entries(first, first + to.size()) - first));
+    };
+    if (new_sparse_precision < old_sp) {
+      if (was_narrow) {
+        fold(narrow.sparse, narrow.sparse);
+      } else if (narrow_entries()) {
+        fold(wide.sparse, narrow.sparse);
+        wide.release();
+        narrow.temporary.reserve(temporary_list_max + batch_size);
+      } else {
+        fold(wide.sparse, wide.sparse);
+      }
+    }
+    std::size_t size =
+        with_lists([](const auto &lists) { return lists.sparse.size(); });
+    sparse_count.set(size);
+    if (size >= sparse_list_max)
+      convert_to_dense();
+  } else if (new_precision < old_p) {
+    hll::byte_registers folded(1ul << new_precision);
+    for (std::size_t i = 0; i < dense.size(); i++) {
+      std::uint8_t rank = dense.get(i);
+      if (rank == 0)
+        continue;
+      std::uint64_t index;
+      std::tie(index, rank) =
+          detail::sparse_to_dense(i, rank, new_precision, old_p);
+      folded.update(index, rank);
+    }
+    dense = std::move(folded);
+    sums = dense.sums();
+  }
+}
+
+template <typename T, typename H>
+template <typename ForEach>
+void hll::dynamic_hyperloglog<T, H>::merge_sparse(std::uint8_t other_sp,
+                                                  ForEach for_each) {
+  if (sparse) {
+    merge_temp();
+    std::size_t size = with_lists([&](auto &lists) {
+      using entry = typename std::decay<decltype(lists)>::type::entry;
+      lists.scratch.clear();
+      for_each([&](std::uint64_t index, std::uint8_t rank) {
+        std::tie(index, rank) =
+            detail::sparse_to_dense(index, rank, sparse_prec, other_sp);
+        lists.scratch.push_back(static_cast<entry>(index << rank_bits | rank));
+      });
+      // folded entries of the same index may be out of order
+      entry *first = lists.scratch.data();
+      entry *last =
+          detail::sort_unique_entries(first, first + lists.scratch.size());
+      detail::merge_sorted_entries(lists.sparse, first, last);
+      return lists.sparse.size();
+    });
+    sparse_count.set(size);
+    if (size >= sparse_list_max)
+      convert_to_dense();
+  } else {
+    for_each([this, other_sp](std::uint64_t index, std::uint8_t rank) {
+      std::tie(index, rank) =
+          detail::sparse_to_dense(index, rank, dense_prec, other_sp);
+      update_register(index, rank);
+    });
+  }
+}
+
+template <typename T, typename H>
+template <typename Get>
+void hll::dynamic_hyperloglog<T, H>::merge_dense(std::uint8_t other_p,
+                                                 Get get) {
+  if (sparse)
+    convert_to_dense();
+  std::size_t count = std::size_t{1} << other_p;
+  for (std::size_t i = 0; i < count; i++) {
+    std::uint8_t rank = get(i);
+    if (rank == 0)
+      continue;
+    std::uint64_t index;
+    std::tie(index, rank) = detail::sparse_to_dense(i, rank, dense_prec,
+                                                    other_p);
+    update_register(index, rank);
+  }
+}
+
+template <typename T, typename H>
+void hll::dynamic_hyperloglog<T, H>::merge(
+    const hll::dynamic_hyperloglog<T, H> &other) {
+  if (hash_seed != other.hash_seed)
+    throw std::invalid_argument(
+        "two counters should have the same seed to merge");
+  if (&other == this)
+    return;
+  HLL_INSTRUMENT(instrumentation::merge_event(sparse, other.sparse), 1);
+
+  if (other.dense_prec < dense_prec || other.sparse_prec < sparse_prec)
+    reduce_precision(std::min(dense_prec, other.dense_prec),
+                     std::min(sparse_prec, other.sparse_prec));
+
+  if (other.sparse) {
+    merge_sparse(other.sparse_prec, [&other](auto f) {
+      other.with_lists([&f](const auto &lists) {
+        for (const auto *list : {&lists.sparse, &lists.temporary})
+          for (const auto entry : *list)
+            f(entry >> rank_bits,
+              static_cast<std::uint8_t>(entry & ((1u << rank_bits) - 1)));
+      });
+    });
+  } else if (!sparse && other.dense_prec == dense_prec) {
+    dense.merge(other.dense);
+    sums = dense.sums();
+  } else {
+    merge_dense(other.dense_prec,
+                [&other](std::size_t i) { return other.dense.get(i); });
+  }
+}
+
+template <typename T, typename H>
+void hll::dynamic_hyperloglog<T, H>::merge(const hll::sketch_view &other) {
+  if (hash_seed != other.seed())
+    throw std::invalid_argument(
+        "two counters should have the same seed to merge");
+  if (other.hash_id() != H::id)
+    throw std::invalid_argument(
+        "two counters should have the same hash function to merge");
+  HLL_INSTRUMENT(instrumentation::merge_event(sparse, other.is_sparse()), 1);
+
+  if (other.precision() < dense_prec ||
+      other.sparse_precision() < sparse_prec)
+    reduce_precision(std::min(dense_prec, other.precision()),
+                     std::min(sparse_prec, other.sparse_precision()));
+
+  if (other.is_sparse())
+    merge_sparse(other.sparse_precision(),
+                 [&other](auto f) { other.for_each_sparse(f); });
+  else
+    merge_dense(other.precision(),
+                [&other](std::size_t i) { return other.dense_register(i); });
+}
+
+template <typename T, typename H>
+std::vector<std::uint8_t> hll::dynamic_hyperloglog<T, H>::serialize() const {
+  return with_lists([this](const auto &lists) {
+    typename std::decay<decltype(lists.sparse)>::type slist;
+    if (sparse)
+      slist = detail::merged_entries(lists.sparse, lists.temporary);
+    return detail::serialize_sketch(dense_prec, sparse_prec, H::id, hash_seed,
+                                    sparse, slist, dense);
+  });
+}
+
+template <typename T, typename H>
+hll::dynamic_hyperloglog<T, H>
+hll::dynamic_hyperloglog<T, H>::deserialize(const void *data,
+                                            std::size_t size) {
+  hll::sketch_view view(data, size);
+  hll::dynamic_hyperloglog<T, H> h(view.precision(), view.sparse_precision(),
+                                   !view.is_sparse(), view.seed());
+  h.merge(view);
+  return h;
+}
+
+template <typename T, typename H>
+double hll::dynamic_hyperloglog<T, H>::estimate() const {
+  return estimate(hll::estimation_method::bias_corrected);
+}
+
+template <typename T, typename H>
+double
+hll::dynamic_hyperloglog<T, H>::estimate(hll::estimation_method method) const {
+  if (sparse) {
+    // sparse entries plus the temporary entries of other indices
+    std::size_t count = sparse_count.get([this]() {
+      return with_lists([](const auto &lists) {
+        return detail::distinct_entries(lists.sparse, lists.temporary);
+      });
+    });
+    return detail::linear_estimate(sparse_prec, count);
+  } else if (method == hll::estimation_method::improved) {
+    return detail::improved_estimate(dense_prec,
+                                     detail::register_histogram(dense));
+  } else {
+    return detail::dense_estimate(
+        dense_prec, detail::raw_estimate(dense_prec, sums.harmonic_sum()),
+        sums.non_zeros);
+  }
+}
@@ -1,47 +1,126 @@
+// Prints the relative bias and the standard error of the estimates of dense
+// counters against the true cardinality.
+//
+// usage: estimate_distribution [precision trials points max [threads [method]]]
+//
+// Without arguments it reproduces the default runs at precision 10. Trials
+// are split into blocks that run in parallel on a thread pool. `method` is the
+// estimator, `bias_corrected` (the default) or `improved`, see
+// `hll::estimation_method`.
+
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <fstream>
 #include <numeric>
+#include <string>
+#include <vector>
 
 #include "../include/hll/hyperloglog.hpp"
+#include "../include/hll/thread_pool.hpp"
+#include "simulation.hpp"
+
+// adds the differences between the estimates of trials [first, last) and the
+// cardinalities, and their squares, to `bias` and `se`
 template <uint8_t precision>
+void block_estimates(
+    const std::vector<std::size_t>& cardinalities,
+    std::size_t first, std::size_t last, hll::estimation_method method,
+    std::vector<double>& bias, std::vector<double>& se) {
+  using hll_t = hll::hyperloglog<std::uint64_t, precision, 25>;
+
+  std::vector<std::uint64_t> buffer;
+  for (std::size_t trial = first; trial < last; trial++) {
+    hll_t h(true);
+    std::uint64_t seed = sim::trial_seed(precision, trial);
+    std::size_t inserted = 0;
+    for (std::size_t k = 0; k < cardinalities.size(); k++) {
+      sim::insert_items(h, seed, inserted, cardinalities[k], buffer);
+      inserted = cardinalities[k];
+      double diff = h.estimate(method) - static_cast<double>(inserted);
+      bias[k] += diff;
+      se[k] += std::pow(diff, 2);
+    }
+  }
+}
+
 void record_estimates(
+    std::uint8_t precision,
     std::size_t trials,
     std::size_t points,
-    std::size_t max) {
-  std::vector<hll::hyperloglog<std::string, precision, 18>> hlls;
-
-  for (size_t j = 0; j < trials; j++)
-    hlls.emplace_back(true);
-
-  std::size_t inc = std::max(1ul, max/points);
-
-  for (std::size_t i = 1; i <= max; i++) {
-    for (std::size_t j = 0; j < trials; j++)
-      hlls[j].insert(std::to_string(i) + ";" + std::to_string(j));
-
-    if (i%inc == 0) {
-      double bias = 0;
-      double se = 0;
-      for (const auto& h: hlls) {
-        double diff = h.estimate() - static_cast<double>(i);
-        bias += diff;
-        se += std::pow(diff, 2);
-      }
-      std::cout << i << " " << trials
-        << " "
-        << bias/static_cast<double>(trials)/static_cast<double>(i) << " "
-        << std::sqrt(se/static_cast<double>(trials))/
-            std::sqrt(trials)/static_cast<double>(i)<< "\n";
+    std::size_t max,
+    hll::estimation_method method,
+    hll::thread_pool& pool) {
+  constexpr std::size_t block_size = 50;
+  std::vector<std::size_t> cardinalities = sim::measure_points(max, points);
+  std::size_t blocks = (trials + block_size - 1)/block_size;
+
+  // sums of each block, added up in block order so that the results do not
+  // depend on the order in which blocks finish
+  std::vector<std::vector<double>> block_bias(blocks), block_se(blocks);
+  pool.parallel_for(blocks, [&](std::size_t b) {
+    std::size_t first = b*block_size;
+    std::size_t last = std::min(first + block_size, trials);
+    block_bias[b].assign(cardinalities.size(), 0.0);
+    block_se[b].assign(cardinalities.size(), 0.0);
+    sim::with_precision(precision, [&](auto p) {
+      block_estimates<decltype(p)::value>(
+          cardinalities, first, last, method, block_bias[b], block_se[b]);
+    });
+  });
+
+  for (std::size_t k = 0; k < cardinalities.size(); k++) {
+    double bias = 0;
+    double se = 0;
+    for (std::size_t b = 0; b < blocks; b++) {
+      bias += block_bias[b][k];
+      se += block_se[b][k];
     }
+    std::size_t i = cardinalities[k];
+    std::cout << i << " " << trials
+      << " "
+      << bias/static_cast<double>(trials)/static_cast<double>(i) << " "
+      << std::sqrt(se/static_cast<double>(trials))/
+          std::sqrt(trials)/static_cast<double>(i)<< "\n";
   }
 }
 
-int main() {
+int main(int argc, char* argv[]) {
   std::size_t sample_size = 5000;
   std::size_t max = 320'000'000;
   std::size_t points = 50'000;
 
-  record_estimates<10>(sample_size, 10000, 50000);
-  record_estimates<10>(sample_size, points, max);
+  if (argc > 1 && argc < 5) {
+    std::cerr << "usage: " << argv[0]
+      << " [precision trials points max [threads [method]]]\n";
+    return 1;
+  }
+
+  hll::estimation_method method = hll::estimation_method::bias_corrected;
+  if (argc > 6) {
+    std::string name = argv[6];
+    if (name == "improved") {
+      method = hll::estimation_method::improved;
+    } else if (name != "bias_corrected") {
+      std::cerr << "unknown estimation method " << name << "\n";
+      return 1;
+    }
+  }
+
+  hll::thread_pool pool(argc > 5 ? std::stoul(argv[5]) : 0);
+  if (argc > 1) {
+    std::uint8_t precision;
+    try {
+      precision = sim::parse_precision(argv[1]);
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << "\n";
+      return 1;
+    }
+    record_estimates(precision, std::stoul(argv[2]), std::stoul(argv[3]),
+        std::stoul(argv[4]), method, pool);
+    return 0;
+  }
+
+  record_estimates(10, sample_size, 10000, 50000, method, pool);
+  record_estimates(10, sample_size, points, max, method, pool);
 }
@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <cstring>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#pragma intrinsic(_umul128)
+#endif
+
+#include "../include/hll/murmurhash.hpp"
+#include "../include/hll/simd.hpp"
+
+namespace hll {
+#define hll_define_integral_hash(Tp)                                           \
+  template <> struct hash<Tp> {                                                \
+    std::uint64_t operator()(const Tp &k, std::uint64_t seed) const {          \
+      return hll::murmurhash3_x64_128(&k, sizeof(k), seed);                    \
+    }                                                                          \
+  };
+
+hll_define_integral_hash(bool)               // NOLINT
+hll_define_integral_hash(char)               // NOLINT
+hll_define_integral_hash(signed char)        // NOLINT
+hll_define_integral_hash(unsigned char)      // NOLINT
+hll_define_integral_hash(wchar_t)            // NOLINT
+hll_define_integral_hash(char16_t)           // NOLINT
+hll_define_integral_hash(char32_t)           // NOLINT
+hll_define_integral_hash(short)              // NOLINT
+hll_define_integral_hash(int)                // NOLINT
+hll_define_integral_hash(long)               // NOLINT
+hll_define_integral_hash(long long)          // NOLINT
+hll_define_integral_hash(unsigned short)     // NOLINT
+hll_define_integral_hash(unsigned int)       // NOLINT
+hll_define_integral_hash(unsigned long)      // NOLINT
+hll_define_integral_hash(unsigned long long) // NOLINT
+
+#undef hll_define_integral_hash
+
+// making sure hash(-0.0f) == hash(+0.0f)
+#define hll_define_floating_point_hash(Tp)                                     \
+  template <> struct hash<Tp> {                                                \
+    std::uint64_t operator()(const Tp &k, std::uint64_t seed) const {          \
+      Tp zero = 0.0;                                                           \
+      return hll::murmurhash3_x64_128(((k == 0.0) ? &zero : &k), sizeof(k),    \
+                                      seed);                                   \
+    }                                                                          \
+  };
+
+hll_define_floating_point_hash(float)       // NOLINT
+hll_define_floating_point_hash(double)      // NOLINT
+hll_define_floating_point_hash(long double) // NOLINT
+
+#undef hll_define_floating_point_hash
+
+template <> struct hash<std::string> {
+  std::uint64_t operator()(const std::string &k, std::uint64_t seed) const {
+    return hll::murmurhash3_x64_128(k.c_str(), static_cast<int>(k.length()) + 1,
+                                    seed);
+  }
+};
+
+#if __cplusplus >= 201703L
+// gives the same hash as the equal `std::string`
+template <> struct hash<std::string_view> {
+  std::uint64_t operator()(const std::string_view &k,
+                           std::uint64_t seed) const {
+    return hll::murmurhash3_x64_128_terminated(k.data(), k.size(), seed);
+  }
+};
+#endif
+
+namespace detail {
+constexpr std::uint64_t wy_secret[4] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull,
+    0x589965cc75374cc3ull};
+
+// the 128-bit product of `a` and `b`, low half in `a` and high half in `b`
+inline void wy_multiply(std::uint64_t &a, std::uint64_t &b) {
+#if defined(__SIZEOF_INT128__)
+  __extension__ typedef unsigned __int128 uint128;
+  uint128 r = static_cast<uint128>(a) * b;
+  a = static_cast<std::uint64_t>(r);
+  b = static_cast<std::uint64_t>(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  a = _umul128(a, b, &b);
+#else
+  std::uint64_t ha = a >> 32, hb = b >> 32;
+  std::uint64_t la = a & 0xffffffff, lb = b & 0xffffffff;
+  std::uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  std::uint64_t t = rl + (rm0 << 32);
+  std::uint64_t carry = t < rl;
+  std::uint64_t lo = t + (rm1 << 32);
+  carry += lo < t;
+  a = lo;
+  b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+#endif
+}
+
+inline std::uint64_t wy_mix(std::uint64_t a, std::uint64_t b) {
+  wy_multiply(a, b);
+  return a ^ b;
+}
+
+inline std::uint64_t wy_read8(const std::uint8_t *p) {
+  std::uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline std::uint64_t wy_read4(const std::uint8_t *p) {
+  std::uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// wyhash (final version 4) of `len` bytes
+inline std::uint64_t wyhash(const void *key, std::size_t len,
+                            std::uint64_t seed) {
+  const std::uint8_t *p = static_cast<const std::uint8_t *>(key);
+  seed ^= wy_mix(seed ^ wy_secret[0], wy_secret[1]);
+  std::uint64_t a, b;
+  if (len <= 16) {
+    if (len >= 4) {
+      std::size_t shift = (len >> 3) << 2;
+      a = (wy_read4(p) << 32) | wy_read4(p + shift);
+      b = (wy_read4(p + len - 4) << 32) | wy_read4(p + len - 4 - shift);
+    } else if (len > 0) {
+      a = (std::uint64_t{p[0]} << 16) | (std::uint64_t{p[len >> 1]} << 8) |
+          p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    std::size_t i = len;
+    if (i > 48) {
+      std::uint64_t see1 = seed, see2 = seed;
+      do {
+        seed = wy_mix(wy_read8(p) ^ wy_secret[1], wy_read8(p + 8) ^ seed);
+        see1 = wy_mix(wy_read8(p + 16) ^ wy_secret[2],
+                      wy_read8(p + 24) ^ see1);
+        see2 = wy_mix(wy_read8(p + 32) ^ wy_secret[3],
+                      wy_read8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = wy_mix(wy_read8(p) ^ wy_secret[1], wy_read8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = wy_read8(p + i - 16);
+    b = wy_read8(p + i - 8);
+  }
+  a ^= wy_secret[1];
+  b ^= seed;
+  wy_multiply(a, b);
+  return wy_mix(a ^ wy_secret[0] ^ len, b ^ wy_secret[1]);
+}
+
+// finalizer of MurmurHash3, a bijection of 64-bit integers
+inline std::uint64_t mix_integer(std::uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdull;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ull;
+  k ^= k >> 33;
+  return k;
+}
+
+// Whether keys of type `K` can be read in place as `std::uint64_t`s: only
+// `std::uint64_t` and its signed type may alias it. `std::make_unsigned` is
+// ill-formed for `bool`, which is never read in place.
+template <typename K, bool = std::is_integral<K>::value &&
+                             !std::is_same<K, bool>::value>
+struct reads_as_uint64 : std::false_type {};
+
+template <typename K>
+struct reads_as_uint64<K, true>
+    : std::is_same<typename std::make_unsigned<K>::type, std::uint64_t> {};
+} // namespace detail
+
+template <bool terminated_strings>
+template <typename K>
+std::uint64_t
+basic_murmur_hash<terminated_strings>::operator()(const K &key,
+                                                  std::uint64_t seed) const {
+  return hll::hash<K>{}(key, seed);
+}
+
+template <bool terminated_strings>
+std::uint64_t
+basic_murmur_hash<terminated_strings>::operator()(const std::string &key,
+                                                  std::uint64_t seed) const {
+  return (*this)(key.data(), key.size(), seed);
+}
+
+#if __cplusplus >= 201703L
+template <bool terminated_strings>
+std::uint64_t
+basic_murmur_hash<terminated_strings>::operator()(std::string_view key,
+                                                  std::uint64_t seed) const {
+  return (*this)(key.data(), key.size(), seed);
+}
+#endif
+
+template <bool terminated_strings>
+std::uint64_t basic_murmur_hash<terminated_strings>::operator()(
+    const char *data, std::size_t size, std::uint64_t seed) const {
+  if (terminated_strings)
+    return hll::murmurhash3_x64_128_terminated(data, size, seed);
+  else
+    return hll::murmurhash3_x64_128(data, static_cast<int>(size), seed);
+}
+
+template <bool terminated_strings>
+template <typename K>
+void basic_murmur_hash<terminated_strings>::hash_many(
+    const K *keys, std::size_t count, std::uint64_t seed,
+    std::uint64_t *out) const {
+  for (std::size_t i = 0; i < count; i++)
+    out[i] = (*this)(keys[i], seed);
+}
+
+template <typename K>
+std::uint64_t wy_hash::operator()(const K &key, std::uint64_t seed) const {
+  static_assert(std::is_arithmetic<K>::value,
+                "`hll::wy_hash` hashes arithmetic types and strings");
+  // making sure -0.0 and +0.0 hash the same
+  K k = key == K(0) ? K(0) : key;
+  return detail::wyhash(&k, sizeof(k), seed);
+}
+
+inline std::uint64_t wy_hash::operator()(const std::string &key,
+                                         std::uint64_t seed) const {
+  return detail::wyhash(key.data(), key.size(), seed);
+}
+
+#if __cplusplus >= 201703L
+inline std::uint64_t wy_hash::operator()(std::string_view key,
+                                         std::uint64_t seed) const {
+  return detail::wyhash(key.data(), key.size(), seed);
+}
+#endif
+
+inline std::uint64_t wy_hash::operator()(const char *data, std::size_t size,
+                                         std::uint64_t seed) const {
+  return detail::wyhash(data, size, seed);
+}
+
+template <typename K>
+void wy_hash::hash_many(const K *keys, std::size_t count, std::uint64_t seed,
+                        std::uint64_t *out) const {
+  for (std::size_t i = 0; i < count; i++)
+    out[i] = (*this)(keys[i], seed);
+}
+
+template <typename K>
+std::uint64_t integer_hash::operator()(const K &key,
+                                       std::uint64_t seed) const {
+  static_assert(std::is_integral<K>::value,
+                "`hll::integer_hash` only hashes integers");
+  return detail::mix_integer(static_cast<std::uint64_t>(key) ^ seed);
+}
+
+// `std::uint64_t` keys are hashed in place and other integers, e.g. `long
+// long` on platforms where it is a distinct type, are widened in blocks
+template <typename K>
+void integer_hash::hash_many(const K *keys, std::size_t count,
+                             std::uint64_t seed, std::uint64_t *out) const {
+  static_assert(std::is_integral<K>::value,
+                "`hll::integer_hash` only hashes integers");
+  if (detail::reads_as_uint64<K>::value) {
+    simd::integer_hashes(reinterpret_cast<const std::uint64_t *>(keys),
+                         count, seed, out);
+    return;
+  }
+
+  constexpr std::size_t block = 256;
+  std::uint64_t wide[block];
+  while (count > 0) {
+    std::size_t n = std::min(count, block);
+    for (std::size_t i = 0; i < n; i++)
+      wide[i] = static_cast<std::uint64_t>(keys[i]);
+    simd::integer_hashes(wide, n, seed, out);
+    keys += n;
+    out += n;
+    count -= n;
+  }
+}
+
+template <typename Hash, typename K>
+void hash_many(const K *keys, std::size_t count, std::uint64_t seed,
+               std::uint64_t *out) {
+  Hash{}.hash_many(keys, count, seed, out);
+}
+} // namespace hll
@@ -0,0 +1,365 @@
+// Microbenchmarks of the main operations of `hll::hyperloglog` over a range of
+// precisions, sparse precisions, key types and hash policies. Results are
+// written as JSON so that runs can be compared by scripts, e.g. to catch
+// regressions in CI.
+//
+// usage: hll_benchmarks [--items N] [--repeats R] [--filter TEXT]
+//                       [--output FILE]
+//
+// All keys are generated from fixed seeds, so every run does the same work.
+// Each measurement is repeated R times and both the fastest and the median
+// time per operation are reported.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../include/hll/hyperloglog.hpp"
+#include "../include/hll/simd.hpp"
+#include "benchmark.hpp"
+
+namespace {
+  struct options {
+    std::size_t items = 1ul << 20;
+    std::size_t repeats = 5;
+    std::string filter;
+    std::string output;
+  };
+
+  struct result {
+    std::string name;
+    std::string key;
+    std::string hash;
+    unsigned precision;
+    unsigned sparse_precision;
+    std::size_t operations;
+    double best_ns;
+    double median_ns;
+  };
+
+  struct context {
+    options opts;
+    std::vector<result> results;
+  };
+
+  template <typename K> struct key_traits;
+
+  template <> struct key_traits<int> {
+    static const char* name() { return "int"; }
+    static int make(std::uint64_t x) { return static_cast<int>(x >> 33); }
+  };
+
+  template <> struct key_traits<std::uint64_t> {
+    static const char* name() { return "uint64_t"; }
+    static std::uint64_t make(std::uint64_t x) { return x; }
+  };
+
+  template <> struct key_traits<std::string> {
+    static const char* name() { return "string"; }
+    static std::string make(std::uint64_t x) {
+      return "key-" + std::to_string(x);
+    }
+  };
+
+  template <typename H> struct hash_traits;
+
+  template <> struct hash_traits<hll::murmur_hash> {
+    static const char* name() { return "murmur"; }
+  };
+
+  template <> struct hash_traits<hll::wy_hash> {
+    static const char* name() { return "wy"; }
+  };
+
+  template <> struct hash_traits<hll::integer_hash> {
+    static const char* name() { return "integer"; }
+  };
+
+  // splitmix64, so that keys do not depend on the standard library
+  std::uint64_t next_random(std::uint64_t& state) {
+    return bench::splitmix64(state += 0x9E3779B97F4A7C15ull);
+  }
+
+  template <typename K>
+  std::vector<K> make_keys(std::size_t count, std::uint64_t seed) {
+    std::vector<K> keys;
+    keys.reserve(count);
+    for (std::size_t i = 0; i < count; i++)
+      keys.push_back(key_traits<K>::make(next_random(seed)));
+    return keys;
+  }
+
+  // Runs `prepare` and then `f` `repeats` times and returns the sorted
+  // durations of `f` in nanoseconds.
+  template <typename P, typename F>
+  std::vector<double> time_runs(std::size_t repeats, P&& prepare, F&& f) {
+    std::vector<double> times;
+    for (std::size_t r = 0; r < repeats; r++) {
+      prepare();
+      auto start = std::chrono::steady_clock::now();
+      f();
+      std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+      times.push_back(elapsed.count());
+    }
+    std::sort(times.begin(), times.end());
+    return times;
+  }
+
+  template <typename K, std::uint8_t p, std::uint8_t sp, typename H,
+            typename P, typename F>
+  void measure(context& ctx, const std::string& name,
+      std::size_t operations, P&& prepare, F&& f) {
+    if (name.find(ctx.opts.filter) == std::string::npos || operations == 0)
+      return;
+
+    std::vector<double> times = time_runs(ctx.opts.repeats,
+        std::forward<P>(prepare), std::forward<F>(f));
+    double ops = static_cast<double>(operations);
+    ctx.results.push_back({name, key_traits<K>::name(),
+        hash_traits<H>::name(), p, sp, operations, times.front()/ops,
+        times[times.size()/2]/ops});
+
+    const result& r = ctx.results.back();
+    std::cerr << r.name << " " << r.key << " " << r.hash
+      << " p=" << r.precision
+      << " sp=" << r.sparse_precision << ": " << r.best_ns << " ns/op\n";
+  }
+
+  template <typename K, std::uint8_t p, std::uint8_t sp,
+            typename H = hll::murmur_hash>
+  void run_suite(context& ctx) {
+    using hll_t = hll::hyperloglog<K, p, sp, hll::byte_registers,
+          std::allocator<std::uint8_t>, H>;
+    auto nothing = []() {};
+
+    const std::vector<K> keys = make_keys<K>(ctx.opts.items, 42);
+    std::vector<std::uint64_t> hashes;
+    hashes.reserve(keys.size());
+    for (const auto& k: keys)
+      hashes.push_back(H{}(k, 0x9E3779B97F4A7C15));
+
+    // number of distinct items the sparse representation holds
+    hll_t probe;
+    std::size_t sparse_items = 0;
+    while (sparse_items < keys.size() && probe.is_sparse())
+      probe.insert(keys[sparse_items++]);
+    bool converts = !probe.is_sparse();
+    if (converts)
+      sparse_items--;
+
+    hll_t counter;
+    measure<K, p, sp, H>(ctx, "insert_single", keys.size(),
+        [&]() { counter = hll_t(); },
+        [&]() {
+          for (const auto& k: keys)
+            counter.insert(k);
+        });
+
+    measure<K, p, sp, H>(ctx, "insert_batch", keys.size(),
+        [&]() { counter = hll_t(); },
+        [&]() { counter.insert(keys.begin(), keys.end()); });
+
+    measure<K, p, sp, H>(ctx, "insert_hashes", hashes.size(),
+        [&]() { counter = hll_t(); },
+        [&]() { counter.insert_hashes(hashes.data(), hashes.size()); });
+
+    measure<K, p, sp, H>(ctx, "insert_sparse", sparse_items,
+        [&]() { counter = hll_t(); },
+        [&]() {
+          for (std::size_t i = 0; i < sparse_items; i++)
+            counter.insert(keys[i]);
+        });
+
+    measure<K, p, sp, H>(ctx, "insert_dense", keys.size(),
+        [&]() { counter = hll_t(true); },
+        [&]() {
+          for (const auto& k: keys)
+            counter.insert(k);
+        });
+
+    // the single insert that turns a full sparse counter dense
+    hll_t full;
+    for (std::size_t i = 0; i < sparse_items; i++)
+      full.insert(keys[i]);
+    if (converts)
+      measure<K, p, sp, H>(ctx, "sparse_to_dense", 1,
+          [&]() { counter = full; },
+          [&]() { counter.insert(keys[sparse_items]); });
+
+    // merges of a small sparse, a half full sparse and a dense counter
+    hll_t small_sparse, sparse, dense(true);
+    std::size_t small_items = std::min<std::size_t>(sparse_items/10, 100);
+    for (std::size_t i = 0; i < small_items; i++)
+      small_sparse.insert(keys[keys.size() - 1 - i]);
+    for (std::size_t i = 0; i < sparse_items/2; i++)
+      sparse.insert(keys[i]);
+    for (const auto& k: keys)
+      dense.insert(k);
+
+    const std::vector<std::pair<std::string, const hll_t*>> kinds = {
+      {"small", &small_sparse}, {"sparse", &sparse}, {"dense", &dense}};
+    for (const auto& into: kinds)
+      for (const auto& from: kinds)
+        measure<K, p, sp, H>(ctx, "merge_" + into.first + "_" + from.first, 1,
+            [&]() { counter = *into.second; },
+            [&]() { counter.merge(*from.second); });
+
+    std::vector<hll_t> many(64);
+    for (std::size_t c = 0; c < many.size(); c++)
+      for (std::size_t i = c; i < keys.size(); i += many.size())
+        many[c].insert(keys[i]);
+    measure<K, p, sp, H>(ctx, "merge_all_64", many.size(), nothing,
+        [&]() {
+          bench::keep(hll::merge_all(many.begin(), many.end()).estimate());
+        });
+
+    // estimates of up-to-date counters are cached, so in the sparse case
+    // every estimate follows an insert
+    measure<K, p, sp, H>(ctx, "estimate_sparse_after_insert", small_items,
+        [&]() { counter = hll_t(); },
+        [&]() {
+          for (std::size_t i = 0; i < small_items; i++) {
+            counter.insert(keys[i]);
+            bench::keep(counter.estimate());
+          }
+        });
+
+    measure<K, p, sp, H>(ctx, "estimate_sparse", 1000,
+        [&]() { counter = sparse; },
+        [&]() {
+          for (std::size_t i = 0; i < 1000; i++)
+            bench::keep(counter.estimate());
+        });
+
+    measure<K, p, sp, H>(ctx, "estimate_dense", 1000,
+        [&]() { counter = dense; },
+        [&]() {
+          for (std::size_t i = 0; i < 1000; i++)
+            bench::keep(counter.estimate());
+        });
+
+    measure<K, p, sp, H>(ctx, "estimate_dense_after_insert", keys.size(),
+        [&]() { counter = dense; },
+        [&]() {
+          for (const auto& k: keys) {
+            counter.insert(k);
+            bench::keep(counter.estimate());
+          }
+        });
+
+    bench::keep(counter.estimate());
+  }
+
+  // runs the suite for precisions first + ps...
+  template <typename K, std::uint8_t first, std::uint8_t sp,
+            std::size_t... ps>
+  void run_precisions(context& ctx, std::index_sequence<ps...>) {
+    int expand[] = {0,
+      (run_suite<K, static_cast<std::uint8_t>(first + ps), sp>(ctx), 0)...};
+    static_cast<void>(expand);
+  }
+
+  std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (char c: s) {
+      if (c == '"' || c == '\\')
+        out += '\\';
+      out += c;
+    }
+    return out + "\"";
+  }
+
+  void write_json(std::ostream& out, const context& ctx) {
+    const char* isa = hll::simd::name(hll::simd::best_instruction_set());
+    out << "{\n"
+      << "  \"benchmark\": \"hll_benchmarks\",\n"
+      << "  \"simd\": " << json_string(isa) << ",\n"
+      << "  \"items\": " << ctx.opts.items << ",\n"
+      << "  \"repeats\": " << ctx.opts.repeats << ",\n"
+      << "  \"results\": [";
+    for (std::size_t i = 0; i < ctx.results.size(); i++) {
+      const result& r = ctx.results[i];
+      out << (i == 0 ? "\n" : ",\n")
+        << "    {\"name\": " << json_string(r.name)
+        << ", \"key\": " << json_string(r.key)
+        << ", \"hash\": " << json_string(r.hash)
+        << ", \"precision\": " << r.precision
+        << ", \"sparse_precision\": " << r.sparse_precision
+        << ", \"operations\": " << r.operations
+        << ", \"best_ns_per_op\": " << r.best_ns
+        << ", \"median_ns_per_op\": " << r.median_ns << "}";
+    }
+    out << "\n  ]\n}\n";
+  }
+
+  options parse_options(int argc, char* argv[]) {
+    options opts;
+    for (int i = 1; i < argc; i++) {
+      std::string arg = argv[i];
+      if (i + 1 >= argc)
+        throw std::invalid_argument("missing value for " + arg);
+      std::string value = argv[++i];
+      if (arg == "--items")
+        opts.items = std::stoul(value);
+      else if (arg == "--repeats")
+        opts.repeats = std::max<std::size_t>(std::stoul(value), 1);
+      else if (arg == "--filter")
+        opts.filter = value;
+      else if (arg == "--output")
+        opts.output = value;
+      else
+        throw std::invalid_argument("unknown option " + arg);
+    }
+    return opts;
+  }
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  context ctx;
+  try {
+    ctx.opts = parse_options(argc, argv);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << "\nusage: " << argv[0]
+      << " [--items N] [--repeats R] [--filter TEXT] [--output FILE]\n";
+    return 1;
+  }
+
+  // every precision with 64-bit keys
+  run_precisions<std::uint64_t, 4, 25>(ctx, std::make_index_sequence<15>{});
+
+  // other key types
+  run_suite<int, 14, 25>(ctx);
+  run_suite<std::string, 10, 25>(ctx);
+  run_suite<std::string, 14, 25>(ctx);
+  run_suite<std::string, 18, 25>(ctx);
+
+  // sparse precisions with 32 and 64-bit sparse entries
+  run_suite<std::uint64_t, 14, 20>(ctx);
+  run_suite<std::uint64_t, 14, 32>(ctx);
+  run_suite<std::uint64_t, 18, 58>(ctx);
+
+  // hash policies
+  run_suite<int, 14, 25, hll::integer_hash>(ctx);
+  run_suite<std::uint64_t, 14, 25, hll::integer_hash>(ctx);
+  run_suite<std::uint64_t, 14, 25, hll::wy_hash>(ctx);
+  run_suite<std::string, 14, 25, hll::wy_hash>(ctx);
+
+  if (ctx.opts.output.empty()) {
+    write_json(std::cout, ctx);
+  } else {
+    std::ofstream out(ctx.opts.output);
+    write_json(out, ctx);
+    if (!out) {
+      std::cerr << "could not write " << ctx.opts.output << "\n";
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,119 @@
+// Counts the distinct lines, or the distinct values of columns, of large text
+// files on all cores.
+//
+// usage: hll-count [options] [FILE...]
+//        hll-count --merge SKETCH...
+//
+// Reads standard input without files, or for a file named "-". Prints a line
+// per column with its name ("line" or the column number) and its estimate, or
+// with --group-by, a line per value of that column with an estimate for every
+// counted column. With --sketches PREFIX the counters are also written to
+// PREFIX.<name>.hll, or PREFIX.<name>.hllg with the sketches of every key when
+// grouping, so that the sketches of several runs can be merged later with
+// --merge. It prints the estimate of their union, or a line per key for
+// grouped sketches.
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "hll_count.hpp"
+
+namespace {
+  const char usage[] =
+    " [--delimiter C] [--column N]... [--group-by N] [--threads N]\n"
+    "    [--precision P] [--hash wy|murmur] [--sketches PREFIX]"
+    " [--block-size BYTES]\n    [--no-mmap] [FILE...]\n"
+    "  or: hll-count --merge SKETCH...\n";
+
+  std::vector<std::uint8_t> read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+      throw std::runtime_error("could not open " + path);
+    return std::vector<std::uint8_t>(std::istreambuf_iterator<char>(in),
+        std::istreambuf_iterator<char>());
+  }
+
+  char parse_delimiter(const std::string& value) {
+    if (value == "tab" || value == "\\t")
+      return '\t';
+    if (value.size() != 1)
+      throw std::invalid_argument("the delimiter should be one character");
+    return value[0];
+  }
+
+  counting::options parse_options(int argc, char* argv[], bool& merge) {
+    counting::options opts;
+    merge = false;
+    for (int i = 1; i < argc; i++) {
+      std::string arg = argv[i];
+      if (arg == "--merge") {
+        merge = true;
+        continue;
+      }
+      if (arg == "--no-mmap") {
+        opts.map_files = false;
+        continue;
+      }
+      if (arg.size() < 2 || arg.compare(0, 2, "--") != 0) {
+        opts.files.push_back(arg);
+        continue;
+      }
+      if (i + 1 >= argc)
+        throw std::invalid_argument("missing value for " + arg);
+      std::string value = argv[++i];
+      if (arg == "--delimiter")
+        opts.delimiter = parse_delimiter(value);
+      else if (arg == "--column")
+        opts.columns.push_back(std::stoul(value));
+      else if (arg == "--group-by")
+        opts.group_by = std::stoul(value);
+      else if (arg == "--threads")
+        opts.threads = std::stoul(value);
+      else if (arg == "--precision")
+        opts.precision = sim::parse_precision(value);
+      else if (arg == "--hash")
+        opts.hash = value;
+      else if (arg == "--sketches")
+        opts.sketches = value;
+      else if (arg == "--block-size")
+        opts.block_size = std::max<std::size_t>(std::stoul(value), 1);
+      else
+        throw std::invalid_argument("unknown option " + arg);
+    }
+    if (opts.files.empty() && !merge)
+      opts.files.push_back("-");
+    return opts;
+  }
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  bool merge = false;
+  counting::options opts;
+  try {
+    opts = parse_options(argc, argv, merge);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << "\nusage: " << argv[0] << usage;
+    return 1;
+  }
+
+  try {
+    if (merge) {
+      std::vector<std::vector<std::uint8_t>> files;
+      for (const auto& path: opts.files)
+        files.push_back(read_file(path));
+      counting::merge_sketches(files, std::cout);
+    } else {
+      counting::run(opts, std::cout);
+    }
+  } catch (const std::exception& e) {
+    std::cerr << argv[0] << ": " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
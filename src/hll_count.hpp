@@ -0,0 +1,497 @@
+#ifndef SRC_HLL_COUNT_HPP_
+#define SRC_HLL_COUNT_HPP_
+
+// Counting of distinct lines or column values of large text files with a
+// thread pool, and merging of the sketches it writes, shared by `hll-count`
+// and `hll_count_benchmark`.
+//
+// Files are mapped into memory where possible and otherwise read as a stream,
+// e.g. standard input. Either way the input is cut into chunks at line
+// boundaries, and every task of the pool counts the chunks it claims into its
+// own counters, which are merged once all chunks are done.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HLL_COUNT_MMAP 1
+#endif
+
+#include "../include/hll/dynamic_hyperloglog.hpp"
+#include "../include/hll/hyperloglog.hpp"
+#include "../include/hll/sketch_map.hpp"
+#include "../include/hll/thread_pool.hpp"
+#include "simulation.hpp"
+
+namespace counting {
+  struct options {
+    // "-" reads standard input
+    std::vector<std::string> files;
+    // separates columns, '\0' counts whole lines
+    char delimiter = '\0';
+    // columns to count, from 1
+    std::vector<std::size_t> columns;
+    // counts the columns per value of this column, 0 for none
+    std::size_t group_by = 0;
+    std::size_t threads = 0;
+    std::uint8_t precision = 14;
+    // "wy" or "murmur"
+    std::string hash = "wy";
+    // writes serialized sketches to files starting with this, if not empty
+    std::string sketches;
+    // maps files into memory where possible, otherwise reads them as streams
+    bool map_files = true;
+    // bytes read at once from streams, per task
+    std::size_t block_size = 8ul << 20;
+  };
+
+  constexpr std::uint8_t sparse_precision = 25;
+
+  // A file mapped into memory, or nothing if it could not be mapped.
+  class mapped_file {
+  public:
+    explicit mapped_file(const std::string& path) {
+#ifdef HLL_COUNT_MMAP
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0)
+        throw std::runtime_error("could not open " + path);
+      struct stat st;
+      if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* p = ::mmap(nullptr, static_cast<std::size_t>(st.st_size),
+            PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+          ptr = static_cast<const char*>(p);
+          length = static_cast<std::size_t>(st.st_size);
+          ::madvise(p, length, MADV_SEQUENTIAL);
+        }
+      } else if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        empty = true;
+      }
+      ::close(fd);
+#else
+      static_cast<void>(path);
+#endif
+    }
+
+    ~mapped_file() {
+#ifdef HLL_COUNT_MMAP
+      if (ptr != nullptr)
+        ::munmap(const_cast<char*>(ptr), length);
+#endif
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    bool mapped() const { return ptr != nullptr || empty; }
+    const char* data() const { return ptr; }
+    std::size_t size() const { return length; }
+
+  private:
+    const char* ptr = nullptr;
+    std::size_t length = 0;
+    bool empty = false;
+  };
+
+  // start of the first line that begins at or after `pos`
+  inline std::size_t line_start(const char* data, std::size_t size,
+      std::size_t pos) {
+    if (pos == 0 || pos >= size)
+      return std::min(pos, size);
+    const void* nl = std::memchr(data + pos - 1, '\n', size - pos + 1);
+    return nl == nullptr ? size
+      : static_cast<std::size_t>(static_cast<const char*>(nl) - data) + 1;
+  }
+
+  // The counters of one task: one counter per column, or one counter per key
+  // and column when grouping.
+  template <std::uint8_t p, typename Hash>
+  class counter_set {
+  public:
+    using hll_t = hll::hyperloglog<std::string, p, sparse_precision,
+          hll::byte_registers, std::allocator<std::uint8_t>, Hash>;
+    using map_t = hll::sketch_map<std::string, std::string, p,
+          sparse_precision, Hash>;
+
+    explicit counter_set(const options& opts)
+        : opts(opts), fields(max_column(opts) + 1) {
+      std::size_t columns = std::max<std::size_t>(opts.columns.size(), 1);
+      if (opts.group_by > 0)
+        maps.resize(columns);
+      else
+        counters.resize(columns);
+      buffers.resize(columns);
+    }
+
+    // counts the lines in [first, last), skipping empty ones
+    void count(const char* first, const char* last) {
+      while (first < last) {
+        const char* end = static_cast<const char*>(
+            std::memchr(first, '\n', static_cast<std::size_t>(last - first)));
+        if (end == nullptr)
+          end = last;
+        const char* line_end = end > first && end[-1] == '\r' ? end - 1 : end;
+        if (line_end > first)
+          count_line(first, line_end);
+        first = end + 1;
+      }
+      flush();
+    }
+
+    void merge(const counter_set& other) {
+      for (std::size_t c = 0; c < counters.size(); c++)
+        counters[c].merge(other.counters[c]);
+      for (std::size_t c = 0; c < maps.size(); c++)
+        maps[c].merge(other.maps[c]);
+    }
+
+    std::vector<hll_t> counters;
+    std::vector<map_t> maps;
+
+  private:
+    const options& opts;
+    // [begin, end) of the columns of the current line, from column 1
+    std::vector<std::pair<const char*, const char*>> fields;
+    std::vector<std::vector<std::uint64_t>> buffers;
+    std::string key;
+
+    static std::size_t max_column(const options& opts) {
+      std::size_t max = opts.group_by;
+      for (auto c: opts.columns)
+        max = std::max(max, c);
+      return max;
+    }
+
+    void count_line(const char* first, const char* last) {
+      if (opts.delimiter == '\0') {
+        add(0, first, last);
+        return;
+      }
+
+      // only the columns up to the last one needed are split
+      std::size_t found = 1;
+      const char* field = first;
+      for (; found < fields.size(); found++) {
+        const char* end = static_cast<const char*>(std::memchr(field,
+              opts.delimiter, static_cast<std::size_t>(last - field)));
+        fields[found] = {field, end == nullptr ? last : end};
+        if (end == nullptr)
+          break;
+        field = end + 1;
+      }
+
+      if (opts.group_by > 0) {
+        if (opts.group_by > found)
+          return;
+        key.assign(fields[opts.group_by].first, fields[opts.group_by].second);
+      }
+      for (std::size_t c = 0; c < opts.columns.size(); c++)
+        if (opts.columns[c] <= found)
+          add(c, fields[opts.columns[c]].first, fields[opts.columns[c]].second);
+    }
+
+    void add(std::size_t c, const char* first, const char* last) {
+      std::uint64_t hash = Hash{}(first, static_cast<std::size_t>(
+            last - first), 0x9E3779B97F4A7C15);
+      if (opts.group_by > 0) {
+        maps[c].insert_hash(key, hash);
+        return;
+      }
+      // hashes are inserted in blocks, as in `hll::hyperloglog::insert()`
+      buffers[c].push_back(hash);
+      if (buffers[c].size() == 1024) {
+        counters[c].insert_hashes(buffers[c].data(), buffers[c].size());
+        buffers[c].clear();
+      }
+    }
+
+    void flush() {
+      for (std::size_t c = 0; c < counters.size(); c++) {
+        counters[c].insert_hashes(buffers[c].data(), buffers[c].size());
+        buffers[c].clear();
+      }
+    }
+  };
+
+  // counts the mapped file `data` in chunks claimed by the tasks
+  template <typename Set>
+  void count_mapped(const char* data, std::size_t size,
+      std::vector<Set>& sets, hll::thread_pool& pool) {
+    // several chunks per task, so that tasks finish at about the same time
+    std::size_t chunk = std::max<std::size_t>(1 << 20,
+        size/(8*sets.size()) + 1);
+    std::vector<std::size_t> starts;
+    for (std::size_t pos = 0; pos < size;
+        pos = line_start(data, size, pos + chunk))
+      starts.push_back(pos);
+    starts.push_back(size);
+
+    std::atomic<std::size_t> next{0};
+    pool.parallel_for(sets.size(), [&](std::size_t t) {
+      for (std::size_t c = next++; c + 1 < starts.size(); c = next++)
+        sets[t].count(data + starts[c], data + starts[c + 1]);
+    });
+  }
+
+  // counts a stream in rounds of one block per task, each cut after its last
+  // complete line
+  template <typename Set>
+  void count_stream(std::istream& in, const options& opts,
+      std::vector<Set>& sets, hll::thread_pool& pool) {
+    std::vector<std::vector<char>> blocks(sets.size());
+    std::vector<std::size_t> ends(sets.size());
+    std::vector<char> carry;
+    while (in) {
+      std::size_t filled = 0;
+      for (; filled < blocks.size() && in; filled++) {
+        std::vector<char>& block = blocks[filled];
+        block.assign(carry.begin(), carry.end());
+        block.resize(carry.size() + opts.block_size);
+        in.read(block.data() + carry.size(),
+            static_cast<std::streamsize>(opts.block_size));
+        block.resize(carry.size() + static_cast<std::size_t>(in.gcount()));
+
+        std::size_t end = block.size();
+        if (in) {
+          while (end > 0 && block[end - 1] != '\n')
+            end--;
+        }
+        carry.assign(block.begin() + static_cast<std::ptrdiff_t>(end),
+            block.end());
+        ends[filled] = end;
+      }
+      pool.parallel_for(filled, [&](std::size_t t) {
+        sets[t].count(blocks[t].data(), blocks[t].data() + ends[t]);
+      });
+    }
+    if (!carry.empty())
+      sets[0].count(carry.data(), carry.data() + carry.size());
+  }
+
+  template <typename Set>
+  void count_file(const std::string& path, const options& opts,
+      std::vector<Set>& sets, hll::thread_pool& pool) {
+    if (path == "-") {
+      count_stream(std::cin, opts, sets, pool);
+      return;
+    }
+    if (opts.map_files) {
+      mapped_file file(path);
+      if (file.mapped()) {
+        count_mapped(file.data(), file.size(), sets, pool);
+        return;
+      }
+    }
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+      throw std::runtime_error("could not open " + path);
+    count_stream(in, opts, sets, pool);
+  }
+
+  inline std::string column_name(const options& opts, std::size_t c) {
+    return opts.columns.empty() ? "line" : std::to_string(opts.columns[c]);
+  }
+
+  inline void write_file(const std::string& path,
+      const std::vector<std::uint8_t>& bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(bytes.data()),
+        static_cast<std::streamsize>(bytes.size()));
+    if (!out)
+      throw std::runtime_error("could not write " + path);
+  }
+
+  // Sketches of grouped counts are written as one file per column, named
+  // PREFIX.<column>.hllg rather than .hll as they are not a single sketch.
+  // The file starts with `grouped_magic` and is followed by records: the
+  // varint length of the key, the key, the varint length of the sketch and
+  // the sketch.
+  constexpr std::uint8_t grouped_magic[2] = {'H', 'G'};
+
+  template <typename Set>
+  void write_sketches(const Set& set, const options& opts) {
+    for (std::size_t c = 0; c < set.counters.size(); c++)
+      write_file(opts.sketches + "." + column_name(opts, c) + ".hll",
+          set.counters[c].serialize());
+
+    for (std::size_t c = 0; c < set.maps.size(); c++) {
+      std::vector<std::uint8_t> records(std::begin(grouped_magic),
+          std::end(grouped_magic));
+      set.maps[c].for_each_estimate([&](const std::string& key, double) {
+        std::vector<std::uint8_t> sketch = set.maps[c].serialize(key);
+        hll::format::write_varint(records, key.size());
+        records.insert(records.end(), key.begin(), key.end());
+        hll::format::write_varint(records, sketch.size());
+        records.insert(records.end(), sketch.begin(), sketch.end());
+      });
+      write_file(opts.sketches + "." + column_name(opts, c) + ".hllg",
+          records);
+    }
+  }
+
+  inline bool is_grouped(const std::vector<std::uint8_t>& file) {
+    return file.size() >= sizeof(grouped_magic) &&
+      std::equal(std::begin(grouped_magic), std::end(grouped_magic),
+          file.begin());
+  }
+
+  // calls `f(key, sketch, size)` for every record of a grouped file
+  template <typename F>
+  void for_each_record(const std::vector<std::uint8_t>& file, F&& f) {
+    std::size_t offset = sizeof(grouped_magic);
+    while (offset < file.size()) {
+      std::uint64_t key_size, sketch_size;
+      if (!hll::format::read_varint(file.data(), file.size(), offset,
+            key_size) || key_size > file.size() - offset)
+        throw std::invalid_argument("truncated grouped sketches");
+      std::string key(reinterpret_cast<const char*>(file.data() + offset),
+          static_cast<std::size_t>(key_size));
+      offset += static_cast<std::size_t>(key_size);
+
+      if (!hll::format::read_varint(file.data(), file.size(), offset,
+            sketch_size) || sketch_size > file.size() - offset)
+        throw std::invalid_argument("truncated grouped sketches");
+      f(key, file.data() + offset, static_cast<std::size_t>(sketch_size));
+      offset += static_cast<std::size_t>(sketch_size);
+    }
+  }
+
+  template <typename Hash>
+  void merge_sketches(const std::vector<std::vector<std::uint8_t>>& files,
+      std::ostream& out) {
+    using counter_t = hll::dynamic_hyperloglog<std::string, Hash>;
+    if (!is_grouped(files[0])) {
+      auto counter = counter_t::deserialize(files[0].data(), files[0].size());
+      for (std::size_t i = 1; i < files.size(); i++)
+        counter.merge(hll::sketch_view(files[i].data(), files[i].size()));
+      out << std::llround(counter.estimate()) << "\n";
+      return;
+    }
+
+    std::map<std::string, counter_t> counters;
+    for (const auto& file: files)
+      for_each_record(file, [&](const std::string& key,
+            const std::uint8_t* sketch, std::size_t size) {
+        auto it = counters.find(key);
+        if (it == counters.end())
+          counters.emplace(key, counter_t::deserialize(sketch, size));
+        else
+          it->second.merge(hll::sketch_view(sketch, size));
+      });
+    for (const auto& counter: counters)
+      out << counter.first << "\t" << std::llround(counter.second.estimate())
+        << "\n";
+  }
+
+  // Merges sketches written by `--sketches`, or any other serialized
+  // counters of strings. Prints the estimate of the union of single
+  // sketches, or a line per key, in order, with the estimate of the union of
+  // its sketches for grouped ones.
+  inline void merge_sketches(
+      const std::vector<std::vector<std::uint8_t>>& files,
+      std::ostream& out) {
+    if (files.empty())
+      throw std::invalid_argument("nothing to merge");
+    bool grouped = is_grouped(files[0]);
+    for (const auto& file: files)
+      if (is_grouped(file) != grouped)
+        throw std::invalid_argument(
+            "grouped and single sketches cannot be merged together");
+
+    // the hash function of the first sketch, if there is any
+    const std::uint8_t* first = files[0].data();
+    std::size_t first_size = files[0].size();
+    if (grouped) {
+      first = nullptr;
+      for (const auto& file: files)
+        for_each_record(file, [&](const std::string&,
+              const std::uint8_t* sketch, std::size_t size) {
+          if (first == nullptr) {
+            first = sketch;
+            first_size = size;
+          }
+        });
+      if (first == nullptr)
+        return;
+    }
+
+    std::uint8_t id = hll::sketch_view(first, first_size).hash_id();
+    if (id == hll::wy_hash::id)
+      merge_sketches<hll::wy_hash>(files, out);
+    else if (id == hll::murmur_hash::id)
+      merge_sketches<hll::murmur_hash>(files, out);
+    else
+      throw std::invalid_argument("unknown hash function of the sketches");
+  }
+
+  // Counts the files of `opts` and writes a line per column, or a line per
+  // key with a column per counted column when grouping, to `out`.
+  template <std::uint8_t p, typename Hash>
+  void run(const options& opts, std::ostream& out) {
+    using set_t = counter_set<p, Hash>;
+    hll::thread_pool pool(opts.threads);
+    std::vector<set_t> sets(pool.size(), set_t(opts));
+    for (const auto& path: opts.files)
+      count_file(path, opts, sets, pool);
+
+    set_t& result = sets[0];
+    for (std::size_t t = 1; t < sets.size(); t++)
+      result.merge(sets[t]);
+
+    for (std::size_t c = 0; c < result.counters.size(); c++)
+      out << column_name(opts, c) << "\t"
+        << std::llround(result.counters[c].estimate()) << "\n";
+
+    if (!result.maps.empty()) {
+      result.maps[0].for_each_estimate(
+          [&](const std::string& key, double estimate) {
+            out << key << "\t" << std::llround(estimate);
+            for (std::size_t c = 1; c < result.maps.size(); c++)
+              out << "\t" << std::llround(result.maps[c].estimate(key));
+            out << "\n";
+          });
+    }
+
+    if (!opts.sketches.empty())
+      write_sketches(result, opts);
+  }
+
+  // `run()` with the precision and hash function of `opts`
+  inline void run(const options& opts, std::ostream& out) {
+    if (opts.group_by > 0 && (opts.delimiter == '\0' || opts.columns.empty()))
+      throw std::invalid_argument(
+          "grouping needs a delimiter and columns to count");
+    if (opts.delimiter == '\0' && !opts.columns.empty())
+      throw std::invalid_argument("columns need a delimiter");
+    for (auto c: opts.columns)
+      if (c == 0)
+        throw std::invalid_argument("columns are numbered from 1");
+
+    sim::with_precision(opts.precision, [&](auto p) {
+      constexpr std::uint8_t precision = decltype(p)::value;
+      if (opts.hash == "wy")
+        run<precision, hll::wy_hash>(opts, out);
+      else if (opts.hash == "murmur")
+        run<precision, hll::murmur_hash>(opts, out);
+      else
+        throw std::invalid_argument("unknown hash function " + opts.hash);
+    });
+  }
+}  // namespace counting
+
+#endif  // SRC_HLL_COUNT_HPP_
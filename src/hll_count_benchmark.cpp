@@ -0,0 +1,145 @@
+// Throughput of `hll-count` on a generated CSV file, against the bandwidth of
+// only finding its lines with `memchr()`.
+//
+// usage: hll_count_benchmark [megabytes [threads [path]]]
+//
+// Writes lines of `user,url,timestamp` to `path` (hll_count_benchmark.csv by
+// default) unless it already has the requested size, then counts distinct
+// lines, distinct urls and distinct urls per user, and distinct urls again
+// reading the file as a stream. Every measurement is the best of three runs,
+// so the file is in the page cache if it fits.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "benchmark.hpp"
+#include "hll_count.hpp"
+
+namespace {
+  std::size_t file_size(const std::string& path) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    return in ? static_cast<std::size_t>(in.tellg()) : 0;
+  }
+
+  // about `bytes` of lines with 100k users, 10M urls and unique timestamps
+  void generate(const std::string& path, std::size_t bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    std::string buffer;
+    char line[96];
+    std::size_t written = 0;
+    for (std::uint64_t i = 0; written < bytes; i++) {
+      std::uint64_t z = bench::splitmix64(i);
+      int n = std::snprintf(line, sizeof(line), "user_%llu,url_%llu,%llu\n",
+          static_cast<unsigned long long>(z % 100'000),
+          static_cast<unsigned long long>((z >> 20) % 10'000'000),
+          static_cast<unsigned long long>(1'600'000'000'000 + i));
+      buffer.append(line, static_cast<std::size_t>(n));
+      written += static_cast<std::size_t>(n);
+      if (buffer.size() > (1 << 20)) {
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        buffer.clear();
+      }
+    }
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    if (!out)
+      throw std::runtime_error("could not write " + path);
+  }
+
+  // seconds to find every line of the file, the upper bound of counting
+  double scan(const std::string& path, std::size_t threads) {
+    counting::mapped_file file(path);
+    if (!file.mapped())
+      throw std::runtime_error("could not map " + path);
+    hll::thread_pool pool(threads);
+    std::vector<std::size_t> lines(pool.size());
+    double seconds = bench::best_of(3, [&]() {
+      std::atomic<std::size_t> next{0};
+      std::size_t chunk = file.size()/(8*pool.size()) + 1;
+      pool.parallel_for(pool.size(), [&](std::size_t t) {
+        lines[t] = 0;
+        for (std::size_t c = next++; c*chunk < file.size(); c = next++) {
+          const char* first = file.data() + c*chunk;
+          const char* last =
+            file.data() + std::min(file.size(), (c + 1)*chunk);
+          while ((first = static_cast<const char*>(std::memchr(first, '\n',
+                    static_cast<std::size_t>(last - first)))) != nullptr) {
+            lines[t]++;
+            first++;
+          }
+        }
+      });
+    });
+    bench::keep(lines[0]);
+    return seconds;
+  }
+
+  void report(const std::string& name, std::size_t bytes, double seconds,
+      double baseline) {
+    double mbs = static_cast<double>(bytes)/seconds/1e6;
+    std::cout << std::fixed << std::setprecision(1) << name << ": " << mbs
+      << " MB/s";
+    if (baseline > 0)
+      std::cout << ", " << 100*baseline/seconds << "% of the line scan";
+    std::cout << "\n";
+  }
+
+  void run(const std::string& name, counting::options opts,
+      std::size_t bytes, double baseline) {
+    std::ostringstream out;
+    double seconds = bench::best_of(3, [&]() {
+      out.str("");
+      counting::run(opts, out);
+    });
+    report(name, bytes, seconds, baseline);
+    if (opts.group_by == 0)
+      std::cout << "  " << out.str();
+  }
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::size_t megabytes = 2048;
+  std::size_t threads = 0;
+  std::string path = "hll_count_benchmark.csv";
+  if (argc > 1)
+    megabytes = std::stoul(argv[1]);
+  if (argc > 2)
+    threads = std::stoul(argv[2]);
+  if (argc > 3)
+    path = argv[3];
+
+  std::size_t bytes = megabytes << 20;
+  if (file_size(path) < bytes) {
+    std::cerr << "writing " << megabytes << " MiB to " << path << "\n";
+    generate(path, bytes);
+  }
+  bytes = file_size(path);
+
+  counting::options opts;
+  opts.files = {path};
+  opts.threads = threads;
+
+  double baseline = scan(path, threads);
+  report("memchr line scan", bytes, baseline, 0);
+
+  run("distinct lines", opts, bytes, baseline);
+
+  opts.delimiter = ',';
+  opts.columns = {2};
+  run("distinct urls", opts, bytes, baseline);
+
+  opts.group_by = 1;
+  run("distinct urls per user", opts, bytes, baseline);
+
+  opts.group_by = 0;
+  opts.map_files = false;
+  run("distinct urls, streamed", opts, bytes, baseline);
+  return 0;
+}
@@ -1,7 +1,12 @@
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
 #include <numeric>
+#include <queue>
 #include <stdexcept>
 #include <string>
 #include <type_traits>
@@ -37,138 +42,134 @@ static inline int hll_countl_zero_u64(std::uint64_t x) noexcept {
 #define hll_countl_zero __builtin_clzll
 #endif
 
-#include "../include/hll/murmurhash.hpp"
-
 namespace hll {
-template <typename T> struct hash;
-
-#define hll_define_integral_hash(Tp)                                           \
-  template <> struct hash<Tp> {                                                \
-    std::uint64_t operator()(const Tp &k, std::uint64_t seed) const {          \
-      return hll::murmurhash3_x64_128(&k, sizeof(k), seed);                    \
-    }                                                                          \
-  };
-
-hll_define_integral_hash(bool)               // NOLINT
-hll_define_integral_hash(char)               // NOLINT
-hll_define_integral_hash(signed char)        // NOLINT
-hll_define_integral_hash(unsigned char)      // NOLINT
-hll_define_integral_hash(wchar_t)            // NOLINT
-hll_define_integral_hash(char16_t)           // NOLINT
-hll_define_integral_hash(char32_t)           // NOLINT
-hll_define_integral_hash(short)              // NOLINT
-hll_define_integral_hash(int)                // NOLINT
-hll_define_integral_hash(long)               // NOLINT
-hll_define_integral_hash(long long)          // NOLINT
-hll_define_integral_hash(unsigned short)     // NOLINT
-hll_define_integral_hash(unsigned int)       // NOLINT
-hll_define_integral_hash(unsigned long)      // NOLINT
-hll_define_integral_hash(unsigned long long) // NOLINT
-
-#undef hll_define_integral_hash
-
-// making sure hash(-0.0f) == hash(+0.0f)
-#define hll_define_floating_point_hash(Tp)                                     \
-  template <> struct hash<Tp> {                                                \
-    std::uint64_t operator()(const Tp &k, std::uint64_t seed) const {          \
-      Tp zero = 0.0;                                                           \
-      return hll::murmurhash3_x64_128(((k == 0.0) ? &zero : &k), sizeof(k),    \
-                                      seed);                                   \
-    }                                                                          \
-  };
-
-hll_define_floating_point_hash(float)       // NOLINT
-hll_define_floating_point_hash(double)      // NOLINT
-hll_define_floating_point_hash(long double) // NOLINT
 
-#undef _hll_define_floating_point_hash
+namespace detail {
+// (raw estimate, bias) of the bias correction of HyperLogLog++, in increasing
+// order of raw estimate
+struct bias_point {
+  double estimate;
+  double bias;
+};
 
-    template <>
-    struct hash<std::string> {
-  std::uint64_t operator()(const std::string &k, std::uint64_t seed) const {
-    return hll::murmurhash3_x64_128(k.c_str(), static_cast<int>(k.length()) + 1,
-                                    seed);
-  }
+struct bias_table {
+  const bias_point *first;
+  const bias_point *last;
 };
 
-const std::vector<std::pair<double, double>> biases[15] = {
+// The tables of precisions 4 to 18, recorded by `record_biases`. They are
+// static members of a class template so that they are constant-initialized
+// and a single copy is shared by all translation units.
+template <typename Unused = void> struct bias_tables {
+  static constexpr bias_point p4[] =
 #include "biases/4"
-    ,
+      ;
+  static constexpr bias_point p5[] =
 #include "biases/5"
-    ,
+      ;
+  static constexpr bias_point p6[] =
 #include "biases/6"
-    ,
+      ;
+  static constexpr bias_point p7[] =
 #include "biases/7"
-    ,
+      ;
+  static constexpr bias_point p8[] =
 #include "biases/8"
-    ,
+      ;
+  static constexpr bias_point p9[] =
 #include "biases/9"
-    ,
+      ;
+  static constexpr bias_point p10[] =
 #include "biases/10"
-    ,
+      ;
+  static constexpr bias_point p11[] =
 #include "biases/11"
-    ,
+      ;
+  static constexpr bias_point p12[] =
 #include "biases/12"
-    ,
+      ;
+  static constexpr bias_point p13[] =
 #include "biases/13"
-    ,
+      ;
+  static constexpr bias_point p14[] =
 #include "biases/14"
-    ,
+      ;
+  static constexpr bias_point p15[] =
 #include "biases/15"
-    ,
+      ;
+  static constexpr bias_point p16[] =
 #include "biases/16"
-    ,
+      ;
+  static constexpr bias_point p17[] =
 #include "biases/17"
-    ,
+      ;
+  static constexpr bias_point p18[] =
 #include "biases/18"
+      ;
+  static constexpr bias_table tables[15] = {
+      {p4, std::end(p4)},
+      {p5, std::end(p5)},
+      {p6, std::end(p6)},
+      {p7, std::end(p7)},
+      {p8, std::end(p8)},
+      {p9, std::end(p9)},
+      {p10, std::end(p10)},
+      {p11, std::end(p11)},
+      {p12, std::end(p12)},
+      {p13, std::end(p13)},
+      {p14, std::end(p14)},
+      {p15, std::end(p15)},
+      {p16, std::end(p16)},
+      {p17, std::end(p17)},
+      {p18, std::end(p18)},
+  };
 };
-} // namespace hll
 
-template <typename T, std::uint8_t p, std::uint8_t sp>
-hll::hyperloglog<T, p, sp>::hyperloglog(bool create_dense, std::uint64_t seed)
-    : seed(seed) {
-  if (create_dense) {
-    sparse = false;
-    convert_to_dense();
-  } else {
-    sparse = true;
-    temporary_list.reserve(temporary_list_max);
-  }
-}
+template <typename U> constexpr bias_point bias_tables<U>::p4[];
+template <typename U> constexpr bias_point bias_tables<U>::p5[];
+template <typename U> constexpr bias_point bias_tables<U>::p6[];
+template <typename U> constexpr bias_point bias_tables<U>::p7[];
+template <typename U> constexpr bias_point bias_tables<U>::p8[];
+template <typename U> constexpr bias_point bias_tables<U>::p9[];
+template <typename U> constexpr bias_point bias_tables<U>::p10[];
+template <typename U> constexpr bias_point bias_tables<U>::p11[];
+template <typename U> constexpr bias_point bias_tables<U>::p12[];
+template <typename U> constexpr bias_point bias_tables<U>::p13[];
+template <typename U> constexpr bias_point bias_tables<U>::p14[];
+template <typename U> constexpr bias_point bias_tables<U>::p15[];
+template <typename U> constexpr bias_point bias_tables<U>::p16[];
+template <typename U> constexpr bias_point bias_tables<U>::p17[];
+template <typename U> constexpr bias_point bias_tables<U>::p18[];
+template <typename U> constexpr bias_table bias_tables<U>::tables[];
 
-template <typename T, std::uint8_t p, std::uint8_t sp>
-double hll::hyperloglog<T, p, sp>::estimate_bias(double est) const {
+inline double estimate_bias(std::uint8_t p, double est) {
   constexpr std::ptrdiff_t k = 6; // K-nn parameter
-  std::vector<std::pair<double, double>> keys(k);
-  auto est_it = std::lower_bound(biases[p - 4].begin(), biases[p - 4].end(),
-                                 std::make_pair(est, 0.0));
-  std::ptrdiff_t est_idx = est_it - biases[p - 4].begin();
-  std::ptrdiff_t ssize = static_cast<std::ptrdiff_t>(biases[p - 4].size());
+  const bias_table &bias = bias_tables<>::tables[p - 4];
+  std::array<bias_point, k> keys;
+  auto est_it = std::lower_bound(
+      bias.first, bias.last, est, [](const bias_point &a, double e) {
+        return a.estimate < e || (!(e < a.estimate) && a.bias < 0.0);
+      });
+  std::ptrdiff_t est_idx = est_it - bias.first;
+  std::ptrdiff_t ssize = bias.last - bias.first;
   std::partial_sort_copy(
-      est_idx <= k ? biases[p - 4].begin() : est_it - k,
-      est_idx + k >= ssize ? biases[p - 4].end() : est_it + k, keys.begin(),
-      keys.end(),
-      [est](const std::pair<double, double> &a,
-            const std::pair<double, double> &b) {
-        return std::abs(a.first - est) < std::abs(b.first - est);
+      est_idx <= k ? bias.first : est_it - k,
+      est_idx + k >= ssize ? bias.last : est_it + k, keys.begin(), keys.end(),
+      [est](const bias_point &a, const bias_point &b) {
+        return std::abs(a.estimate - est) < std::abs(b.estimate - est);
       });
 
   double sum = 0;
   double weight_sum = 0;
-  std::tie(sum, weight_sum) = std::accumulate(
-      keys.begin(), keys.begin() + k, std::make_pair(0.0, 0.0),
-      [est](std::pair<double, double> t,     // (sum, sum of weights)
-            std::pair<double, double> key) { // (distance, bias)
-        return std::make_pair(
-            t.first + key.second * 1.0 / (std::abs(key.first - est) + 1e-5),
-            t.second + 1.0 / (std::abs(key.first - est) + 1e-5));
-      });
-
+  for (const auto &key : keys) {
+    double weight = 1.0 / (std::abs(key.estimate - est) + 1e-5);
+    sum += key.bias * weight;
+    weight_sum += weight;
+  }
   return sum / weight_sum;
 }
 
-template <typename T, std::uint8_t p, std::uint8_t sp>
-constexpr double hll::hyperloglog<T, p, sp>::alpha() const {
+inline double alpha(std::uint8_t p) {
   if (p == 4)
     return 0.673;
   else if (p == 5)
@@ -176,47 +177,117 @@ constexpr double hll::hyperloglog<T, p, sp>::alpha() const {
   else if (p == 6)
     return 0.709;
   else
-    return 0.7213 / (1.0 + 1.079 / (1ul << p));
+    return 0.7213 / (1.0 + 1.079 / static_cast<double>(1ul << p));
 }
 
-template <typename T, std::uint8_t p, std::uint8_t sp>
-constexpr double hll::hyperloglog<T, p, sp>::threshold() const {
+inline double threshold(std::uint8_t p) {
   constexpr double thresholds[] = {10,    20,    40,    80,     220,
                                    400,   900,   1800,  3100,   6500,
                                    11500, 20000, 50000, 120000, 350000};
   return thresholds[p - 4];
 }
 
-template <typename T, std::uint8_t p, std::uint8_t sp>
-bool hll::hyperloglog<T, p, sp>::is_sparse() const {
-  return sparse;
+// linear counting estimate for 2^p registers of which `non_zero` are set
+inline double linear_estimate(std::uint8_t p, std::size_t non_zero) {
+  double m = static_cast<double>(1ul << p);
+  return m * std::log(m / (m - static_cast<double>(non_zero)));
 }
 
-template <typename T, std::uint8_t p, std::uint8_t sp>
-const std::vector<std::uint8_t> &hll::hyperloglog<T, p, sp>::dense_vec() const {
-  return dense;
+// `sum` is the harmonic sum of the 2^p dense registers, i.e. sum of 2^-m_j
+inline double raw_estimate(std::uint8_t p, double sum) {
+  return alpha(p) * std::pow((1ul << p), 2) / sum;
 }
 
-template <typename T, std::uint8_t p, std::uint8_t sp>
-double hll::hyperloglog<T, p, sp>::linear_estimate(std::size_t non_zero) const {
-  double m;
-  if (sparse)
-    m = static_cast<double>(1ul << sp);
+// HyperLogLog++ estimate of a dense counter from its raw estimate
+inline double dense_estimate(std::uint8_t p, double e,
+                             std::size_t non_zeros) {
+  if (e <= 5 * (1ul << p))
+    e = e - estimate_bias(p, e);
+
+  double h;
+  if (non_zeros < (1ul << p))
+    h = linear_estimate(p, non_zeros);
   else
-    m = static_cast<double>(1ul << p);
+    h = e;
 
-  return m * std::log(m / (m - static_cast<double>(non_zero)));
+  if (h <= threshold(p))
+    return h;
+  else
+    return e;
 }
 
-template <typename T, std::uint8_t p, std::uint8_t sp>
-std::pair<std::uint64_t, std::uint8_t>
-hll::hyperloglog<T, p, sp>::get_hash_rank(std::uint64_t hash) const {
-  std::uint8_t precision;
-  if (sparse)
-    precision = sp;
-  else
-    precision = p;
+// sigma(x) = x + sum_k x^(2^k) 2^(k-1), see Ertl (2017)
+inline double ertl_sigma(double x) {
+  if (x == 1.0)
+    return std::numeric_limits<double>::infinity();
+  double y = 1;
+  double z = x;
+  double previous;
+  do {
+    x *= x;
+    previous = z;
+    z += x * y;
+    y += y;
+  } while (z != previous);
+  return z;
+}
+
+// tau(x) = (1 - x - sum_k (1 - x^(2^-k))^2 2^-k) / 3, see Ertl (2017)
+inline double ertl_tau(double x) {
+  if (x == 0.0 || x == 1.0)
+    return 0.0;
+  double y = 1;
+  double z = 1 - x;
+  double previous;
+  do {
+    x = std::sqrt(x);
+    previous = z;
+    y *= 0.5;
+    z -= (1 - x) * (1 - x) * y;
+  } while (z != previous);
+  return z / 3;
+}
+
+// Histogram of the ranks of dense registers. Runs of equal ranks are counted
+// in four histograms, so that consecutive increments do not wait for each
+// other.
+template <typename Registers>
+std::array<std::size_t, 64> register_histogram(const Registers &registers) {
+  std::array<std::array<std::size_t, 64>, 4> partial{};
+  std::size_t size = registers.size();
+  std::size_t i = 0;
+  for (; i + 4 <= size; i += 4)
+    for (std::size_t j = 0; j < 4; j++)
+      partial[j][registers.get(i + j)]++;
+  for (; i < size; i++)
+    partial[0][registers.get(i)]++;
+
+  for (std::size_t r = 0; r < 64; r++)
+    partial[0][r] += partial[1][r] + partial[2][r] + partial[3][r];
+  return partial[0];
+}
+
+// Ertl's improved raw estimate of 2^p dense registers, where `histogram[r]`
+// registers have rank r. Ranks are capped at 64 - p, which has the
+// probability of a rank of 63 - p, so the estimator sees 63 - p hash bits.
+inline double improved_estimate(std::uint8_t p,
+                                const std::array<std::size_t, 64> &histogram) {
+  const double m = static_cast<double>(1ul << p);
+  const std::size_t q = 63u - p;
+  if (histogram[0] == (1ul << p))
+    return 0.0;
 
+  double z = m * ertl_tau(1 - static_cast<double>(histogram[q + 1]) / m);
+  for (std::size_t k = q; k >= 1; k--)
+    z = 0.5 * (z + static_cast<double>(histogram[k]));
+  z += m * ertl_sigma(static_cast<double>(histogram[0]) / m);
+  return m * m / (2 * std::log(2.0) * z);
+}
+
+// splits a hash into the register index, the first `precision` bits, and the
+// rank, the position of the first set bit in the rest
+inline std::pair<std::uint64_t, std::uint8_t>
+hash_rank(std::uint64_t hash, std::uint8_t precision) {
   std::uint64_t index = hash >> (sizeof(hash) * 8 - precision);
 
   std::uint8_t rank = static_cast<std::uint8_t>(sizeof(hash) * 8 - precision);
@@ -226,228 +297,950 @@ hll::hyperloglog<T, p, sp>::get_hash_rank(std::uint64_t hash) const {
   return std::make_pair(index, rank);
 }
 
-template <typename T, std::uint8_t p, std::uint8_t sp>
-uint64_t hll::hyperloglog<T, p, sp>::encode_hash(std::uint64_t index,
-                                                 std::uint8_t rank) const {
-  return (index << rank_bits) | rank;
+// maps a sparse (index, rank) pair with precision `sp` to the dense register
+// index and rank with precision `p`
+inline std::pair<std::uint64_t, std::uint8_t>
+sparse_to_dense(std::uint64_t index, std::uint8_t rank, std::uint8_t p,
+                std::uint8_t sp) {
+  std::uint64_t dense_index = (index >> (sp - p));
+  std::uint64_t betweens = (index & ((1ul << (sp - p)) - 1));
+  std::uint8_t dense_rank;
+
+  if (betweens == 0)
+    dense_rank = static_cast<std::uint8_t>(rank + (sp - p));
+  else
+    dense_rank = static_cast<std::uint8_t>(
+        (static_cast<std::uint8_t>(hll_countl_zero(betweens)) -
+         (sizeof(betweens) * 8 - static_cast<std::size_t>(sp - p))) +
+        1);
+  return std::make_pair(dense_index, dense_rank);
 }
 
-template <typename T, std::uint8_t p, std::uint8_t sp>
+// Sorts sparse entries (index << 6 | rank) and keeps the highest rank of
+// every index, returning the end of the remaining entries.
+template <typename E> E *sort_unique_entries(E *first, E *last) {
+  constexpr int rank_bits = 6;
+  if (first == last)
+    return last;
+
+  // entries of the same index are sorted by increasing rank
+  std::sort(first, last);
+  E *out = first;
+  for (E *it = first + 1; it != last; ++it) {
+    if ((*it >> rank_bits) != (*out >> rank_bits))
+      ++out;
+    *out = *it;
+  }
+  return out + 1;
+}
+
+// Merges the sorted, deduplicated sparse entries [first, last) into `list`,
+// which should not contain them. The merge runs from the back of `list`, so
+// it needs no memory beyond the capacity of `list`.
+template <typename V>
+void merge_sorted_entries(V &list, const typename V::value_type *first,
+                          const typename V::value_type *last) {
+  using E = typename V::value_type;
+  constexpr int rank_bits = 6;
+  std::size_t n = list.size();
+  std::size_t k = static_cast<std::size_t>(last - first);
+  if (k == 0)
+    return;
+
+  list.resize(n + k);
+  E *data = list.data();
+  std::size_t out = n + k, i = n, j = k;
+  while (i > 0 && j > 0) {
+    E a = data[i - 1];
+    E b = first[j - 1];
+    if ((a >> rank_bits) == (b >> rank_bits)) {
+      data[--out] = std::max(a, b);
+      --i;
+      --j;
+    } else if (a > b) {
+      data[--out] = a;
+      --i;
+    } else {
+      data[--out] = b;
+      --j;
+    }
+  }
+  while (j > 0)
+    data[--out] = first[--j];
+
+  // Entries of the same index left a gap of `out - i` at the front.
+  std::size_t gap = out - i;
+  if (gap > 0) {
+    std::move_backward(data, data + i, data + out);
+    std::move(data + gap, data + n + k, data);
+    list.resize(n + k - gap);
+  }
+}
+
+// Sorted, deduplicated copy of the sparse entries [first, last). Const methods
+// sort into it rather than into a member, so that many threads can read the
+// same counter at once.
+//
+// The memory comes from the counter's allocator `alloc`. Allocators that are
+// always equal, e.g. `std::allocator`, share one buffer per thread, so that
+// estimates and merges in a steady state allocate nothing. A copy is then
+// valid until the next one on the same thread, and the buffer keeps the
+// largest copy it held, at most a temporary list or a `sketch_map` block of a
+// few times 2^p bytes. Other allocators get a new buffer for every copy.
+template <typename E, typename A> class sorted_entries {
+public:
+  sorted_entries(const E *first, const E *last, const A &alloc,
+                 std::size_t capacity = 0)
+      : own(alloc) {
+    std::vector<E, A> &buffer = buffer_for(
+        typename std::allocator_traits<A>::is_always_equal{});
+    buffer.reserve(capacity);
+    buffer.assign(first, last);
+    E *data = buffer.data();
+    begin_ = data;
+    end_ = sort_unique_entries(data, data + buffer.size());
+  }
+
+  sorted_entries(const sorted_entries &) = delete;
+  sorted_entries &operator=(const sorted_entries &) = delete;
+
+  const E *begin() const { return begin_; }
+  const E *end() const { return end_; }
+
+private:
+  std::vector<E, A> own;
+  const E *begin_;
+  const E *end_;
+
+  std::vector<E, A> &buffer_for(std::true_type) {
+    thread_local std::vector<E, A> shared(own.get_allocator());
+    return shared;
+  }
+  std::vector<E, A> &buffer_for(std::false_type) { return own; }
+};
+
+// The buffer takes the capacity of the temporary list, so that it does not
+// grow again as the list fills up.
+template <typename V>
+sorted_entries<typename V::value_type, typename V::allocator_type>
+sorted_temporary(const V &temporary) {
+  return {temporary.data(), temporary.data() + temporary.size(),
+          temporary.get_allocator(), temporary.capacity()};
+}
+
+// The sparse representation shared by `hll::hyperloglog` and
+// `hll::dynamic_hyperloglog`: a sorted, deduplicated sparse list of entries
+// (index << 6 | rank) and an unsorted temporary list of new entries. Both
+// counters go through the functions below, so that they keep the same entries
+// and convert to dense registers at the same points.
+
+// Merges the temporary list into the sparse list in place, so that once the
+// sparse list has grown to its working size no memory is allocated.
+template <typename V> void merge_temporary_list(V &sparse, V &temporary) {
+  HLL_INSTRUMENT(instrumentation::event::merge_temp, 1);
+  auto *first = temporary.data();
+  auto *last = sort_unique_entries(first, first + temporary.size());
+  merge_sorted_entries(sparse, first, last);
+  temporary.clear();
+}
+
+// Appends the entries of `count` hashes to the temporary list, merging it into
+// the sparse list once it holds `temporary_max` entries, and returns whether
+// the sparse list holds `sparse_max` entries and should be converted to dense
+// registers. The whole block is appended so that at most one merge is paid
+// for it. Converting between blocks results in exactly the same registers as
+// inserting the hashes one by one.
+template <typename V>
+bool insert_sparse_hashes(V &sparse, V &temporary, const std::uint64_t *hashes,
+                          std::size_t count, std::uint8_t sp,
+                          std::size_t sparse_max, std::size_t temporary_max) {
+  constexpr int rank_bits = 6;
+  for (std::size_t i = 0; i < count; i++) {
+    std::uint64_t index;
+    std::uint8_t rank;
+    std::tie(index, rank) = hash_rank(hashes[i], sp);
+    temporary.push_back(
+        static_cast<typename V::value_type>(index << rank_bits | rank));
+  }
+
+  if (temporary.size() >= temporary_max)
+    merge_temporary_list(sparse, temporary);
+  return sparse.size() >= sparse_max;
+}
+
+// Register updates are random accesses into a 2^p byte array, which for larger
+// precisions does not fit in L1. The indices of the whole block of at most 64
+// hashes are computed and their cache lines prefetched before any register is
+// touched with `update(index, rank)`.
+template <typename Registers, typename Update>
+void insert_dense_hashes(const Registers &registers,
+                         const std::uint64_t *hashes, std::size_t count,
+                         std::uint8_t p, Update update) {
+  std::uint64_t indices[64];
+  std::uint8_t ranks[64];
+  const std::uint8_t max_rank = static_cast<std::uint8_t>(64 - p);
+  for (std::size_t i = 0; i < count; i++) {
+    indices[i] = hashes[i] >> max_rank;
+    std::uint64_t h = hashes[i] << p;
+    ranks[i] = max_rank;
+    if (h > 0)
+      ranks[i] = std::min(
+          max_rank, static_cast<std::uint8_t>(hll_countl_zero(h) + 1));
+    registers.prefetch(indices[i]);
+  }
+
+  for (std::size_t i = 0; i < count; i++)
+    update(indices[i], ranks[i]);
+}
+
+// Hashes the items of [first, last) in blocks of `batch` and passes each block
+// to `insert(hashes, count)`. Numbers are copied into a block and hashed with
+// a single `hash_many()`, which hashes several keys at once with some
+// policies.
+template <typename T, typename Hash, std::size_t batch, typename InputIt,
+          typename Insert>
+void hash_range(InputIt first, InputIt last, std::uint64_t seed,
+                Insert insert, std::true_type) {
+  T keys[batch];
+  std::uint64_t hashes[batch];
+  while (first != last) {
+    std::size_t count = 0;
+    for (; count < batch && first != last; ++first)
+      keys[count++] = *first;
+    Hash{}.hash_many(keys, count, seed, hashes);
+    insert(hashes, count);
+  }
+}
+
+template <typename T, typename Hash, std::size_t batch, typename InputIt,
+          typename Insert>
+void hash_range(InputIt first, InputIt last, std::uint64_t seed,
+                Insert insert, std::false_type) {
+  std::uint64_t hashes[batch];
+  while (first != last) {
+    std::size_t count = 0;
+    for (; count < batch && first != last; ++first)
+      hashes[count++] = Hash{}(*first, seed);
+    insert(hashes, count);
+  }
+}
+
+// number of distinct indices of the sparse and temporary lists
+template <typename V>
+std::size_t distinct_entries(const V &sparse, const V &temporary) {
+  constexpr int rank_bits = 6;
+  using E = typename V::value_type;
+  const auto &temp = sorted_temporary(temporary);
+  std::size_t distinct = sparse.size();
+  auto it = sparse.begin();
+  for (const E *e = temp.begin(); e != temp.end(); ++e) {
+    while (it != sparse.end() && (*it >> rank_bits) < (*e >> rank_bits))
+      ++it;
+    if (it == sparse.end() || (*it >> rank_bits) != (*e >> rank_bits))
+      distinct++;
+  }
+  return distinct;
+}
+
+// sorted, deduplicated union of the sparse and temporary lists
+template <typename V> V merged_entries(const V &sparse, const V &temporary) {
+  const auto &temp = sorted_temporary(temporary);
+  V list(sparse.get_allocator());
+  list.reserve(sparse.size() +
+               static_cast<std::size_t>(temp.end() - temp.begin()));
+  list.assign(sparse.begin(), sparse.end());
+  merge_sorted_entries(list, temp.begin(), temp.end());
+  return list;
+}
+
+// Histogram of the dense registers of precision `p` that the sparse and
+// temporary lists with sparse precision `sp` convert to. The entries of a
+// dense register are adjacent once sorted, so the registers are not built:
+// one pass over both lists in order keeps the highest rank of each.
+template <typename V>
+std::array<std::size_t, 64> sparse_histogram(const V &sparse,
+                                             const V &temporary,
+                                             std::uint8_t p, std::uint8_t sp) {
+  constexpr int rank_bits = 6;
+  using E = typename V::value_type;
+  std::array<std::size_t, 64> histogram{};
+  std::size_t touched = 0;
+  std::uint64_t current = 0;
+  std::uint8_t current_rank = 0; // ranks are at least 1
+  auto add = [&](E entry) {
+    std::uint64_t index;
+    std::uint8_t rank;
+    std::tie(index, rank) = sparse_to_dense(
+        entry >> rank_bits,
+        static_cast<std::uint8_t>(entry & ((1u << rank_bits) - 1)), p, sp);
+    if (current_rank > 0 && index != current) {
+      histogram[current_rank]++;
+      touched++;
+      current_rank = 0;
+    }
+    current = index;
+    current_rank = std::max(current_rank, rank);
+  };
+
+  const auto &temp = sorted_temporary(temporary);
+  auto it = sparse.begin();
+  for (const E *e = temp.begin(); e != temp.end(); ++e) {
+    for (; it != sparse.end() && *it < *e; ++it)
+      add(*it);
+    add(*e);
+  }
+  for (; it != sparse.end(); ++it)
+    add(*it);
+  if (current_rank > 0) {
+    histogram[current_rank]++;
+    touched++;
+  }
+  histogram[0] = (std::size_t{1} << p) - touched;
+  return histogram;
+}
+
+// Sets the dense registers of precision `p` to the entries of the sparse and
+// temporary lists with sparse precision `sp`, in any order.
+template <typename V, typename Registers>
+void add_sparse_entries(const V &sparse, const V &temporary, std::uint8_t p,
+                        std::uint8_t sp, Registers &registers) {
+  constexpr int rank_bits = 6;
+  for (const auto &list : {&sparse, &temporary})
+    for (const auto entry : *list) {
+      std::uint64_t index;
+      std::uint8_t rank;
+      std::tie(index, rank) = sparse_to_dense(
+          entry >> rank_bits,
+          static_cast<std::uint8_t>(entry & ((1u << rank_bits) - 1)), p, sp);
+      registers.update(index, rank);
+    }
+}
+
+// frees the memory of sparse lists once a counter is dense
+template <typename V> void release(V &list) {
+  list.clear();
+  list.shrink_to_fit();
+}
+
+template <typename V>
+const V *counter_address(const V &counter, std::false_type) {
+  return &counter;
+}
+
+template <typename V> V counter_address(V counter, std::true_type) {
+  return counter;
+}
+
+// address of an element of a range of counters or of pointers to counters
+template <typename V>
+const typename std::remove_pointer<V>::type *counter_address(const V &v) {
+  return counter_address(v, std::is_pointer<V>{});
+}
+
+// a block of byte registers as `serialize_sketch()` reads them
+struct register_block {
+  const std::uint8_t *data;
+  std::size_t count;
+
+  std::size_t size() const { return count; }
+  std::uint8_t get(std::size_t index) const { return data[index]; }
+};
+
+// Serializes a counter in the format described in `sketch_view.hpp`, from its
+// sorted sparse entries if it is sparse or from its registers otherwise.
+template <typename Entries, typename Registers>
+std::vector<std::uint8_t>
+serialize_sketch(std::uint8_t p, std::uint8_t sp, std::uint8_t hash_id,
+                 std::uint64_t seed, bool sparse, const Entries &entries,
+                 const Registers &registers) {
+  std::vector<std::uint8_t> out(format::header_size, 0);
+  out[0] = format::magic[0];
+  out[1] = format::magic[1];
+  out[2] = format::version;
+  out[3] = p;
+  out[4] = sp;
+  out[5] = static_cast<std::uint8_t>(sparse ? format::representation::sparse
+                                            : format::representation::dense);
+  out[6] = hash_id;
+  for (std::size_t i = 0; i < 8; i++)
+    out[8 + i] = static_cast<std::uint8_t>(seed >> (8 * i));
+
+  if (sparse) {
+    format::write_varint(out, entries.size());
+    std::uint64_t previous = 0;
+    for (const auto i : entries) {
+      format::write_varint(out, i - previous);
+      previous = i;
+    }
+  } else {
+    out.resize(format::header_size + format::dense_payload_size(p), 0);
+    std::uint8_t *payload = out.data() + format::header_size;
+    for (std::size_t i = 0; i < registers.size(); i++) {
+      std::size_t bit = i * format::rank_bits;
+      unsigned word = static_cast<unsigned>(registers.get(i)) << (bit % 8);
+      payload[bit / 8] = static_cast<std::uint8_t>(payload[bit / 8] | word);
+      if (word > 0xff)
+        payload[bit / 8 + 1] = static_cast<std::uint8_t>(word >> 8);
+    }
+  }
+
+  return out;
+}
+} // namespace detail
+} // namespace hll
+
+template <typename T, std::uint8_t p, std::uint8_t sp, typename R, typename A,
+          typename H>
+hll::hyperloglog<T, p, sp, R, A, H>::hyperloglog(bool create_dense,
+                                                 std::uint64_t seed,
+                                                 const A &alloc)
+    : seed(seed), dense(0, alloc),
+      sparse_list(typename entry_vector::allocator_type(alloc)),
+      temporary_list(typename entry_vector::allocator_type(alloc)),
+      scratch(typename entry_vector::allocator_type(alloc)) {
+  if (create_dense) {
+    sparse = false;
+    convert_to_dense();
+  } else {
+    sparse = true;
+    temporary_list.reserve(temporary_list_max + batch_size);
+  }
+}
+
+template <typename T, std::uint8_t p, std::uint8_t sp, typename R, typename A,
+          typename H>
+A hll::hyperloglog<T, p, sp, R, A, H>::get_allocator() const {
+  return A(sparse_list.get_allocator());
+}
+
+template <typename T, std::uint8_t p, std::uint8_t sp, typename R, typename A,
+          typename H>
+bool hll::hyperloglog<T, p, sp, R, A, H>::is_sparse() const {
+  return sparse;
+}
+
+template <typename T, std::uint8_t p, std::uint8_t sp, typename R, typename A,
+          typename H>
+auto hll::hyperloglog<T, p, sp, R, A, H>::dense_vec() const
+    -> decltype(std::declval<const registers_type &>().values()) {
+  return dense.values();
+}
+
+template <typename T, std::uint8_t p, std::uint8_t sp, typename R, typename A,
+          typename H>
+hll::sketch_stats hll::hyperloglog<T, p, sp, R, A, H>::stats() const {
+  hll::sketch_stats s;
+  s.sparse = sparse;
+  s.sparse_entries = sparse_list.size();
+  s.temporary_entries = temporary_list.size();
+  s.temporary_entries_max = temporary_list_max;
+  s.sparse_entries_max = sparse_list_max;
+  s.sparse_bytes = (sparse_list.capacity() + temporary_list.capacity() +
+                    scratch.capacity()) *
+                   sizeof(sparse_entry);
+  s.dense_bytes = R::bytes_for(dense.size());
+
+  if (sparse) {
+    s.register_histogram =
+        detail::sparse_histogram(sparse_list, temporary_list, p, sp);
+    return s;
+  }
+  for (std::size_t i = 0; i < dense.size(); i++)
+    s.register_histogram[dense.get(i)]++;
+  return s;
+}
+
+template <typename T, std::uint8_t p, std::uint8_t sp, typename R, typename A,
+          typename H>
+auto hll::hyperloglog<T, p, sp, R, A, H>::encode_hash(std::uint64_t index,
+                                                      std::uint8_t rank) const
+    -> sparse_entry {
+  return static_cast<sparse_entry>((index << rank_bits) | rank);
+}
+
+template <typename T, std::uint8_t p, std::uint8_t sp, typename R, typename A,
+          typename H>
 std::pair<std::uint64_t, std::uint8_t>
-hll::hyperloglog<T, p, sp>::decode_hash(std::uint64_t hash) const {
+hll::hyperloglog<T, p, sp, R, A, H>::decode_hash(std::uint64_t hash) const {
   std::uint64_t index = (hash >> rank_bits);
   std::uint8_t rank = static_cast<std::uint8_t>(((1 << rank_bits) - 1) & hash);
   return std::make_pair(index, rank);
 }
 
-template <typename T, std::uint8_t p, std::uint8_t sp>
-void hll::hyperloglog<T, p, sp>::merge(
-    const hll::hyperloglog<T, p, sp> &other) {
+template <typename T, std::uint8_t p, std::uint8_t sp, typename R, typename A,
+          typename H>
+void hll::hyperloglog<T, p, sp, R, A, H>::merge(
+    const hll::hyperloglog<T, p, sp, R, A, H> &other) {
   if (seed != other.seed)
     throw std::invalid_argument(
         "two counters should have the same seed to merge");
+  if (&other == this)
+    return;
+  HLL_INSTRUMENT(instrumentation::merge_event(sparse, other.sparse), 1);
 
   if (other.sparse && sparse) {
     merge_temp();
-    std::vector<std::uint64_t> other_slist = other.merged_temp_list();
-    std::vector<std::uint64_t> merged_slist = merged_sorted_list(other_slist);
-    sparse_list.swap(merged_slist);
+    detail::merge_sorted_entries(
+        sparse_list, other.sparse_list.data(),
+        other.sparse_list.data() + other.sparse_list.size());
+    const auto &other_temp = detail::sorted_temporary(other.temporary_list);
+    detail::merge_sorted_entries(sparse_list, other_temp.begin(),
+                                 other_temp.end());
+    sparse_count.set(sparse_list.size());
   } else {
-    std::vector<std::uint8_t> other_converted;
     if (sparse)
       convert_to_dense();
 
-    auto other_dense_begin = other.dense.begin();
     if (other.sparse) {
-      other_converted = other.converted_to_dense();
-      other_dense_begin = other_converted.begin();
+      for (const auto &list : {&other.sparse_list, &other.temporary_list})
+        for (const auto entry : *list) {
+          std::uint64_t index;
+          std::uint8_t rank;
+          std::tie(index, rank) = decode_hash(entry);
+          std::tie(index, rank) = detail::sparse_to_dense(index, rank, p, sp);
+          update_register(index, rank);
+        }
+    } else {
+      dense.merge(other.dense);
+      sums = dense.sums();
     }
+  }
+}
+
+template <typename T, std::uint8_t p, std::uint8_t sp, typename R, typename A,
+          typename H>
+void hll::hyperloglog<T, p, sp, R, A, H>::merge(const hll::sketch_view &other) {
+  if (other.precision() != p || other.sparse_precision() != sp)
+    throw std::invalid_argument(
+        "two counters should have the same precisions to merge");
+  if (seed != other.seed())
+    throw std::invalid_argument(
+        "two counters should have the same seed to merge");
+  if (other.hash_id() != H::id)
+    throw std::invalid_argument(
+        "two counters should have the same hash function to merge");
+  HLL_INSTRUMENT(instrumentation::merge_event(sparse, other.is_sparse()), 1);
 
-    std::transform(dense.begin(), dense.end(), other_dense_begin, dense.begin(),
-                   [](const std::uint8_t a, const std::uint8_t b) {
-                     return std::max(a, b);
-                   });
+  if (other.is_sparse() && sparse) {
+    merge_temp();
+    scratch.clear();
+    other.for_each_sparse([this](std::uint64_t index, std::uint8_t rank) {
+      scratch.push_back(encode_hash(index, rank));
+    });
+    detail::merge_sorted_entries(sparse_list, scratch.data(),
+                                 scratch.data() + scratch.size());
+    sparse_count.set(sparse_list.size());
+  } else {
+    if (sparse)
+      convert_to_dense();
+
+    if (other.is_sparse()) {
+      other.for_each_sparse([this](std::uint64_t index, std::uint8_t rank) {
+        std::uint64_t dense_index;
+        std::uint8_t dense_rank;
+        std::tie(dense_index, dense_rank) =
+            detail::sparse_to_dense(index, rank, p, sp);
+        update_register(dense_index, dense_rank);
+      });
+    } else {
+      for (std::size_t i = 0; i < dense.size(); i++)
+        update_register(i, other.dense_register(i));
+    }
   }
 }
 
-template <typename T, std::uint8_t precision, std::uint8_t sparse_precision>
-void hll::hyperloglog<T, precision, sparse_precision>::insert(T item) {
-  std::uint64_t index;
-  std::uint8_t rank;
-  std::tie(index, rank) = get_hash_rank(hll::hash<T>{}(item, seed));
+template <typename T, std::uint8_t p, std::uint8_t sp, typename R, typename A,
+          typename H>
+template <typename InputIt>
+void hll::hyperloglog<T, p, sp, R, A, H>::merge(InputIt first, InputIt last) {
+  merge_range(first, last, nullptr);
+}
 
-  if (sparse) {
-    std::uint64_t encoded = encode_hash(index, rank);
-    temporary_list.push_back(encoded);
+template <typename T, std::uint8_t p, std::uint8_t sp, typename R, typename A,
+          typename H>
+template <typename InputIt>
+void hll::hyperloglog<T, p, sp, R, A, H>::merge(InputIt first, InputIt last,
+                                                hll::thread_pool &pool) {
+  merge_range(first, last, &pool);
+}
 
-    if (temporary_list.size() >= temporary_list_max)
-      merge_temp();
+template <typename T, std::uint8_t p, std::uint8_t sp, typename R, typename A,
+          typename H>
+template <typename InputIt>
+void hll::hyperloglog<T, p, sp, R, A, H>::merge_range(InputIt first,
+                                                      InputIt last,
+                                                      hll::thread_pool *pool) {
+  std::vector<const hll::hyperloglog<T, p, sp, R, A, H> *> others;
+  for (; first != last; ++first)
+    others.push_back(detail::counter_address(*first));
+  merge_many(others, pool);
+}
 
-    if (sparse_list.size() >= sparse_list_max)
-      convert_to_dense();
-  } else if (rank > dense[index]) {
-    dense[index] = rank;
+template <typename T, std::uint8_t p, std::uint8_t sp, typename R, typename A,
+          typename H>
+void hll::hyperloglog<T, p, sp, R, A, H>::merge_many(
+    const std::vector<const hll::hyperloglog<T, p, sp, R, A, H> *> &counters,
+    hll::thread_pool *pool) {
+  std::vector<const hll::hyperloglog<T, p, sp, R, A, H> *> others;
+  for (const auto h : counters) {
+    if (h->seed != seed)
+      throw std::invalid_argument(
+          "two counters should have the same seed to merge");
+    if (h != this) // merging with itself changes nothing
+      others.push_back(h);
   }
-}
+  if (others.empty())
+    return;
 
-template <typename T, std::uint8_t precision, std::uint8_t sparse_precision>
-void hll::hyperloglog<T, precision, sparse_precision>::merge_temp() {
-  std::vector<std::uint64_t> new_sparse_list = merged_temp_list();
-  sparse_list.swap(new_sparse_list);
-  temporary_list.clear();
-}
-
-template <typename T, std::uint8_t precision, std::uint8_t sparse_precision>
-std::vector<std::uint64_t>
-hll::hyperloglog<T, precision, sparse_precision>::merged_sorted_list(
-    const std::vector<std::uint64_t> &sorted_list) const {
-  std::vector<std::uint64_t> new_sparse_list;
-
-  auto it1 = sorted_list.begin();
-  auto it2 = sparse_list.begin();
-
-  while (it1 != sorted_list.end() && it2 != sparse_list.end()) {
-    std::uint64_t index1;
-    std::uint8_t rank1;
-    std::tie(index1, rank1) = decode_hash(*it1);
-    std::uint64_t index2;
-    std::uint8_t rank2;
-    std::tie(index2, rank2) = decode_hash(*it2);
-
-    if (index1 == index2) {
-      new_sparse_list.push_back(encode_hash(index1, std::max(rank1, rank2)));
-      ++it1;
-      ++it2;
-    } else if (index1 > index2) {
-      new_sparse_list.push_back(encode_hash(index2, rank2));
-      ++it2;
+  // Sorted sparse entries of each sparse counter, only copied if it has
+  // entries left in its temporary list.
+  std::vector<entry_vector> copies;
+  std::vector<sorted_range> lists;
+  std::vector<const registers_type *> dense_others;
+  for (const auto h : others) {
+    if (h->sparse) {
+      if (!h->temporary_list.empty()) {
+        copies.push_back(h->merged_temp_list());
+        lists.emplace_back(copies.back().data(),
+                           copies.back().data() + copies.back().size());
+      } else {
+        lists.emplace_back(h->sparse_list.data(),
+                           h->sparse_list.data() + h->sparse_list.size());
+      }
     } else {
-      new_sparse_list.push_back(encode_hash(index1, rank1));
-      ++it1;
+      dense_others.push_back(&h->dense);
     }
   }
+  HLL_INSTRUMENT(sparse && dense_others.empty()
+                     ? instrumentation::event::merge_sparse_sparse
+                 : !sparse && lists.empty()
+                     ? instrumentation::event::merge_dense_dense
+                     : instrumentation::event::merge_sparse_dense,
+                 others.size());
+
+  if (sparse && dense_others.empty()) {
+    merge_temp();
+    lists.emplace_back(sparse_list.data(),
+                       sparse_list.data() + sparse_list.size());
+    entry_vector merged(sparse_list.get_allocator());
+    if (merge_sorted_lists(lists, merged, sparse_list_max - 1)) {
+      sparse_list.swap(merged);
+      sparse_count.set(sparse_list.size());
+      return;
+    }
+    // too many entries for the sparse representation
+    lists.pop_back();
+  }
+
+  if (sparse)
+    convert_to_dense();
 
-  if (it1 == sorted_list.end() && it2 != sparse_list.end())
-    new_sparse_list.insert(new_sparse_list.end(), it2, sparse_list.end());
-  else if (it2 == sparse_list.end() && it1 != sorted_list.end())
-    new_sparse_list.insert(new_sparse_list.end(), it1, sorted_list.end());
+  // Sparse entries are sorted by their index, so the entries belonging to a
+  // slice of dense registers are contiguous.
+  constexpr std::size_t m = 1ul << p;
+  constexpr int index_shift = rank_bits + sp - p;
+  auto merge_slice = [&](std::size_t begin, std::size_t end) {
+    if (!dense_others.empty())
+      dense.merge(dense_others.data(), dense_others.size(), begin, end);
+    for (const auto &list : lists) {
+      const sparse_entry *it = std::lower_bound(
+          list.first, list.second, std::uint64_t{begin} << index_shift);
+      const sparse_entry *stop =
+          end == m ? list.second
+                   : std::lower_bound(it, list.second,
+                                      std::uint64_t{end} << index_shift);
+      for (; it != stop; ++it) {
+        std::uint64_t index;
+        std::uint8_t rank;
+        std::tie(index, rank) = decode_hash(*it);
+        std::tie(index, rank) = detail::sparse_to_dense(index, rank, p, sp);
+        dense.update(index, rank);
+      }
+    }
+  };
 
-  return new_sparse_list;
+  if (pool != nullptr && pool->size() > 1) {
+    constexpr std::size_t slice = m < 4096 ? m : 4096;
+    pool->parallel_for(m / slice, [&merge_slice](std::size_t s) {
+      merge_slice(s * slice, (s + 1) * slice);
+    });
+  } else {
+    merge_slice(0, m);
+  }
+  sums = dense.sums();
 }
 
-template <typename T, std::uint8_t precision, std::uint8_t sparse_precision>
-std::vector<std::uint64_t>
-hll::hyperloglog<T, precision, sparse_precision>::merged_temp_list() const {
-  std::vector<std::uint64_t> temporary_list_copy = temporary_list;
-  std::sort(temporary_list_copy.begin(), temporary_list_copy.end());
+// Merges sorted lists of sparse entries into `out`, keeping the highest rank
+// of every index. Returns false if the result would be longer than
+// `max_entries`, leaving `out` partially filled.
+template <typename T, std::uint8_t p, std::uint8_t sp, typename R, typename A,
+          typename H>
+bool hll::hyperloglog<T, p, sp, R, A, H>::merge_sorted_lists(
+    const std::vector<sorted_range> &lists, entry_vector &out,
+    std::size_t max_entries) {
+  using head = std::pair<sparse_entry, std::size_t>;
+  std::priority_queue<head, std::vector<head>, std::greater<head>> heap;
+  std::vector<const sparse_entry *> cursors;
+  for (std::size_t i = 0; i < lists.size(); i++) {
+    cursors.push_back(lists[i].first);
+    if (lists[i].first != lists[i].second)
+      heap.emplace(*lists[i].first, i);
+  }
 
-  std::reverse(temporary_list_copy.begin(), temporary_list_copy.end());
+  while (!heap.empty()) {
+    sparse_entry entry = heap.top().first;
+    std::size_t i = heap.top().second;
+    heap.pop();
 
-  auto last =
-      std::unique(temporary_list_copy.begin(), temporary_list_copy.end(),
-                  [this](std::uint64_t a, std::uint64_t b) -> bool {
-                    std::uint64_t index1, index2;
-                    std::tie(index1, std::ignore) = decode_hash(a);
-                    std::tie(index2, std::ignore) = decode_hash(b);
-                    return index1 == index2;
-                  });
+    // entries of the same index come out in increasing order of rank
+    if (!out.empty() && (out.back() >> rank_bits) == (entry >> rank_bits)) {
+      out.back() = entry;
+    } else {
+      if (out.size() == max_entries)
+        return false;
+      out.push_back(entry);
+    }
 
-  temporary_list_copy.erase(last, temporary_list_copy.end());
-  std::reverse(temporary_list_copy.begin(), temporary_list_copy.end());
+    if (++cursors[i] != lists[i].second)
+      heap.emplace(*cursors[i], i);
+  }
+  return true;
+}
+
+template <typename InputIt>
+hll::detail::counter_of<InputIt> hll::merge_all(InputIt first, InputIt last) {
+  if (first == last)
+    throw std::invalid_argument("cannot merge an empty range of counters");
+  detail::counter_of<InputIt> result = *detail::counter_address(*first);
+  result.merge(++first, last);
+  return result;
+}
 
-  return merged_sorted_list(temporary_list_copy);
+template <typename InputIt>
+hll::detail::counter_of<InputIt>
+hll::merge_all(InputIt first, InputIt last, hll::thread_pool &pool) {
+  if (first == last)
+    throw std::invalid_argument("cannot merge an empty range of counters");
+  detail::counter_of<InputIt> result = *detail::counter_address(*first);
+  result.merge(++first, last, pool);
+  return result;
 }
 
-template <typename T, std::uint8_t precision, std::uint8_t sparse_precision>
+template <typename H, typename... Rest>
+H hll::union_of(const H &first, const Rest &...rest) {
+  std::array<const H *, sizeof...(Rest)> others{{&rest...}};
+  H result = first;
+  result.merge(others.begin(), others.end());
+  return result;
+}
+
+template <typename T, std::uint8_t p, std::uint8_t sp, typename R, typename A,
+          typename H>
 std::vector<std::uint8_t>
-hll::hyperloglog<T, precision, sparse_precision>::converted_to_dense() const {
-  std::vector<std::uint8_t> new_dense(1ul << precision, std::uint8_t{});
+hll::hyperloglog<T, p, sp, R, A, H>::serialize() const {
+  entry_vector slist(sparse_list.get_allocator());
+  if (sparse)
+    slist = merged_temp_list();
+  return detail::serialize_sketch(p, sp, H::id, seed, sparse, slist, dense);
+}
 
-  std::vector<std::uint64_t> slist = merged_temp_list();
-  for (const auto i : slist) {
+template <typename T, std::uint8_t p, std::uint8_t sp, typename R, typename A,
+          typename H>
+hll::hyperloglog<T, p, sp, R, A, H>
+hll::hyperloglog<T, p, sp, R, A, H>::deserialize(const void *data,
+                                                 std::size_t size,
+                                                 const A &alloc) {
+  hll::sketch_view view(data, size);
+  hll::hyperloglog<T, p, sp, R, A, H> h(!view.is_sparse(), view.seed(), alloc);
+  h.merge(view);
+  return h;
+}
+
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
+void hll::hyperloglog<T, precision, sparse_precision, R, A, H>::insert(
+    const T &item) {
+  insert_hash(H{}(item, seed));
+}
+
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
+template <typename U, typename>
+void hll::hyperloglog<T, precision, sparse_precision, R, A, H>::insert(
+    const char *data, std::size_t size) {
+  insert_hash(H{}(data, size, seed));
+}
+
+#if __cplusplus >= 201703L
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
+template <typename S, typename>
+void hll::hyperloglog<T, precision, sparse_precision, R, A, H>::insert(S item) {
+  insert_hash(H{}(item.data(), item.size(), seed));
+}
+#endif
+
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
+template <typename InputIt>
+void hll::hyperloglog<T, precision, sparse_precision, R, A, H>::insert(
+    InputIt first, InputIt last) {
+  detail::hash_range<T, H, batch_size>(
+      first, last, seed,
+      [this](const std::uint64_t *hashes, std::size_t count) {
+        insert_hashes(hashes, count);
+      },
+      std::is_arithmetic<T>{});
+}
+
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
+void hll::hyperloglog<T, precision, sparse_precision, R, A, H>::insert_hash(
+    std::uint64_t hash) {
+  HLL_INSTRUMENT(instrumentation::event::insert, 1);
+  if (sparse) {
+    insert_sparse_block(&hash, 1);
+  } else {
     std::uint64_t index;
     std::uint8_t rank;
-    std::tie(index, rank) = decode_hash(i);
-
-    std::uint64_t dense_index = (index >> (sparse_precision - precision));
-    std::uint64_t betweens =
-        (index & ((1u << (sparse_precision - precision)) - 1));
-    std::uint8_t dense_rank;
+    std::tie(index, rank) = detail::hash_rank(hash, precision);
+    update_register(index, rank);
+  }
+}
 
-    if (betweens == 0)
-      dense_rank =
-          static_cast<std::uint8_t>(rank + (sparse_precision - precision));
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
+void hll::hyperloglog<T, precision, sparse_precision, R, A, H>::insert_hashes(
+    const std::uint64_t *hashes, std::size_t count) {
+  HLL_INSTRUMENT(instrumentation::event::insert, count);
+  while (count > 0) {
+    std::size_t block = count < batch_size ? count : batch_size;
+    if (sparse)
+      insert_sparse_block(hashes, block);
     else
-      dense_rank = static_cast<std::uint8_t>(
-          (static_cast<std::uint8_t>(hll_countl_zero(betweens)) -
-           (sizeof(betweens) * 8 - (sparse_precision - precision))) +
-          1);
-    if (dense_rank > new_dense[dense_index])
-      new_dense[dense_index] = dense_rank;
+      insert_dense_block(hashes, block);
+    hashes += block;
+    count -= block;
+  }
+}
+
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
+void hll::hyperloglog<T, precision, sparse_precision, R, A,
+                      H>::insert_sparse_block(const std::uint64_t *hashes,
+                                                 std::size_t count) {
+  sparse_count.reset();
+  if (detail::insert_sparse_hashes(sparse_list, temporary_list, hashes, count,
+                                   sparse_precision, sparse_list_max,
+                                   temporary_list_max))
+    convert_to_dense();
+}
+
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
+void hll::hyperloglog<T, precision, sparse_precision, R, A,
+                      H>::insert_dense_block(const std::uint64_t *hashes,
+                                             std::size_t count) {
+  detail::insert_dense_hashes(
+      dense, hashes, count, precision,
+      [this](std::uint64_t index, std::uint8_t rank) {
+        update_register(index, rank);
+      });
+}
+
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
+void hll::hyperloglog<T, precision, sparse_precision, R, A, H>::update_register(
+    std::uint64_t index, std::uint8_t rank) {
+  std::uint8_t previous = dense.update(index, rank);
+  if (rank > previous) {
+    sums.remove(previous);
+    sums.add(rank);
   }
+}
+
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
+void hll::hyperloglog<T, precision, sparse_precision, R, A, H>::merge_temp() {
+  detail::merge_temporary_list(sparse_list, temporary_list);
+}
+
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
+auto hll::hyperloglog<T, precision, sparse_precision, R, A,
+                      H>::merged_temp_list() const -> entry_vector {
+  return detail::merged_entries(sparse_list, temporary_list);
+}
+
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
+auto hll::hyperloglog<T, precision, sparse_precision, R, A,
+                      H>::converted_to_dense() const -> registers_type {
+  registers_type new_dense(1ul << precision, get_allocator());
+  detail::add_sparse_entries(sparse_list, temporary_list, precision,
+                             sparse_precision, new_dense);
   return new_dense;
 }
 
-template <typename T, std::uint8_t precision, std::uint8_t sparse_precision>
-void hll::hyperloglog<T, precision, sparse_precision>::convert_to_dense() {
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
+void hll::hyperloglog<T, precision, sparse_precision, R, A,
+                      H>::convert_to_dense() {
+  // counters created dense are not converted
+  HLL_INSTRUMENT(instrumentation::event::convert_to_dense, sparse ? 1 : 0);
   dense = converted_to_dense();
-
-  temporary_list.clear();
-  temporary_list.shrink_to_fit();
+  sums = dense.sums();
 
   sparse = false;
-  sparse_list.clear();
-  sparse_list.shrink_to_fit();
+  detail::release(sparse_list);
+  detail::release(temporary_list);
+  detail::release(scratch);
 }
 
-template <typename T, std::uint8_t precision, std::uint8_t sparse_precision>
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
 std::pair<double, std::size_t>
-hll::hyperloglog<T, precision, sparse_precision>::raw_estimate() const {
+hll::hyperloglog<T, precision, sparse_precision, R, A,
+                 H>::raw_estimate() const {
   if (sparse) {
     throw std::logic_error(
         "`raw_estimate()` does not work with sparse representation.");
   } else {
-    double sum = 0;
-    std::size_t non_zeros = 0;
-    for (auto &&m_j : dense) {
-      if (m_j > 0)
-        non_zeros += 1;
-      sum += 1.0 / static_cast<double>(1ul << m_j);
-    }
-
-    return std::make_pair(alpha() * std::pow((1ul << precision), 2) / sum,
-                          non_zeros);
+    return std::make_pair(
+        detail::raw_estimate(precision, sums.harmonic_sum()), sums.non_zeros);
   }
 }
 
-template <typename T, std::uint8_t precision, std::uint8_t sparse_precision>
-double hll::hyperloglog<T, precision, sparse_precision>::estimate() const {
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
+double
+hll::hyperloglog<T, precision, sparse_precision, R, A, H>::estimate() const {
+  return estimate(hll::estimation_method::bias_corrected);
+}
+
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
+double hll::hyperloglog<T, precision, sparse_precision, R, A, H>::estimate(
+    hll::estimation_method method) const {
   if (sparse) {
-    size_t nonzero = merged_temp_list().size();
-    return linear_estimate(nonzero);
+    std::size_t count = sparse_count.get([this]() {
+      return detail::distinct_entries(sparse_list, temporary_list);
+    });
+    return detail::linear_estimate(sparse_precision, count);
+  } else if (method == hll::estimation_method::improved) {
+    return detail::improved_estimate(precision,
+                                     detail::register_histogram(dense));
   } else {
     double e;
     std::size_t non_zeros;
     std::tie(e, non_zeros) = raw_estimate();
-
-    if (e <= 5 * (1ul << precision))
-      e = e - estimate_bias(e);
-
-    double h;
-    if (non_zeros < (1ul << precision))
-      h = linear_estimate(non_zeros);
-    else
-      h = e;
-
-    if (h <= threshold())
-      return h;
-    else
-      return e;
+    return detail::dense_estimate(precision, e, non_zeros);
   }
 }
 
-template <typename T, std::uint8_t precision, std::uint8_t sparse_precision>
-double hll::hyperloglog<T, precision, sparse_precision>::measure_error(
+template <typename T, std::uint8_t precision, std::uint8_t sparse_precision,
+          typename R, typename A, typename H>
+double hll::hyperloglog<T, precision, sparse_precision, R, A, H>::measure_error(
     std::size_t orig_card) const {
   double e;
   std::tie(e, std::ignore) = raw_estimate();
@@ -0,0 +1,63 @@
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../include/hll/hyperloglog.hpp"
+#include "benchmark.hpp"
+
+template <std::uint8_t precision>
+void benchmark_inserts(std::size_t count, std::size_t repeats) {
+  using hll_t = hll::hyperloglog<std::uint64_t, precision, 25>;
+
+  std::vector<std::uint64_t> items(count);
+  for (std::size_t i = 0; i < count; i++)
+    items[i] = i;
+
+  std::vector<std::uint64_t> hashes(count);
+  for (std::size_t i = 0; i < count; i++)
+    hashes[i] = hll::hash<std::uint64_t>{}(items[i], 0x9E3779B97F4A7C15);
+
+  for (bool dense : {false, true}) {
+    double single = bench::best_of(repeats, [&]() {
+      hll_t h(dense);
+      for (auto i: items)
+        h.insert(i);
+      bench::keep(h.estimate());
+    });
+
+    double range = bench::best_of(repeats, [&]() {
+      hll_t h(dense);
+      h.insert(items.begin(), items.end());
+      bench::keep(h.estimate());
+    });
+
+    double hashed = bench::best_of(repeats, [&]() {
+      hll_t h(dense);
+      h.insert_hashes(hashes.data(), hashes.size());
+      bench::keep(h.estimate());
+    });
+
+    double n = static_cast<double>(count);
+    std::cout << "p=" << +precision
+      << (dense ? " dense " : " sparse") << std::fixed << std::setprecision(2)
+      << "  single: " << single/n*1e9 << " ns/item"
+      << "  range: " << range/n*1e9 << " ns/item (x" << single/range << ")"
+      << "  pre-hashed: " << hashed/n*1e9 << " ns/item (x" << single/hashed
+      << ")\n";
+  }
+}
+
+int main(int argc, char* argv[]) {
+  std::size_t count = 1ul << 24;
+  std::size_t repeats = 5;
+  if (argc > 1)
+    count = std::stoul(argv[1]);
+  if (argc > 2)
+    repeats = std::stoul(argv[2]);
+
+  benchmark_inserts<14>(count, repeats);
+  benchmark_inserts<18>(count, repeats);
+  return 0;
+}
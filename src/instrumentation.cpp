@@ -0,0 +1,118 @@
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "../include/hll/instrumentation.hpp"
+
+namespace hll {
+  namespace instrumentation {
+    namespace {
+      using raw_totals = std::array<totals, event_count>;
+
+      // Totals of one thread. Only the thread writes them, with relaxed
+      // atomics so that `snapshot()` can read them at the same time.
+      struct thread_totals {
+        std::array<std::atomic<std::uint64_t>, event_count> counts{};
+        std::array<std::atomic<std::uint64_t>, event_count> nanoseconds{};
+      };
+
+      struct registry {
+        std::mutex lock;
+        std::vector<const thread_totals*> threads;
+        // totals of the threads that have exited
+        raw_totals exited{};
+        // totals at the last `reset()`
+        raw_totals baseline{};
+
+        raw_totals sum() const {
+          raw_totals result = exited;
+          for (const auto t: threads)
+            for (std::size_t e = 0; e < event_count; e++) {
+              result[e].count +=
+                t->counts[e].load(std::memory_order_relaxed);
+              result[e].nanoseconds +=
+                t->nanoseconds[e].load(std::memory_order_relaxed);
+            }
+          return result;
+        }
+      };
+
+      registry& global() {
+        static registry r;
+        return r;
+      }
+
+      // registers the totals of a thread for as long as it runs
+      struct registration {
+        thread_totals totals;
+
+        registration() {
+          registry& r = global();
+          std::lock_guard<std::mutex> guard(r.lock);
+          r.threads.push_back(&totals);
+        }
+
+        ~registration() {
+          registry& r = global();
+          std::lock_guard<std::mutex> guard(r.lock);
+          for (std::size_t e = 0; e < event_count; e++) {
+            r.exited[e].count += totals.counts[e].load();
+            r.exited[e].nanoseconds += totals.nanoseconds[e].load();
+          }
+          for (auto it = r.threads.begin(); it != r.threads.end(); ++it)
+            if (*it == &totals) {
+              r.threads.erase(it);
+              break;
+            }
+        }
+      };
+
+      void add(std::atomic<std::uint64_t>& total, std::uint64_t value) {
+        total.store(total.load(std::memory_order_relaxed) + value,
+            std::memory_order_relaxed);
+      }
+    }  // namespace
+
+    const char* name(event e) {
+      switch (e) {
+        case event::insert:
+          return "insert";
+        case event::merge_temp:
+          return "merge_temp";
+        case event::convert_to_dense:
+          return "convert_to_dense";
+        case event::merge_sparse_sparse:
+          return "merge_sparse_sparse";
+        case event::merge_sparse_dense:
+          return "merge_sparse_dense";
+        case event::merge_dense_dense:
+          return "merge_dense_dense";
+      }
+      return "unknown";
+    }
+
+    std::array<totals, event_count> snapshot() {
+      registry& r = global();
+      std::lock_guard<std::mutex> guard(r.lock);
+      raw_totals result = r.sum();
+      for (std::size_t e = 0; e < event_count; e++) {
+        result[e].count -= r.baseline[e].count;
+        result[e].nanoseconds -= r.baseline[e].nanoseconds;
+      }
+      return result;
+    }
+
+    void reset() {
+      registry& r = global();
+      std::lock_guard<std::mutex> guard(r.lock);
+      r.baseline = r.sum();
+    }
+
+    void record(event e, std::uint64_t count, std::uint64_t nanoseconds) {
+      thread_local registration local;
+      auto i = static_cast<std::size_t>(e);
+      add(local.totals.counts[i], count);
+      add(local.totals.nanoseconds[i], nanoseconds);
+    }
+  }  // namespace instrumentation
+}  // namespace hll
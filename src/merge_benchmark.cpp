@@ -0,0 +1,66 @@
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../include/hll/hyperloglog.hpp"
+#include "../include/hll/thread_pool.hpp"
+#include "benchmark.hpp"
+
+// Unions `count` counters, each holding `items` items, with one `merge()`
+// per counter, with `hll::merge_all()` and with `hll::merge_all()` on a
+// thread pool.
+template <std::uint8_t precision>
+void benchmark_merges(std::size_t count, std::size_t items,
+    std::size_t repeats, hll::thread_pool& pool) {
+  using hll_t = hll::hyperloglog<std::uint64_t, precision, 25>;
+
+  std::vector<hll_t> counters(count);
+  for (std::size_t c = 0; c < count; c++)
+    for (std::size_t i = 0; i < items; i++)
+      counters[c].insert(c*items + i);
+
+  double sequential = bench::best_of(repeats, [&]() {
+    hll_t result;
+    for (const auto& h: counters)
+      result.merge(h);
+    bench::keep(result.estimate());
+  });
+
+  double all = bench::best_of(repeats, [&]() {
+    bench::keep(hll::merge_all(counters.begin(), counters.end()).estimate());
+  });
+
+  double parallel = bench::best_of(repeats, [&]() {
+    bench::keep(
+        hll::merge_all(counters.begin(), counters.end(), pool).estimate());
+  });
+
+  std::cout << "p=" << +precision << " " << count << " counters of "
+    << items << " items (" << (counters[0].is_sparse() ? "sparse" : "dense")
+    << ")" << std::fixed << std::setprecision(2)
+    << "  merge: " << sequential*1e3 << " ms"
+    << "  merge_all: " << all*1e3 << " ms (x" << sequential/all << ")"
+    << "  merge_all on " << pool.size() << " threads: " << parallel*1e3
+    << " ms (x" << sequential/parallel << ")\n";
+}
+
+int main(int argc, char* argv[]) {
+  std::size_t count = 10000;
+  std::size_t repeats = 3;
+  std::size_t threads = 0;
+  if (argc > 1)
+    count = std::stoul(argv[1]);
+  if (argc > 2)
+    repeats = std::stoul(argv[2]);
+  if (argc > 3)
+    threads = std::stoul(argv[3]);
+
+  hll::thread_pool pool(threads);
+  benchmark_merges<14>(count, 10, repeats, pool);
+  benchmark_merges<14>(count/10, 10000, repeats, pool);
+  benchmark_merges<18>(count, 10, repeats, pool);
+  benchmark_merges<18>(count/10, 100000, repeats, pool);
+  return 0;
+}
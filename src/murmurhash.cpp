@@ -1,4 +1,6 @@
 #include "../include/hll/murmurhash.hpp"
+
+#include <cstring>
 #if defined(_MSC_VER)
 #define HLL_FORCE_INLINE __forceinline
 
@@ -32,26 +34,12 @@ namespace hll {
 
       return k;
     }
-  }  // namespace detail
-
-  // Based on the reference MurmurHash3 implementation by Austin Appleby.
-  std::uint64_t murmurhash3_x64_128(
-      const void* key, const int len, const std::uint64_t seed) {
-    const std::uint8_t* data = (const std::uint8_t*)key;
-    const int nblocks = len/16;
-
-    std::uint64_t h1 = seed;
-    std::uint64_t h2 = seed;
-
-    const std::uint64_t c1 = 0x87c37b91114253d5ULL;
-    const std::uint64_t c2 = 0x4cf5ad432745937fULL;
-
-
-    const std::uint64_t* blocks = (const std::uint64_t*)(data);
 
-    for (int i = 0; i < nblocks; i++) {
-      std::uint64_t k1 = detail::getblock64(blocks, i*2+0);
-      std::uint64_t k2 = detail::getblock64(blocks, i*2+1);
+    HLL_FORCE_INLINE void mix_block(
+        std::uint64_t& h1, std::uint64_t& h2,
+        std::uint64_t k1, std::uint64_t k2) {
+      const std::uint64_t c1 = 0x87c37b91114253d5ULL;
+      const std::uint64_t c2 = 0x4cf5ad432745937fULL;
 
       k1 *= c1;
       k1 = HLL_ROTL64(k1, 31);
@@ -72,42 +60,88 @@ namespace hll {
       h2 = h2*5+0x38495ab5;
     }
 
-    const std::uint8_t* tail = (const std::uint8_t*)(data + nblocks*16);
-
-    std::uint64_t k1 = 0;
-    std::uint64_t k2 = 0;
-
-    switch (len & 15) {
-    case 15: k2 ^= ((std::uint64_t)tail[14]) << 48;
-    case 14: k2 ^= ((std::uint64_t)tail[13]) << 40;
-    case 13: k2 ^= ((std::uint64_t)tail[12]) << 32;
-    case 12: k2 ^= ((std::uint64_t)tail[11]) << 24;
-    case 11: k2 ^= ((std::uint64_t)tail[10]) << 16;
-    case 10: k2 ^= ((std::uint64_t)tail[ 9]) << 8;
-    case  9: k2 ^= ((std::uint64_t)tail[ 8]) << 0;
-            k2 *= c2; k2  = HLL_ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
-
-    case  8: k1 ^= ((std::uint64_t)tail[ 7]) << 56;
-    case  7: k1 ^= ((std::uint64_t)tail[ 6]) << 48;
-    case  6: k1 ^= ((std::uint64_t)tail[ 5]) << 40;
-    case  5: k1 ^= ((std::uint64_t)tail[ 4]) << 32;
-    case  4: k1 ^= ((std::uint64_t)tail[ 3]) << 24;
-    case  3: k1 ^= ((std::uint64_t)tail[ 2]) << 16;
-    case  2: k1 ^= ((std::uint64_t)tail[ 1]) << 8;
-    case  1: k1 ^= ((std::uint64_t)tail[ 0]) << 0;
-            k1 *= c1; k1  = HLL_ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
-    }
+    // Hashes `nblocks` 16-byte blocks of `data` followed by `tail_len` bytes
+    // of `tail`, `len` bytes in total. A 16-byte tail is hashed as a block.
+    HLL_FORCE_INLINE std::uint64_t murmurhash3_x64_128(
+        const std::uint8_t* data, std::size_t nblocks,
+        const std::uint8_t* tail, std::size_t tail_len,
+        std::uint64_t len, std::uint64_t seed) {
+      std::uint64_t h1 = seed;
+      std::uint64_t h2 = seed;
+
+      const std::uint64_t c1 = 0x87c37b91114253d5ULL;
+      const std::uint64_t c2 = 0x4cf5ad432745937fULL;
+
+      const std::uint64_t* blocks = (const std::uint64_t*)(data);
+
+      for (std::size_t i = 0; i < nblocks; i++)
+        mix_block(h1, h2,
+            getblock64(blocks, static_cast<int>(i*2+0)),
+            getblock64(blocks, static_cast<int>(i*2+1)));
+
+      if (tail_len == 16) {
+        const std::uint64_t* last = (const std::uint64_t*)(tail);
+        mix_block(h1, h2, getblock64(last, 0), getblock64(last, 1));
+        tail_len = 0;
+      }
+
+      std::uint64_t k1 = 0;
+      std::uint64_t k2 = 0;
+
+      switch (tail_len & 15) {
+      case 15: k2 ^= ((std::uint64_t)tail[14]) << 48;
+      case 14: k2 ^= ((std::uint64_t)tail[13]) << 40;
+      case 13: k2 ^= ((std::uint64_t)tail[12]) << 32;
+      case 12: k2 ^= ((std::uint64_t)tail[11]) << 24;
+      case 11: k2 ^= ((std::uint64_t)tail[10]) << 16;
+      case 10: k2 ^= ((std::uint64_t)tail[ 9]) << 8;
+      case  9: k2 ^= ((std::uint64_t)tail[ 8]) << 0;
+              k2 *= c2; k2  = HLL_ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+
+      case  8: k1 ^= ((std::uint64_t)tail[ 7]) << 56;
+      case  7: k1 ^= ((std::uint64_t)tail[ 6]) << 48;
+      case  6: k1 ^= ((std::uint64_t)tail[ 5]) << 40;
+      case  5: k1 ^= ((std::uint64_t)tail[ 4]) << 32;
+      case  4: k1 ^= ((std::uint64_t)tail[ 3]) << 24;
+      case  3: k1 ^= ((std::uint64_t)tail[ 2]) << 16;
+      case  2: k1 ^= ((std::uint64_t)tail[ 1]) << 8;
+      case  1: k1 ^= ((std::uint64_t)tail[ 0]) << 0;
+              k1 *= c1; k1  = HLL_ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+      }
+
+      h1 ^= len;
+      h2 ^= len;
 
+      h1 += h2;
+      h2 += h1;
 
-    h1 ^= (std::uint64_t)len;
-    h2 ^= (std::uint64_t)len;
+      h1 = fmix64(h1);
+      h2 = fmix64(h2);
 
-    h1 += h2;
-    h2 += h1;
+      return h1 + h2;
+    }
+  }  // namespace detail
 
-    h1 = detail::fmix64(h1);
-    h2 = detail::fmix64(h2);
+  // Based on the reference MurmurHash3 implementation by Austin Appleby.
+  std::uint64_t murmurhash3_x64_128(
+      const void* key, const int len, const std::uint64_t seed) {
+    const std::uint8_t* data = (const std::uint8_t*)key;
+    const std::size_t nblocks = static_cast<std::size_t>(len/16);
+    return detail::murmurhash3_x64_128(
+        data, nblocks, data + nblocks*16, static_cast<std::size_t>(len & 15),
+        static_cast<std::uint64_t>(len), seed);
+  }
 
-    return h1 + h2;
+  std::uint64_t murmurhash3_x64_128_terminated(
+      const void* key, std::size_t len, std::uint64_t seed) {
+    const std::uint8_t* data = (const std::uint8_t*)key;
+    const std::size_t nblocks = len/16;
+
+    // the last bytes and the terminator, zero padded to a whole block
+    std::uint64_t tail[2] = {0, 0};
+    std::memcpy(tail, data + nblocks*16, len - nblocks*16);
+    return detail::murmurhash3_x64_128(
+        data, nblocks, (const std::uint8_t*)tail, len - nblocks*16 + 1,
+        len + 1, seed);
   }
 }  // namespace hll
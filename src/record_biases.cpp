@@ -1,70 +1,203 @@
+// Records the bias of the raw estimate of dense counters, the tables in
+// `src/biases/`, by averaging the error of many trials.
+//
+// usage: record_biases [trials [points [threads [out_dir [precision...]]]]]
+//
+// Trials are split into blocks that run in parallel on a thread pool. The
+// error sums of every finished block are saved in `out_dir`, so that a run
+// that was stopped can be continued by running the same command again. The
+// saved blocks of a precision are removed once its table is written.
+
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
 #include <iostream>
 #include <fstream>
 #include <numeric>
 #include <limits>
 #include <iomanip>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include "../include/hll/hyperloglog.hpp"
+#include "../include/hll/thread_pool.hpp"
+#include "simulation.hpp"
 
-template <uint8_t precision>
-void record_bias(std::size_t trials, std::size_t points,
-    std::string out_dir) {
-  std::ofstream out;
-  out.open(out_dir + std::to_string(precision),
-      std::ios::trunc | std::ios::out);
+struct bias_table {
+  std::uint8_t precision;
+  std::vector<std::size_t> cardinalities;
+  // error sums of each block, added up in order once all are done so that
+  // the table does not depend on the order in which blocks finish
+  std::vector<std::vector<long double>> block_sums;
+  std::size_t remaining_blocks;
+};
 
+// sums of the errors of the raw estimate of trials [first, last) at each of
+// the cardinalities
+template <std::uint8_t precision>
+std::vector<long double> block_errors(
+    const std::vector<std::size_t>& cardinalities,
+    std::size_t first, std::size_t last) {
   using hll_t = hll::hyperloglog<
-    std::string, precision, static_cast<uint8_t>(precision+1)>;
+    std::uint64_t, precision, static_cast<uint8_t>(precision+1)>;
+
+  std::vector<long double> sums(cardinalities.size());
+  std::vector<std::uint64_t> buffer;
+  for (std::size_t trial = first; trial < last; trial++) {
+    hll_t h(true);
+    std::uint64_t seed = sim::trial_seed(precision, trial);
+    std::size_t inserted = 0;
+    for (std::size_t k = 0; k < cardinalities.size(); k++) {
+      sim::insert_items(h, seed, inserted, cardinalities[k], buffer);
+      inserted = cardinalities[k];
+      sums[k] += h.measure_error(inserted);
+    }
+  }
+  return sums;
+}
 
-  std::vector<hll_t> hlls(trials, hll_t(true));
+std::string checkpoint_path(const std::string& out_dir,
+    std::uint8_t precision, std::size_t first) {
+  return out_dir + std::to_string(precision) + ".block-"
+    + std::to_string(first);
+}
+
+// reads the sums of a block saved by an earlier run, if there is one that
+// matches
+bool load_checkpoint(const std::string& path, std::uint8_t precision,
+    std::size_t first, std::size_t last, std::size_t points,
+    std::vector<long double>& sums) {
+  std::ifstream in(path);
+  unsigned p;
+  std::size_t saved_first, saved_last, saved_points;
+  if (!(in >> p >> saved_first >> saved_last >> saved_points)
+      || p != precision || saved_first != first || saved_last != last
+      || saved_points != points)
+    return false;
+
+  sums.assign(points, 0);
+  for (auto& s: sums)
+    if (!(in >> s))
+      return false;
+  return true;
+}
+
+// writes to a temporary file first, so that a run stopped while saving does
+// not leave a truncated block behind
+void save_checkpoint(const std::string& path, std::uint8_t precision,
+    std::size_t first, std::size_t last,
+    const std::vector<long double>& sums) {
+  std::string temp = path + ".tmp";
+  {
+    std::ofstream out(temp, std::ios::trunc | std::ios::out);
+    out << std::setprecision(std::numeric_limits<long double>::max_digits10);
+    out << +precision << " " << first << " " << last << " " << sums.size()
+      << "\n";
+    for (const auto s: sums)
+      out << s << "\n";
+    if (!out)
+      throw std::runtime_error("could not write " + temp);
+  }
+  std::remove(path.c_str());
+  if (std::rename(temp.c_str(), path.c_str()) != 0)
+    throw std::runtime_error("could not rename " + temp);
+}
 
-  std::size_t max = (1u << precision)*6;
-  std::size_t inc = std::max(1ul, max/points);
+void write_table(const bias_table& table, std::size_t trials,
+    const std::string& out_dir) {
+  std::ofstream out;
+  out.open(out_dir + std::to_string(table.precision),
+      std::ios::trunc | std::ios::out);
 
   out << "{";
   out << std::setprecision(std::numeric_limits<double>::digits10 + 1);
-  for (std::size_t i = 1; i <= max; i++) {
-    for (std::size_t j = 0; j < trials; j++)
-      hlls[j].insert(std::to_string(i) + "-" + std::to_string(j));
-
-    if (i%inc == 0) {
-      std::cerr << i/inc << std::endl;
-      long double err = 0;
-      for (const auto& h: hlls)
-        err += h.measure_error(i);
-      long double avg_error = err/trials;
-
-      out << "{" << i + avg_error
-        << ", " << avg_error << "}, ";
-    }
+  for (std::size_t k = 0; k < table.cardinalities.size(); k++) {
+    long double err = 0;
+    for (const auto& sums: table.block_sums)
+      err += sums[k];
+    long double avg_error = err/trials;
+    out << "{" << table.cardinalities[k] + avg_error
+      << ", " << avg_error << "}, ";
   }
   out << "}";
 
   out.close();
+  if (!out)
+    throw std::runtime_error("could not write the table of precision "
+        + std::to_string(table.precision));
 }
 
-
-int main() {
+int main(int argc, char* argv[]) {
   std::size_t sample_size = 100'000;
   std::size_t points = 500;
+  std::size_t threads = 0;
   std::string out_dir = "./src/biases/";
+  std::vector<std::uint8_t> precisions;
+  constexpr std::size_t block_size = 250;
+
+  if (argc > 1)
+    sample_size = std::stoul(argv[1]);
+  if (argc > 2)
+    points = std::stoul(argv[2]);
+  if (argc > 3)
+    threads = std::stoul(argv[3]);
+  if (argc > 4)
+    out_dir = argv[4];
+  try {
+    for (int i = 5; i < argc; i++)
+      precisions.push_back(sim::parse_precision(argv[i]));
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+  if (precisions.empty())
+    for (std::uint8_t p = 4; p <= 18; p++)
+      precisions.push_back(p);
+
+  // largest precisions first, as their blocks take the longest
+  std::sort(precisions.rbegin(), precisions.rend());
 
-  record_bias<4>(sample_size, points, out_dir);
-  record_bias<5>(sample_size, points, out_dir);
-  record_bias<6>(sample_size, points, out_dir);
-  record_bias<7>(sample_size, points, out_dir);
-  record_bias<8>(sample_size, points, out_dir);
-  record_bias<9>(sample_size, points, out_dir);
-  record_bias<10>(sample_size, points, out_dir);
-  record_bias<11>(sample_size, points, out_dir);
-  record_bias<12>(sample_size, points, out_dir);
-  record_bias<13>(sample_size, points, out_dir);
-  record_bias<14>(sample_size, points, out_dir);
-  record_bias<15>(sample_size, points, out_dir);
-  record_bias<16>(sample_size, points, out_dir);
-  record_bias<17>(sample_size, points, out_dir);
-  record_bias<18>(sample_size, points, out_dir);
+  std::size_t blocks = (sample_size + block_size - 1)/block_size;
+  std::vector<bias_table> tables;
+  for (const auto p: precisions) {
+    std::vector<std::size_t> cardinalities =
+      sim::measure_points((1ul << p)*6, points);
+    tables.push_back({p, std::move(cardinalities),
+        std::vector<std::vector<long double>>(blocks), blocks});
+  }
+
+  hll::thread_pool pool(threads);
+  std::mutex lock;
+  std::size_t finished = 0;
+  pool.parallel_for(tables.size()*blocks, [&](std::size_t task) {
+    bias_table& table = tables[task/blocks];
+    std::size_t first = (task%blocks)*block_size;
+    std::size_t last = std::min(first + block_size, sample_size);
+    std::size_t count = table.cardinalities.size();
+    std::string path = checkpoint_path(out_dir, table.precision, first);
+
+    std::vector<long double> sums;
+    if (!load_checkpoint(path, table.precision, first, last, count, sums)) {
+      sim::with_precision(table.precision, [&](auto p) {
+        sums = block_errors<decltype(p)::value>(
+            table.cardinalities, first, last);
+      });
+      save_checkpoint(path, table.precision, first, last, sums);
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    table.block_sums[task%blocks] = std::move(sums);
+    std::cerr << ++finished << "/" << tables.size()*blocks << std::endl;
+
+    if (--table.remaining_blocks == 0) {
+      write_table(table, sample_size, out_dir);
+      for (std::size_t b = 0; b < blocks; b++)
+        std::remove(
+            checkpoint_path(out_dir, table.precision, b*block_size).c_str());
+    }
+  });
 
   return 0;
 }
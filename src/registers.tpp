@@ -0,0 +1,243 @@
+#include <algorithm>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define hll_prefetch(addr) __builtin_prefetch((addr), 1)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define hll_prefetch(addr)                                                     \
+  _mm_prefetch(reinterpret_cast<const char *>(addr), _MM_HINT_T0)
+#else
+#define hll_prefetch(addr) static_cast<void>(addr)
+#endif
+
+namespace hll {
+namespace detail {
+// Register-wise maximum of ten 6-bit registers held in the lower 60 bits of
+// `a` and `b`. The lane-wise difference is computed with the top bit of every
+// lane masked so that borrows cannot cross lanes, then the borrow out of each
+// lane selects the larger of the two.
+inline std::uint64_t packed_max(std::uint64_t a, std::uint64_t b) {
+  constexpr std::uint64_t high = 0x0820820820820820; // top bit of each lane
+  std::uint64_t diff = ((a | high) - (b & ~high)) ^ ((a ^ ~b) & high);
+  std::uint64_t borrow = ((~a & b) | (~(a ^ b) & diff)) & high;
+  std::uint64_t lows = borrow >> 5;
+  std::uint64_t b_larger = (lows << 6) - lows;
+  return (a & ~b_larger) | (b & b_larger);
+}
+
+// Unpacks a group of three words into its 32 registers.
+inline void unpack_group(const std::uint64_t *words, std::uint8_t *out) {
+  constexpr std::uint64_t mask = 0x3f;
+  for (int j = 0; j < 10; j++)
+    out[j] = static_cast<std::uint8_t>((words[0] >> (6 * j)) & mask);
+  out[10] = static_cast<std::uint8_t>((words[0] >> 60) |
+                                      ((words[1] & 0x3) << 4));
+  for (int j = 0; j < 10; j++)
+    out[11 + j] = static_cast<std::uint8_t>((words[1] >> (2 + 6 * j)) & mask);
+  out[21] = static_cast<std::uint8_t>((words[1] >> 62) |
+                                      ((words[2] & 0xf) << 2));
+  for (int j = 0; j < 10; j++)
+    out[22 + j] = static_cast<std::uint8_t>((words[2] >> (4 + 6 * j)) & mask);
+}
+} // namespace detail
+} // namespace hll
+
+template <typename A>
+hll::basic_byte_registers<A>::basic_byte_registers(std::size_t count,
+                                                   const A &alloc)
+    : registers(count, std::uint8_t{}, alloc) {}
+
+template <typename A>
+std::size_t hll::basic_byte_registers<A>::size() const {
+  return registers.size();
+}
+
+template <typename A>
+std::size_t hll::basic_byte_registers<A>::size_in_bytes() const {
+  return registers.capacity();
+}
+
+template <typename A>
+std::uint8_t hll::basic_byte_registers<A>::get(std::size_t index) const {
+  return registers[index];
+}
+
+template <typename A>
+std::uint8_t hll::basic_byte_registers<A>::update(std::size_t index,
+                                                  std::uint8_t rank) {
+  std::uint8_t previous = registers[index];
+  if (rank > previous)
+    registers[index] = rank;
+  return previous;
+}
+
+template <typename A>
+void hll::basic_byte_registers<A>::prefetch(std::size_t index) const {
+  hll_prefetch(registers.data() + index);
+}
+
+template <typename A>
+void hll::basic_byte_registers<A>::merge(
+    const hll::basic_byte_registers<A> &other) {
+  simd::max_registers(registers.data(), other.registers.data(),
+                      registers.size());
+}
+
+// Blocks of registers stay in L1 while the sources are folded into them a
+// few at a time.
+template <typename A>
+void hll::basic_byte_registers<A>::merge(
+    const hll::basic_byte_registers<A> *const *others, std::size_t count,
+    std::size_t first, std::size_t last) {
+  constexpr std::size_t block = 4096;
+  constexpr std::size_t group = 8;
+  const std::uint8_t *srcs[group];
+  for (std::size_t b = first; b < last; b += block) {
+    std::size_t n = std::min(block, last - b);
+    for (std::size_t s = 0; s < count; s += group) {
+      std::size_t k = std::min(group, count - s);
+      for (std::size_t j = 0; j < k; j++)
+        srcs[j] = others[s + j]->registers.data() + b;
+      simd::max_registers(registers.data() + b, srcs, k, n);
+    }
+  }
+}
+
+template <typename A>
+hll::simd::register_sums hll::basic_byte_registers<A>::sums() const {
+  simd::register_sums sums;
+  simd::accumulate(registers.data(), registers.size(), sums);
+  return sums;
+}
+
+template <typename A>
+const std::vector<std::uint8_t, A> &
+hll::basic_byte_registers<A>::values() const {
+  return registers;
+}
+
+template <typename A>
+hll::basic_packed_registers<A>::basic_packed_registers(std::size_t count,
+                                                       const A &alloc)
+    : count(count),
+      words((count + 31) / 32 * 3, std::uint64_t{}, word_allocator(alloc)) {}
+
+template <typename A>
+std::size_t hll::basic_packed_registers<A>::size() const { return count; }
+
+template <typename A>
+std::size_t hll::basic_packed_registers<A>::size_in_bytes() const {
+  return words.capacity() * sizeof(std::uint64_t);
+}
+
+template <typename A>
+std::uint8_t hll::basic_packed_registers<A>::get(std::size_t index) const {
+  std::size_t bit = index * register_bits;
+  std::size_t word = bit / 64;
+  unsigned shift = static_cast<unsigned>(bit % 64);
+  std::uint64_t value = words[word] >> shift;
+  if (shift > 64 - register_bits)
+    value |= words[word + 1] << (64 - shift);
+  return static_cast<std::uint8_t>(value & register_mask);
+}
+
+template <typename A>
+void hll::basic_packed_registers<A>::set(std::size_t index,
+                                         std::uint8_t rank) {
+  std::size_t bit = index * register_bits;
+  std::size_t word = bit / 64;
+  unsigned shift = static_cast<unsigned>(bit % 64);
+  words[word] = (words[word] & ~(register_mask << shift)) |
+                (static_cast<std::uint64_t>(rank) << shift);
+  if (shift > 64 - register_bits)
+    words[word + 1] = (words[word + 1] & ~(register_mask >> (64 - shift))) |
+                      (static_cast<std::uint64_t>(rank) >> (64 - shift));
+}
+
+template <typename A>
+std::uint8_t hll::basic_packed_registers<A>::update(std::size_t index,
+                                                    std::uint8_t rank) {
+  std::uint8_t previous = get(index);
+  if (rank > previous)
+    set(index, rank);
+  return previous;
+}
+
+template <typename A>
+void hll::basic_packed_registers<A>::prefetch(std::size_t index) const {
+  hll_prefetch(words.data() + index * register_bits / 64);
+}
+
+template <typename A>
+void hll::basic_packed_registers<A>::merge(
+    const hll::basic_packed_registers<A> &other) {
+  merge_words(other.words.data(), 0, words.size());
+}
+
+template <typename A>
+void hll::basic_packed_registers<A>::merge(
+    const hll::basic_packed_registers<A> *const *others, std::size_t count,
+    std::size_t first, std::size_t last) {
+  constexpr std::size_t block = 3 * 128; // words of 4096 registers
+  std::size_t first_word = first / 32 * 3;
+  std::size_t last_word = std::min(words.size(), (last + 31) / 32 * 3);
+  for (std::size_t b = first_word; b < last_word; b += block) {
+    std::size_t e = std::min(b + block, last_word);
+    for (std::size_t s = 0; s < count; s++)
+      merge_words(others[s]->words.data(), b, e);
+  }
+}
+
+// merges words [first, last) of `other`, both multiples of three
+template <typename A>
+void hll::basic_packed_registers<A>::merge_words(const std::uint64_t *other,
+                                                 std::size_t first,
+                                                 std::size_t last) {
+  constexpr std::uint64_t lanes = 0x0fffffffffffffff; // ten whole registers
+  for (std::size_t g = first; g < last; g += 3) {
+    std::uint64_t *a = words.data() + g;
+    const std::uint64_t *b = other + g;
+
+    std::uint64_t r0 = detail::packed_max(a[0] & lanes, b[0] & lanes);
+    std::uint64_t r1 = detail::packed_max((a[1] >> 2) & lanes,
+                                          (b[1] >> 2) & lanes) << 2;
+    std::uint64_t r2 = detail::packed_max(a[2] >> 4, b[2] >> 4) << 4;
+
+    std::uint64_t x = (a[0] >> 60) | ((a[1] & 0x3) << 4);
+    std::uint64_t y = (b[0] >> 60) | ((b[1] & 0x3) << 4);
+    std::uint64_t z = std::max(x, y);
+    r0 |= z << 60;
+    r1 |= z >> 4;
+
+    x = (a[1] >> 62) | ((a[2] & 0xf) << 2);
+    y = (b[1] >> 62) | ((b[2] & 0xf) << 2);
+    z = std::max(x, y);
+    r1 |= z << 62;
+    r2 |= z >> 2;
+
+    a[0] = r0;
+    a[1] = r1;
+    a[2] = r2;
+  }
+}
+
+template <typename A>
+hll::simd::register_sums hll::basic_packed_registers<A>::sums() const {
+  simd::register_sums sums;
+  std::uint8_t group[32];
+  for (std::size_t g = 0; g < words.size(); g += 3) {
+    detail::unpack_group(words.data() + g, group);
+    simd::accumulate(group, std::min<std::size_t>(32, count - g / 3 * 32),
+                     sums);
+  }
+  return sums;
+}
+
+template <typename A>
+std::vector<std::uint8_t> hll::basic_packed_registers<A>::values() const {
+  std::vector<std::uint8_t> out(words.size() / 3 * 32);
+  for (std::size_t g = 0; g < words.size(); g += 3)
+    detail::unpack_group(words.data() + g, out.data() + g / 3 * 32);
+  out.resize(count);
+  return out;
+}
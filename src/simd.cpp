@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "../include/hll/hash.hpp"
+#include "../include/hll/simd.hpp"
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define HLL_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace hll {
+  namespace simd {
+    namespace portable {
+      // contributions of each register value to `register_sums`
+      struct sum_table {
+        std::uint64_t high[64];
+        std::uint64_t low[64];
+
+        constexpr sum_table() : high(), low() {
+          for (int r = 0; r < 64; r++) {
+            high[r] = r <= 32 ? (std::uint64_t{1} << 32) >> r : 0;
+            low[r] = r > 32 ? (std::uint64_t{1} << 63) >> r : 0;
+          }
+        }
+      };
+
+      constexpr sum_table sums_of;
+
+      void max_registers(
+          std::uint8_t* dst, const std::uint8_t* src, std::size_t count) {
+        for (std::size_t i = 0; i < count; i++)
+          dst[i] = std::max(dst[i], src[i]);
+      }
+
+      void max_registers_many(
+          std::uint8_t* dst, const std::uint8_t* const* srcs,
+          std::size_t sources, std::size_t count) {
+        for (std::size_t s = 0; s < sources; s++)
+          max_registers(dst, srcs[s], count);
+      }
+
+      void accumulate(
+          const std::uint8_t* registers, std::size_t count,
+          register_sums& sums) {
+        // local copies, since the registers could alias `sums`
+        std::uint64_t high = sums.high;
+        std::uint64_t low = sums.low;
+        std::size_t non_zeros = sums.non_zeros;
+        for (std::size_t i = 0; i < count; i++) {
+          std::uint8_t r = registers[i] & 63;
+          high += sums_of.high[r];
+          low += sums_of.low[r];
+          non_zeros += r > 0;
+        }
+        sums.high = high;
+        sums.low = low;
+        sums.non_zeros = non_zeros;
+      }
+
+      void integer_hashes(
+          const std::uint64_t* keys, std::size_t count, std::uint64_t seed,
+          std::uint64_t* out) {
+        for (std::size_t i = 0; i < count; i++)
+          out[i] = detail::mix_integer(keys[i] ^ seed);
+      }
+    }  // namespace portable
+
+#if defined(HLL_SIMD_X86)
+    namespace sse2 {
+      __attribute__((target("sse2")))
+      void max_registers(
+          std::uint8_t* dst, const std::uint8_t* src, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+          __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i*>(dst + i));
+          __m128i b = _mm_loadu_si128(
+              reinterpret_cast<const __m128i*>(src + i));
+          _mm_storeu_si128(
+              reinterpret_cast<__m128i*>(dst + i), _mm_max_epu8(a, b));
+        }
+        portable::max_registers(dst + i, src + i, count - i);
+      }
+
+      __attribute__((target("sse2")))
+      void max_registers_many(
+          std::uint8_t* dst, const std::uint8_t* const* srcs,
+          std::size_t sources, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+          __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i*>(dst + i));
+          for (std::size_t s = 0; s < sources; s++)
+            a = _mm_max_epu8(a, _mm_loadu_si128(
+                  reinterpret_cast<const __m128i*>(srcs[s] + i)));
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), a);
+        }
+        for (std::size_t s = 0; s < sources; s++)
+          portable::max_registers(dst + i, srcs[s] + i, count - i);
+      }
+    }  // namespace sse2
+
+    namespace avx2 {
+      __attribute__((target("avx2")))
+      void max_registers(
+          std::uint8_t* dst, const std::uint8_t* src, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 32 <= count; i += 32) {
+          __m256i a = _mm256_loadu_si256(
+              reinterpret_cast<__m256i*>(dst + i));
+          __m256i b = _mm256_loadu_si256(
+              reinterpret_cast<const __m256i*>(src + i));
+          _mm256_storeu_si256(
+              reinterpret_cast<__m256i*>(dst + i), _mm256_max_epu8(a, b));
+        }
+        portable::max_registers(dst + i, src + i, count - i);
+      }
+
+      __attribute__((target("avx2")))
+      void max_registers_many(
+          std::uint8_t* dst, const std::uint8_t* const* srcs,
+          std::size_t sources, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 32 <= count; i += 32) {
+          __m256i a = _mm256_loadu_si256(
+              reinterpret_cast<__m256i*>(dst + i));
+          for (std::size_t s = 0; s < sources; s++)
+            a = _mm256_max_epu8(a, _mm256_loadu_si256(
+                  reinterpret_cast<const __m256i*>(srcs[s] + i)));
+          _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), a);
+        }
+        for (std::size_t s = 0; s < sources; s++)
+          portable::max_registers(dst + i, srcs[s] + i, count - i);
+      }
+
+      // Four registers at a time are widened to 64-bit lanes. Variable shifts
+      // give 0 for shift counts of 64 or more, so a register only adds to one
+      // of the two sums without any branches.
+      __attribute__((target("avx2")))
+      void accumulate(
+          const std::uint8_t* registers, std::size_t count,
+          register_sums& sums) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i high_one = _mm256_set1_epi64x(1ll << 32);
+        const __m256i low_one = _mm256_set1_epi64x(1ll << 30);
+        const __m256i low_offset = _mm256_set1_epi64x(33);
+        __m256i high = zero;
+        __m256i low = zero;
+        std::size_t zeros = 0;
+
+        std::size_t i = 0;
+        for (; i + 32 <= count; i += 32) {
+          __m256i v = _mm256_loadu_si256(
+              reinterpret_cast<const __m256i*>(registers + i));
+          zeros += static_cast<std::size_t>(__builtin_popcount(
+                static_cast<unsigned>(_mm256_movemask_epi8(
+                    _mm256_cmpeq_epi8(v, zero)))));
+          for (std::size_t j = 0; j < 32; j += 4) {
+            int four;
+            std::memcpy(&four, registers + i + j, sizeof(four));
+            __m256i ranks = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(four));
+            high = _mm256_add_epi64(high, _mm256_srlv_epi64(high_one, ranks));
+            low = _mm256_add_epi64(low, _mm256_srlv_epi64(
+                  low_one, _mm256_sub_epi64(ranks, low_offset)));
+          }
+        }
+
+        alignas(32) std::uint64_t lanes[4];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), high);
+        sums.high += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), low);
+        sums.low += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        sums.non_zeros += i - zeros;
+
+        portable::accumulate(registers + i, count - i, sums);
+      }
+
+      // low 64 bits of the lane-wise product of `a` and `b`, from 32-bit
+      // multiplies as AVX2 has no 64-bit one
+      __attribute__((target("avx2")))
+      inline __m256i multiply(__m256i a, __m256i b) {
+        __m256i low = _mm256_mul_epu32(a, b);
+        __m256i cross = _mm256_add_epi64(
+            _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+            _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+        return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+      }
+
+      __attribute__((target("avx2")))
+      void integer_hashes(
+          const std::uint64_t* keys, std::size_t count, std::uint64_t seed,
+          std::uint64_t* out) {
+        const __m256i s = _mm256_set1_epi64x(static_cast<long long>(seed));
+        const __m256i c1 = _mm256_set1_epi64x(
+            static_cast<long long>(0xff51afd7ed558ccdull));
+        const __m256i c2 = _mm256_set1_epi64x(
+            static_cast<long long>(0xc4ceb9fe1a85ec53ull));
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+          __m256i k = _mm256_xor_si256(_mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(keys + i)), s);
+          k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+          k = multiply(k, c1);
+          k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+          k = multiply(k, c2);
+          k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+          _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), k);
+        }
+        portable::integer_hashes(keys + i, count - i, seed, out + i);
+      }
+    }  // namespace avx2
+
+// GCC's own AVX-512 intrinsics trip its uninitialized variable warnings
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+    namespace avx512 {
+      __attribute__((target("avx512f,avx512bw")))
+      void max_registers(
+          std::uint8_t* dst, const std::uint8_t* src, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 64 <= count; i += 64) {
+          __m512i a = _mm512_loadu_si512(dst + i);
+          __m512i b = _mm512_loadu_si512(src + i);
+          _mm512_storeu_si512(dst + i, _mm512_max_epu8(a, b));
+        }
+        avx2::max_registers(dst + i, src + i, count - i);
+      }
+
+      __attribute__((target("avx512f,avx512bw")))
+      void max_registers_many(
+          std::uint8_t* dst, const std::uint8_t* const* srcs,
+          std::size_t sources, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 64 <= count; i += 64) {
+          __m512i a = _mm512_loadu_si512(dst + i);
+          for (std::size_t s = 0; s < sources; s++)
+            a = _mm512_max_epu8(a, _mm512_loadu_si512(srcs[s] + i));
+          _mm512_storeu_si512(dst + i, a);
+        }
+        for (std::size_t s = 0; s < sources; s++)
+          avx2::max_registers(dst + i, srcs[s] + i, count - i);
+      }
+
+      __attribute__((target("avx512f,avx512bw")))
+      void accumulate(
+          const std::uint8_t* registers, std::size_t count,
+          register_sums& sums) {
+        const __m512i zero = _mm512_setzero_si512();
+        const __m512i high_one = _mm512_set1_epi64(1ll << 32);
+        const __m512i low_one = _mm512_set1_epi64(1ll << 30);
+        const __m512i low_offset = _mm512_set1_epi64(33);
+        __m512i high = zero;
+        __m512i low = zero;
+        std::size_t zeros = 0;
+
+        std::size_t i = 0;
+        for (; i + 64 <= count; i += 64) {
+          __m512i v = _mm512_loadu_si512(registers + i);
+          zeros += static_cast<std::size_t>(__builtin_popcountll(
+                _mm512_cmpeq_epi8_mask(v, zero)));
+          for (std::size_t j = 0; j < 64; j += 8) {
+            __m512i ranks = _mm512_cvtepu8_epi64(_mm_loadl_epi64(
+                  reinterpret_cast<const __m128i*>(registers + i + j)));
+            high = _mm512_add_epi64(high, _mm512_srlv_epi64(high_one, ranks));
+            low = _mm512_add_epi64(low, _mm512_srlv_epi64(
+                  low_one, _mm512_sub_epi64(ranks, low_offset)));
+          }
+        }
+
+        sums.high += static_cast<std::uint64_t>(_mm512_reduce_add_epi64(high));
+        sums.low += static_cast<std::uint64_t>(_mm512_reduce_add_epi64(low));
+        sums.non_zeros += i - zeros;
+
+        avx2::accumulate(registers + i, count - i, sums);
+      }
+
+      // AVX-512F has no 64-bit multiply either, that needs AVX-512DQ
+      __attribute__((target("avx512f,avx512bw")))
+      inline __m512i multiply(__m512i a, __m512i b) {
+        __m512i low = _mm512_mul_epu32(a, b);
+        __m512i cross = _mm512_add_epi64(
+            _mm512_mul_epu32(_mm512_srli_epi64(a, 32), b),
+            _mm512_mul_epu32(a, _mm512_srli_epi64(b, 32)));
+        return _mm512_add_epi64(low, _mm512_slli_epi64(cross, 32));
+      }
+
+      __attribute__((target("avx512f,avx512bw")))
+      void integer_hashes(
+          const std::uint64_t* keys, std::size_t count, std::uint64_t seed,
+          std::uint64_t* out) {
+        const __m512i s = _mm512_set1_epi64(static_cast<long long>(seed));
+        const __m512i c1 = _mm512_set1_epi64(
+            static_cast<long long>(0xff51afd7ed558ccdull));
+        const __m512i c2 = _mm512_set1_epi64(
+            static_cast<long long>(0xc4ceb9fe1a85ec53ull));
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+          __m512i k = _mm512_xor_si512(_mm512_loadu_si512(keys + i), s);
+          k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+          k = multiply(k, c1);
+          k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+          k = multiply(k, c2);
+          k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+          _mm512_storeu_si512(out + i, k);
+        }
+        avx2::integer_hashes(keys + i, count - i, seed, out + i);
+      }
+    }  // namespace avx512
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif  // HLL_SIMD_X86
+
+    namespace {
+      const kernels portable_kernels = {
+        instruction_set::portable, portable::max_registers,
+        portable::max_registers_many, portable::accumulate,
+        portable::integer_hashes};
+
+#if defined(HLL_SIMD_X86)
+      const kernels sse2_kernels = {
+        instruction_set::sse2, sse2::max_registers,
+        sse2::max_registers_many, portable::accumulate,
+        portable::integer_hashes};
+
+      const kernels avx2_kernels = {
+        instruction_set::avx2, avx2::max_registers,
+        avx2::max_registers_many, avx2::accumulate, avx2::integer_hashes};
+
+      const kernels avx512_kernels = {
+        instruction_set::avx512, avx512::max_registers,
+        avx512::max_registers_many, avx512::accumulate,
+        avx512::integer_hashes};
+#endif
+    }  // namespace
+
+    bool is_supported(instruction_set isa) {
+#if defined(HLL_SIMD_X86)
+      __builtin_cpu_init();
+      switch (isa) {
+        case instruction_set::portable:
+          return true;
+        case instruction_set::sse2:
+          return __builtin_cpu_supports("sse2");
+        case instruction_set::avx2:
+          return __builtin_cpu_supports("avx2");
+        case instruction_set::avx512:
+          return __builtin_cpu_supports("avx512f") &&
+            __builtin_cpu_supports("avx512bw") &&
+            __builtin_cpu_supports("avx2");
+      }
+      return false;
+#else
+      return isa == instruction_set::portable;
+#endif
+    }
+
+    instruction_set best_instruction_set() {
+      for (auto isa : {instruction_set::avx512, instruction_set::avx2,
+                       instruction_set::sse2})
+        if (is_supported(isa))
+          return isa;
+      return instruction_set::portable;
+    }
+
+    const char* name(instruction_set isa) {
+      switch (isa) {
+        case instruction_set::portable: return "portable";
+        case instruction_set::sse2: return "sse2";
+        case instruction_set::avx2: return "avx2";
+        case instruction_set::avx512: return "avx512";
+      }
+      return "unknown";
+    }
+
+    const kernels& kernels_for(instruction_set isa) {
+      if (!is_supported(isa))
+        throw std::invalid_argument(
+            std::string("instruction set is not supported: ") + name(isa));
+
+#if defined(HLL_SIMD_X86)
+      switch (isa) {
+        case instruction_set::sse2: return sse2_kernels;
+        case instruction_set::avx2: return avx2_kernels;
+        case instruction_set::avx512: return avx512_kernels;
+        default: break;
+      }
+#endif
+      return portable_kernels;
+    }
+
+    const kernels& best_kernels() {
+      static const kernels& best = kernels_for(best_instruction_set());
+      return best;
+    }
+  }  // namespace simd
+}  // namespace hll
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../include/hll/simd.hpp"
+#include "benchmark.hpp"
+
+// Register-wise max and harmonic sum loops as used by `hll::hyperloglog`
+// before the vectorised kernels.
+void scalar_max(std::vector<std::uint8_t>& dst,
+    const std::vector<std::uint8_t>& src) {
+  std::transform(dst.begin(), dst.end(), src.begin(), dst.begin(),
+      [](const std::uint8_t a, const std::uint8_t b) {
+        return std::max(a, b);
+      });
+}
+
+std::pair<double, std::size_t> scalar_sum(
+    const std::vector<std::uint8_t>& registers) {
+  double sum = 0;
+  std::size_t non_zeros = 0;
+  for (auto&& m_j : registers) {
+    if (m_j > 0)
+      non_zeros += 1;
+    sum += 1.0/static_cast<double>(1ul << m_j);
+  }
+  return {sum, non_zeros};
+}
+
+void benchmark_precision(std::uint8_t precision, std::size_t sketches,
+    std::size_t repeats) {
+  std::size_t m = 1ul << precision;
+  std::mt19937_64 gen(precision);
+  std::geometric_distribution<int> rank(0.5);
+  std::vector<std::vector<std::uint8_t>> sources(sketches,
+      std::vector<std::uint8_t>(m));
+  for (auto& source: sources)
+    for (auto& r: source)
+      r = static_cast<std::uint8_t>(std::min(rank(gen), 63));
+
+  std::vector<const std::uint8_t*> srcs;
+  for (const auto& source: sources)
+    srcs.push_back(source.data());
+
+  std::vector<std::uint8_t> dst(m);
+  double bytes = static_cast<double>(m*sketches);
+
+  double max_time = bench::best_of(repeats, [&]() {
+    std::fill(dst.begin(), dst.end(), 0);
+    for (const auto& source: sources)
+      scalar_max(dst, source);
+  });
+  double sum_time = bench::best_of(repeats, [&]() {
+    for (const auto& source: sources)
+      bench::keep(scalar_sum(source).first);
+  });
+  std::cout << "p=" << +precision << " " << std::setw(8) << "scalar"
+    << std::fixed << std::setprecision(2)
+    << "  max: " << bytes/max_time/1e9 << " GB/s"
+    << "  harmonic sum: " << bytes/sum_time/1e9 << " GB/s\n";
+
+  for (auto isa: {hll::simd::instruction_set::portable,
+      hll::simd::instruction_set::sse2, hll::simd::instruction_set::avx2,
+      hll::simd::instruction_set::avx512}) {
+    if (!hll::simd::is_supported(isa))
+      continue;
+    const auto& kernels = hll::simd::kernels_for(isa);
+
+    double pairwise_time = bench::best_of(repeats, [&]() {
+      std::fill(dst.begin(), dst.end(), 0);
+      for (const auto& source: sources)
+        kernels.max_registers(dst.data(), source.data(), m);
+    });
+    double many_time = bench::best_of(repeats, [&]() {
+      std::fill(dst.begin(), dst.end(), 0);
+      kernels.max_registers_many(dst.data(), srcs.data(), srcs.size(), m);
+    });
+    double accumulate_time = bench::best_of(repeats, [&]() {
+      for (const auto& source: sources) {
+        hll::simd::register_sums sums;
+        kernels.accumulate(source.data(), m, sums);
+        bench::keep(sums.harmonic_sum());
+      }
+    });
+
+    std::cout << "p=" << +precision << " " << std::setw(8)
+      << hll::simd::name(isa)
+      << "  max: " << bytes/pairwise_time/1e9 << " GB/s (x"
+      << max_time/pairwise_time << ")"
+      << "  max of many: " << bytes/many_time/1e9 << " GB/s (x"
+      << max_time/many_time << ")"
+      << "  harmonic sum: " << bytes/accumulate_time/1e9 << " GB/s (x"
+      << sum_time/accumulate_time << ")\n";
+  }
+}
+
+int main(int argc, char* argv[]) {
+  std::size_t sketches = 64;
+  std::size_t repeats = 5;
+  if (argc > 1)
+    sketches = std::stoul(argv[1]);
+  if (argc > 2)
+    repeats = std::stoul(argv[2]);
+
+  std::cout << "best instruction set: "
+    << hll::simd::name(hll::simd::best_instruction_set()) << "\n";
+  for (std::uint8_t precision: {12, 14, 16, 18})
+    benchmark_precision(precision, sketches, repeats);
+  return 0;
+}
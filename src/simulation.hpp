@@ -0,0 +1,89 @@
+#ifndef SRC_SIMULATION_HPP_
+#define SRC_SIMULATION_HPP_
+
+// Helpers shared by the tools that simulate many counters, `record_biases` and
+// `estimate_distribution`.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../include/hll/hyperloglog.hpp"
+#include "benchmark.hpp"
+
+namespace sim {
+  template <std::uint8_t p>
+  using precision_constant = std::integral_constant<std::uint8_t, p>;
+
+  template <typename F, std::size_t... ps>
+  void with_precision(std::uint8_t p, F&& f, std::index_sequence<ps...>) {
+    bool found = false;
+    int expand[] = {0, (p == ps + 4 ?
+        (f(precision_constant<static_cast<std::uint8_t>(ps + 4)>{}),
+         found = true) : false, 0)...};
+    static_cast<void>(expand);
+    if (!found)
+      throw std::invalid_argument(
+          "precision should be between 4 and 18, not " + std::to_string(p));
+  }
+
+  // Calls `f(precision_constant<p>{})`, so that a precision chosen at run
+  // time can be used as a template argument.
+  template <typename F>
+  void with_precision(std::uint8_t p, F&& f) {
+    with_precision(p, std::forward<F>(f), std::make_index_sequence<15>{});
+  }
+
+  // Precision given as text, e.g. on the command line. The range is checked
+  // before narrowing, so that e.g. 300 is not taken for 44.
+  inline std::uint8_t parse_precision(const std::string& value) {
+    unsigned long p = std::stoul(value);
+    if (p < 4 || p > 18)
+      throw std::invalid_argument(
+          "precision should be between 4 and 18, not " + value);
+    return static_cast<std::uint8_t>(p);
+  }
+
+  // Seed of the hash function of one trial. Trials with different seeds
+  // behave as if they counted different items.
+  inline std::uint64_t trial_seed(std::uint8_t p, std::size_t trial) {
+    return bench::splitmix64((std::uint64_t{p} << 56) ^ trial);
+  }
+
+  // Inserts items numbered (first, last] of a trial into `counter`, hashing
+  // them in blocks and inserting the hashes in batches.
+  template <typename Counter>
+  void insert_items(Counter& counter, std::uint64_t seed,
+      std::size_t first, std::size_t last,
+      std::vector<std::uint64_t>& buffer) {
+    constexpr std::size_t block = 4096;
+    buffer.resize(block);
+    hll::hash<std::uint64_t> hash;
+    while (first < last) {
+      std::size_t count = std::min(block, last - first);
+      for (std::size_t i = 0; i < count; i++)
+        buffer[i] = hash(first + i + 1, seed);
+      counter.insert_hashes(buffer.data(), count);
+      first += count;
+    }
+  }
+
+  // Cardinalities, at most `points` of them evenly spaced up to `max`, at
+  // which counters are measured.
+  inline std::vector<std::size_t> measure_points(
+      std::size_t max, std::size_t points) {
+    std::size_t inc = std::max<std::size_t>(1, max/std::max<std::size_t>(
+          points, 1));
+    std::vector<std::size_t> cardinalities;
+    for (std::size_t i = inc; i <= max; i += inc)
+      cardinalities.push_back(i);
+    return cardinalities;
+  }
+}  // namespace sim
+
+#endif  // SRC_SIMULATION_HPP_
@@ -0,0 +1,396 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+hll::sketch_map<K, T, p, sp, H, KH, KE>::sketch_map(std::uint64_t seed)
+    : seed(seed) {}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+std::size_t hll::sketch_map<K, T, p, sp, H, KH, KE>::size() const {
+  return slots.size();
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+bool hll::sketch_map<K, T, p, sp, H, KH, KE>::contains(const K &key) const {
+  return slots.find(key) != slots.end();
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+std::size_t hll::sketch_map<K, T, p, sp, H, KH, KE>::dense_count() const {
+  return dense_sums.size();
+}
+
+// Nodes and buckets of the hash table are counted as they are laid out by
+// the common standard libraries. Memory owned by the keys themselves and the
+// overhead of the allocator are not counted.
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+std::size_t hll::sketch_map<K, T, p, sp, H, KH, KE>::memory_usage() const {
+  std::size_t bytes =
+      slots.size() * (sizeof(typename decltype(slots)::value_type) +
+                      sizeof(void *)) +
+      slots.bucket_count() * sizeof(void *) +
+      arena.capacity() * sizeof(sparse_entry) + dense_registers.capacity() +
+      dense_sums.capacity() * sizeof(simd::register_sums);
+  for (const auto &blocks : free_blocks)
+    bytes += blocks.capacity() * sizeof(std::uint32_t);
+  return bytes;
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+void hll::sketch_map<K, T, p, sp, H, KH, KE>::reserve(std::size_t keys) {
+  slots.reserve(keys);
+  arena.reserve(keys * min_block);
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+std::size_t hll::sketch_map<K, T, p, sp, H, KH, KE>::capacity(const slot &s) {
+  return min_block << s.size_class;
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+std::uint32_t hll::sketch_map<K, T, p, sp, H, KH, KE>::allocate_block(
+    std::uint8_t size_class) {
+  if (free_blocks.size() <= size_class)
+    free_blocks.resize(size_class + 1ul);
+  std::vector<std::uint32_t> &blocks = free_blocks[size_class];
+  if (!blocks.empty()) {
+    std::uint32_t offset = blocks.back();
+    blocks.pop_back();
+    return offset;
+  }
+
+  std::size_t offset = arena.size();
+  std::size_t block = min_block << size_class;
+  if (offset + block > std::numeric_limits<std::uint32_t>::max())
+    throw std::length_error("too many sparse entries in a `sketch_map`");
+  arena.resize(offset + block);
+  return static_cast<std::uint32_t>(offset);
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+void hll::sketch_map<K, T, p, sp, H, KH, KE>::free_block(const slot &s) {
+  free_blocks[s.size_class].push_back(s.offset);
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+auto hll::sketch_map<K, T, p, sp, H, KH, KE>::slot_of(const K &key) -> slot & {
+  auto it = slots.find(key);
+  if (it != slots.end())
+    return it->second;
+  slot &s = slots[key];
+  s.offset = allocate_block(0);
+  return s;
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+void hll::sketch_map<K, T, p, sp, H, KH, KE>::insert(const K &key,
+                                                     const T &item) {
+  insert_hash(slot_of(key), H{}(item, seed));
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+void hll::sketch_map<K, T, p, sp, H, KH, KE>::insert_hash(const K &key,
+                                                          std::uint64_t hash) {
+  insert_hash(slot_of(key), hash);
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+template <typename InputIt, typename>
+void hll::sketch_map<K, T, p, sp, H, KH, KE>::insert(InputIt first,
+                                                     InputIt last) {
+  insert_range(first, last, std::is_arithmetic<T>{});
+}
+
+// Slots are looked up while the items of a block are copied, as elements of
+// an `std::unordered_map` keep their address when it grows. Numbers are then
+// hashed with a single `hash_many()`.
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+template <typename InputIt>
+void hll::sketch_map<K, T, p, sp, H, KH, KE>::insert_range(InputIt first,
+                                                           InputIt last,
+                                                           std::true_type) {
+  slot *targets[batch_size];
+  T items[batch_size];
+  std::uint64_t hashes[batch_size];
+  slot *target = nullptr;
+  const K *previous = nullptr;
+  while (first != last) {
+    std::size_t count = 0;
+    for (; count < batch_size && first != last; ++first) {
+      const auto &pair = *first;
+      if (previous == nullptr || !KE{}(pair.first, *previous))
+        target = &slot_of(pair.first);
+      previous = &pair.first;
+      targets[count] = target;
+      items[count++] = pair.second;
+    }
+    H{}.hash_many(items, count, seed, hashes);
+    for (std::size_t i = 0; i < count; i++)
+      prefetch(*targets[i], hashes[i]);
+    for (std::size_t i = 0; i < count; i++)
+      insert_hash(*targets[i], hashes[i]);
+  }
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+template <typename InputIt>
+void hll::sketch_map<K, T, p, sp, H, KH, KE>::insert_range(InputIt first,
+                                                           InputIt last,
+                                                           std::false_type) {
+  slot *target = nullptr;
+  const K *previous = nullptr;
+  for (; first != last; ++first) {
+    const auto &pair = *first;
+    if (previous == nullptr || !KE{}(pair.first, *previous))
+      target = &slot_of(pair.first);
+    previous = &pair.first;
+    insert_hash(*target, H{}(pair.second, seed));
+  }
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+void hll::sketch_map<K, T, p, sp, H, KH, KE>::insert_hash(slot &s,
+                                                          std::uint64_t hash) {
+  if (!s.dense && s.size == capacity(s))
+    compact(s);
+
+  std::uint64_t index;
+  std::uint8_t rank;
+  if (s.dense) {
+    std::tie(index, rank) = detail::hash_rank(hash, p);
+    update_register(s, index, rank);
+  } else {
+    std::tie(index, rank) = detail::hash_rank(hash, sp);
+    arena[s.offset + s.size++] =
+        static_cast<sparse_entry>(index << rank_bits | rank);
+  }
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+void hll::sketch_map<K, T, p, sp, H, KH, KE>::update_register(
+    const slot &s, std::uint64_t index, std::uint8_t rank) {
+  std::uint8_t &r = dense_registers[(std::size_t{s.offset} << p) + index];
+  if (rank > r) {
+    dense_sums[s.offset].remove(r);
+    dense_sums[s.offset].add(rank);
+    r = rank;
+  }
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+void hll::sketch_map<K, T, p, sp, H, KH, KE>::merge(
+    const hll::sketch_map<K, T, p, sp, H, KH, KE> &other) {
+  if (seed != other.seed)
+    throw std::invalid_argument(
+        "two counters should have the same seed to merge");
+  if (&other == this)
+    return;
+
+  for (const auto &key_slot : other.slots) {
+    const slot &from = key_slot.second;
+    slot &s = slot_of(key_slot.first);
+    if (from.dense) {
+      if (!s.dense)
+        convert_to_dense(s);
+      const std::uint8_t *registers_from =
+          other.dense_registers.data() + (std::size_t{from.offset} << p);
+      for (std::size_t i = 0; i < registers; i++)
+        update_register(s, i, registers_from[i]);
+      continue;
+    }
+
+    for (std::size_t i = from.offset; i < from.offset + from.size; i++) {
+      sparse_entry entry = other.arena[i];
+      if (!s.dense && s.size == capacity(s))
+        compact(s);
+      if (s.dense) {
+        std::uint64_t index;
+        std::uint8_t rank;
+        std::tie(index, rank) = detail::sparse_to_dense(
+            entry >> rank_bits,
+            static_cast<std::uint8_t>(entry & ((1u << rank_bits) - 1)), p,
+            sp);
+        update_register(s, index, rank);
+      } else {
+        arena[s.offset + s.size++] = entry;
+      }
+    }
+  }
+}
+
+// the cache line that inserting `hash` into `s` writes to
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+void hll::sketch_map<K, T, p, sp, H, KH, KE>::prefetch(
+    const slot &s, std::uint64_t hash) const {
+  if (s.dense)
+    hll_prefetch(dense_registers.data() + (std::size_t{s.offset} << p) +
+                 (hash >> (64 - p)));
+  else
+    hll_prefetch(arena.data() + s.offset + s.size);
+}
+
+// Called when the block of a sparse key is full. Keys with as many distinct
+// entries as `hll::hyperloglog` keeps in its sparse list become dense, and
+// blocks still more than half full after deduplication grow.
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+void hll::sketch_map<K, T, p, sp, H, KH, KE>::compact(slot &s) {
+  sparse_entry *first = arena.data() + s.offset;
+  s.size = s.sorted = static_cast<std::uint32_t>(
+      detail::sort_unique_entries(first, first + s.size) - first);
+  if (s.size >= sparse_list_max)
+    convert_to_dense(s);
+  else if (s.size > capacity(s) / 2 && capacity(s) < sparse_list_max)
+    grow(s);
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+void hll::sketch_map<K, T, p, sp, H, KH, KE>::grow(slot &s) {
+  std::uint32_t offset =
+      allocate_block(static_cast<std::uint8_t>(s.size_class + 1));
+  std::copy(arena.begin() + s.offset, arena.begin() + s.offset + s.size,
+            arena.begin() + offset);
+  free_block(s);
+  s.offset = offset;
+  s.size_class++;
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+void hll::sketch_map<K, T, p, sp, H, KH, KE>::convert_to_dense(slot &s) {
+  std::size_t block = dense_sums.size();
+  dense_registers.resize((block + 1) * registers);
+  std::uint8_t *dense = dense_registers.data() + block * registers;
+  for (std::size_t i = s.offset; i < s.offset + s.size; i++) {
+    std::uint64_t index;
+    std::uint8_t rank;
+    std::tie(index, rank) = detail::sparse_to_dense(
+        arena[i] >> rank_bits,
+        static_cast<std::uint8_t>(arena[i] & ((1u << rank_bits) - 1)), p, sp);
+    dense[index] = std::max(dense[index], rank);
+  }
+  dense_sums.emplace_back();
+  simd::accumulate(dense, registers, dense_sums.back());
+
+  free_block(s);
+  s.dense = true;
+  s.offset = static_cast<std::uint32_t>(block);
+  s.size = s.sorted = 0;
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+std::size_t
+hll::sketch_map<K, T, p, sp, H, KH, KE>::sparse_count(const slot &s) const {
+  if (s.sorted == s.size)
+    return s.size;
+
+  const sparse_entry *block = arena.data() + s.offset;
+  const sparse_entry *sorted_end = block + s.sorted;
+  auto index = [](sparse_entry e) { return e >> rank_bits; };
+  std::size_t count = s.sorted;
+
+  // small blocks, most of them, are counted without sorting a copy
+  if (s.size <= 16) {
+    for (const sparse_entry *it = sorted_end; it != block + s.size; ++it) {
+      const sparse_entry *seen = block;
+      while (seen != it && index(*seen) != index(*it))
+        ++seen;
+      count += seen == it;
+    }
+    return count;
+  }
+
+  // sorted entries plus the unsorted entries of other indices
+  detail::sorted_entries<sparse_entry, std::allocator<sparse_entry>> sorted(
+      sorted_end, block + s.size, arena.get_allocator());
+  const sparse_entry *it = block;
+  for (const sparse_entry *e = sorted.begin(); e != sorted.end(); ++e) {
+    while (it != sorted_end && index(*it) < index(*e))
+      ++it;
+    if (it == sorted_end || index(*it) != index(*e))
+      count++;
+  }
+  return count;
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+double hll::sketch_map<K, T, p, sp, H, KH, KE>::estimate(const slot &s) const {
+  if (!s.dense)
+    return detail::linear_estimate(sp, sparse_count(s));
+  const simd::register_sums &sums = dense_sums[s.offset];
+  return detail::dense_estimate(
+      p, detail::raw_estimate(p, sums.harmonic_sum()), sums.non_zeros);
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+double hll::sketch_map<K, T, p, sp, H, KH, KE>::estimate(const K &key) const {
+  auto it = slots.find(key);
+  return it == slots.end() ? 0.0 : estimate(it->second);
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+template <typename F>
+void hll::sketch_map<K, T, p, sp, H, KH, KE>::for_each_estimate(F f) const {
+  // the blocks of the next keys are prefetched while the map is walked
+  constexpr std::size_t lookahead = 8;
+  auto ahead = slots.begin();
+  for (std::size_t i = 0; i < lookahead && ahead != slots.end(); i++, ++ahead)
+    prefetch(ahead->second, 0);
+  for (const auto &key_slot : slots) {
+    if (ahead != slots.end())
+      prefetch((ahead++)->second, 0);
+    f(key_slot.first, estimate(key_slot.second));
+  }
+}
+
+template <typename K, typename T, std::uint8_t p, std::uint8_t sp, typename H,
+          typename KH, typename KE>
+std::vector<std::uint8_t>
+hll::sketch_map<K, T, p, sp, H, KH, KE>::serialize(const K &key) const {
+  auto it = slots.find(key);
+  if (it == slots.end())
+    throw std::invalid_argument("the key has no items");
+  const slot &s = it->second;
+
+  std::vector<sparse_entry> entries;
+  detail::register_block dense{nullptr, 0};
+  if (s.dense) {
+    dense.data = dense_registers.data() + std::size_t{s.offset} * registers;
+    dense.count = registers;
+  } else {
+    entries.assign(arena.begin() + s.offset,
+                   arena.begin() + s.offset + s.size);
+    sparse_entry *first = entries.data();
+    entries.resize(static_cast<std::size_t>(
+        detail::sort_unique_entries(first, first + entries.size()) - first));
+  }
+  return detail::serialize_sketch(p, sp, H::id, seed, !s.dense, entries,
+                                  dense);
+}
@@ -0,0 +1,153 @@
+// Memory and insert throughput of `hll::sketch_map` with many keys that see a
+// few items each, against an `std::unordered_map` of `hll::hyperloglog`s.
+//
+// usage: sketch_map_benchmark [keys [items_per_key [baseline_keys]]]
+//
+// The baseline takes a few KiB per key, so it is measured with fewer keys.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../include/hll/hyperloglog.hpp"
+#include "../include/hll/sketch_map.hpp"
+#include "benchmark.hpp"
+
+// live bytes allocated with `operator new`, counted through a header in front
+// of every allocation
+static std::size_t live_bytes = 0;
+
+void* operator new(std::size_t size) {
+  void* ptr = std::malloc(size + 16);
+  if (ptr == nullptr)
+    throw std::bad_alloc();
+  *static_cast<std::size_t*>(ptr) = size;
+  live_bytes += size;
+  return static_cast<char*>(ptr) + 16;
+}
+
+void operator delete(void* ptr) noexcept {
+  if (ptr == nullptr)
+    return;
+  void* block = static_cast<char*>(ptr) - 16;
+  live_bytes -= *static_cast<std::size_t*>(block);
+  std::free(block);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  operator delete(ptr);
+}
+
+using item_pair = std::pair<std::uint64_t, std::uint64_t>;
+
+// The i-th (key, item) pair of the stream: most items go to uniformly random
+// keys, every tenth to one of 1000 hot keys that become dense.
+item_pair stream_pair(std::uint64_t i, std::size_t keys) {
+  std::uint64_t z = bench::splitmix64(i*0x9E3779B97F4A7C15ull);
+  std::uint64_t key = i % 10 == 0 ? z % 1000 : z % keys;
+  return {key, z >> 20};
+}
+
+// Feeds the stream to `insert(chunk)` in chunks and returns the seconds spent
+// inserting, not counting generating the pairs.
+template <typename F>
+double feed(std::size_t keys, std::size_t items, F&& insert) {
+  constexpr std::size_t chunk_size = 1 << 16;
+  std::vector<item_pair> chunk;
+  double seconds = 0;
+  for (std::size_t first = 0; first < items; first += chunk_size) {
+    chunk.clear();
+    for (std::size_t i = first; i < std::min(items, first + chunk_size); i++)
+      chunk.push_back(stream_pair(i, keys));
+    auto start = std::chrono::steady_clock::now();
+    insert(chunk);
+    std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    seconds += elapsed.count();
+  }
+  return seconds;
+}
+
+void report(const std::string& name, std::size_t keys, std::size_t items,
+    double seconds, std::size_t bytes) {
+  std::cout << std::fixed << std::setprecision(1) << name << ": " << keys
+    << " keys, " << items << " items, "
+    << seconds*1e9/static_cast<double>(items) << " ns/item, "
+    << static_cast<double>(bytes)/static_cast<double>(keys) << " bytes/key ("
+    << static_cast<double>(bytes)/(1 << 20) << " MiB)\n";
+}
+
+template <typename Map>
+void benchmark_scan(const Map& map) {
+  double sum = 0;
+  double seconds = bench::best_of(3, [&]() {
+    sum = 0;
+    map.for_each_estimate([&](std::uint64_t, double e) { sum += e; });
+  });
+  bench::keep(sum);
+  std::cout << "  for_each_estimate: "
+    << seconds*1e9/static_cast<double>(map.size()) << " ns/key\n";
+}
+
+int main(int argc, char* argv[]) {
+  std::size_t keys = 10'000'000;
+  std::size_t items_per_key = 4;
+  std::size_t baseline_keys = 100'000;
+  if (argc > 1)
+    keys = std::stoul(argv[1]);
+  if (argc > 2)
+    items_per_key = std::stoul(argv[2]);
+  if (argc > 3)
+    baseline_keys = std::stoul(argv[3]);
+
+  using map_t = hll::sketch_map<std::uint64_t, std::uint64_t, 14, 25>;
+  using hll_t = hll::hyperloglog<std::uint64_t, 14, 25>;
+
+  {
+    std::size_t before = live_bytes;
+    map_t map;
+    double seconds = feed(keys, keys*items_per_key,
+        [&](const std::vector<item_pair>& chunk) {
+          map.insert(chunk.begin(), chunk.end());
+        });
+    report("sketch_map bulk insert", map.size(), keys*items_per_key,
+        seconds, live_bytes - before);
+    std::cout << "  memory_usage(): "
+      << static_cast<double>(map.memory_usage())/(1 << 20) << " MiB, "
+      << map.dense_count() << " dense keys\n";
+    benchmark_scan(map);
+  }
+
+  {
+    std::size_t before = live_bytes;
+    map_t map;
+    double seconds = feed(keys, keys*items_per_key,
+        [&](const std::vector<item_pair>& chunk) {
+          for (const auto& p: chunk)
+            map.insert(p.first, p.second);
+        });
+    report("sketch_map single insert", map.size(), keys*items_per_key,
+        seconds, live_bytes - before);
+  }
+
+  {
+    std::size_t before = live_bytes;
+    std::unordered_map<std::uint64_t, hll_t> map;
+    double seconds = feed(baseline_keys, baseline_keys*items_per_key,
+        [&](const std::vector<item_pair>& chunk) {
+          for (const auto& p: chunk)
+            map[p.first].insert(p.second);
+        });
+    report("unordered_map of hyperloglog", map.size(),
+        baseline_keys*items_per_key, seconds, live_bytes - before);
+  }
+  return 0;
+}
@@ -0,0 +1,625 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "../include/hll/hyperloglog.hpp"
+#include "../include/hll/sketch_store.hpp"
+
+namespace hll {
+  namespace {
+    constexpr std::uint8_t store_magic[8] = {
+      'H', 'L', 'L', 'S', 'T', 'O', 'R', 'E'};
+    constexpr std::uint8_t store_version = 1;
+    constexpr std::size_t file_header_size = 64;
+    constexpr std::size_t record_header_size = 32;
+    constexpr std::size_t max_rollup_levels = 4;
+    constexpr std::size_t end_offset = 24;
+    constexpr std::size_t min_capacity = std::size_t{1} << 20;
+
+    std::uint64_t load_le(const std::uint8_t* data, std::size_t bytes) {
+      std::uint64_t value = 0;
+      for (std::size_t i = bytes; i > 0; i--)
+        value = (value << 8) | data[i - 1];
+      return value;
+    }
+
+    void store_le(std::uint8_t* data, std::uint64_t value,
+        std::size_t bytes) {
+      for (std::size_t i = 0; i < bytes; i++)
+        data[i] = static_cast<std::uint8_t>(value >> (8*i));
+    }
+
+    std::uint64_t padded(std::uint64_t size) {
+      return (size + 7)/8*8;
+    }
+  }  // namespace
+
+  // The file and its memory mapping, which always spans the whole file.
+  struct sketch_store::mapping {
+    std::uint8_t* data = nullptr;
+    std::size_t capacity = 0;
+    bool writable;
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    HANDLE map_handle = nullptr;
+#else
+    int fd = -1;
+#endif
+
+    mapping(const std::string& path, bool create, bool writable)
+        : writable(writable) {
+#ifdef _WIN32
+      handle = CreateFileA(path.c_str(),
+          GENERIC_READ | (writable ? GENERIC_WRITE : 0),
+          FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+          create ? CREATE_NEW : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+          nullptr);
+      if (handle == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("could not open " + path);
+      LARGE_INTEGER size;
+      if (!GetFileSizeEx(handle, &size)) {
+        CloseHandle(handle);
+        throw std::runtime_error("could not read the size of " + path);
+      }
+      capacity = static_cast<std::size_t>(size.QuadPart);
+#else
+      int flags = create ? O_RDWR | O_CREAT | O_EXCL
+        : (writable ? O_RDWR : O_RDONLY);
+      fd = ::open(path.c_str(), flags, 0644);
+      if (fd < 0)
+        throw std::runtime_error("could not open " + path);
+      struct stat st;
+      if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("could not read the size of " + path);
+      }
+      capacity = static_cast<std::size_t>(st.st_size);
+#endif
+      try {
+        map();
+      } catch (...) {
+        close();
+        throw;
+      }
+    }
+
+    ~mapping() {
+      unmap();
+      close();
+    }
+
+    mapping(const mapping&) = delete;
+    mapping& operator=(const mapping&) = delete;
+
+    // grows the file and the mapping to `size` bytes
+    void resize(std::size_t size) {
+      unmap();
+#ifdef _WIN32
+      LARGE_INTEGER end;
+      end.QuadPart = static_cast<LONGLONG>(size);
+      if (!SetFilePointerEx(handle, end, nullptr, FILE_BEGIN) ||
+          !SetEndOfFile(handle))
+        throw std::runtime_error("could not grow the sketch store");
+#else
+      if (::ftruncate(fd, static_cast<off_t>(size)) != 0)
+        throw std::runtime_error("could not grow the sketch store");
+#endif
+      capacity = size;
+      map();
+    }
+
+    void sync() {
+      if (data == nullptr)
+        return;
+#ifdef _WIN32
+      if (!FlushViewOfFile(data, 0) || !FlushFileBuffers(handle))
+        throw std::runtime_error("could not write the sketch store");
+#else
+      if (::msync(data, capacity, MS_SYNC) != 0)
+        throw std::runtime_error("could not write the sketch store");
+#endif
+    }
+
+  private:
+    void map() {
+      if (capacity == 0)
+        return;
+#ifdef _WIN32
+      map_handle = CreateFileMappingA(handle, nullptr,
+          writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+      if (map_handle == nullptr)
+        throw std::runtime_error("could not map the sketch store");
+      data = static_cast<std::uint8_t*>(MapViewOfFile(map_handle,
+            writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, capacity));
+      if (data == nullptr) {
+        CloseHandle(map_handle);
+        map_handle = nullptr;
+        throw std::runtime_error("could not map the sketch store");
+      }
+#else
+      void* ptr = ::mmap(nullptr, capacity,
+          writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+      if (ptr == MAP_FAILED)
+        throw std::runtime_error("could not map the sketch store");
+      data = static_cast<std::uint8_t*>(ptr);
+#endif
+    }
+
+    void unmap() {
+      if (data == nullptr)
+        return;
+#ifdef _WIN32
+      UnmapViewOfFile(data);
+      CloseHandle(map_handle);
+      map_handle = nullptr;
+#else
+      ::munmap(data, capacity);
+#endif
+      data = nullptr;
+    }
+
+    void close() {
+#ifdef _WIN32
+      CloseHandle(handle);
+#else
+      ::close(fd);
+#endif
+    }
+  };
+
+  // The union of the sketches of a range, kept like the sparse list and the
+  // dense registers of a `dynamic_hyperloglog` that merges them one by one.
+  class sketch_store::range_union {
+  public:
+    range_union(std::uint8_t p, std::uint8_t sp, std::size_t entry_bytes)
+        : p(p), sp(sp),
+          sparse_list_max(hll::byte_registers::bytes_for(
+                std::size_t{1} << p)/entry_bytes),
+          sparse(true) {}
+
+    void add_sparse(const std::uint8_t* payload, std::size_t count,
+        std::size_t entry_bytes) {
+      if (!sparse) {
+        for (std::size_t i = 0; i < count; i++)
+          update(load_le(payload + i*entry_bytes, entry_bytes));
+        return;
+      }
+      for (std::size_t i = 0; i < count; i++)
+        entries.push_back(load_le(payload + i*entry_bytes, entry_bytes));
+      // duplicates only count once towards the size of the sparse list
+      if (entries.size() >= sparse_list_max)
+        compact();
+    }
+
+    void add_dense(const std::uint8_t* dense) {
+      if (sparse)
+        convert_to_dense();
+      simd::max_registers(registers.data(), dense, registers.size());
+    }
+
+    bool is_sparse() {
+      if (sparse)
+        compact();
+      return sparse;
+    }
+
+    double estimate() {
+      if (is_sparse())
+        return detail::linear_estimate(sp, entries.size());
+      simd::register_sums sums;
+      simd::accumulate(registers.data(), registers.size(), sums);
+      return detail::dense_estimate(
+          p, detail::raw_estimate(p, sums.harmonic_sum()), sums.non_zeros);
+    }
+
+    std::vector<std::uint8_t> serialize(std::uint8_t hash_id,
+        std::uint64_t seed) {
+      bool s = is_sparse();
+      return detail::serialize_sketch(p, sp, hash_id, seed, s, entries,
+          detail::register_block{registers.data(), registers.size()});
+    }
+
+  private:
+    std::uint8_t p, sp;
+    std::size_t sparse_list_max;
+    bool sparse;
+    std::vector<std::uint64_t> entries;
+    std::vector<std::uint8_t> registers;
+
+    void compact() {
+      std::uint64_t* first = entries.data();
+      entries.resize(static_cast<std::size_t>(
+            detail::sort_unique_entries(first, first + entries.size()) -
+            first));
+      if (entries.size() >= sparse_list_max)
+        convert_to_dense();
+    }
+
+    void convert_to_dense() {
+      sparse = false;
+      registers.assign(std::size_t{1} << p, 0);
+      for (auto entry: entries)
+        update(entry);
+      entries.clear();
+      entries.shrink_to_fit();
+    }
+
+    void update(std::uint64_t entry) {
+      std::uint64_t index;
+      std::uint8_t rank;
+      std::tie(index, rank) = detail::sparse_to_dense(
+          entry >> format::rank_bits,
+          static_cast<std::uint8_t>(entry & ((1u << format::rank_bits) - 1)),
+          p, sp);
+      registers[index] = std::max(registers[index], rank);
+    }
+  };
+
+  sketch_store::sketch_store()
+      : read_only(false), p(0), sp(0), hash(0), hash_seed(0), sketches(0) {}
+
+  sketch_store::sketch_store(const std::string& path, bool read_only)
+      : file(std::make_unique<mapping>(path, false, !read_only)),
+        read_only(read_only), p(0), sp(0), hash(0), hash_seed(0),
+        sketches(0) {
+    load();
+  }
+
+  sketch_store::~sketch_store() = default;
+  sketch_store::sketch_store(sketch_store&& other) noexcept = default;
+  sketch_store& sketch_store::operator=(sketch_store&& other) noexcept =
+    default;
+
+  sketch_store sketch_store::create(const std::string& path,
+      const settings& s) {
+    if (s.precision < 4 || s.precision > 18)
+      throw std::invalid_argument(
+          "precision should be between 4 and 18, not " +
+          std::to_string(s.precision));
+    if (s.sparse_precision <= s.precision || s.sparse_precision > 58)
+      throw std::invalid_argument(
+          "sparse precision should be greater than precision and at most 58");
+    if (s.rollups.size() > max_rollup_levels)
+      throw std::invalid_argument("there can be at most 4 rollup levels");
+    for (std::size_t l = 0; l < s.rollups.size(); l++)
+      if (s.rollups[l] == 0 || (l > 0 && (s.rollups[l] <= s.rollups[l - 1] ||
+              s.rollups[l] % s.rollups[l - 1] != 0)))
+        throw std::invalid_argument(
+            "rollup widths should be multiples of the ones before");
+
+    sketch_store store;
+    store.file = std::make_unique<mapping>(path, true, true);
+    store.file->resize(min_capacity);
+
+    std::uint8_t* header = store.file->data;
+    std::memcpy(header, store_magic, sizeof(store_magic));
+    header[8] = store_version;
+    header[9] = s.precision;
+    header[10] = s.sparse_precision;
+    header[11] = s.hash_id;
+    header[12] = static_cast<std::uint8_t>(s.rollups.size());
+    store_le(header + 16, s.seed, 8);
+    store_le(header + end_offset, file_header_size, 8);
+    for (std::size_t l = 0; l < s.rollups.size(); l++)
+      store_le(header + 32 + 8*l, s.rollups[l], 8);
+
+    store.load();
+    return store;
+  }
+
+  std::uint8_t sketch_store::precision() const {
+    return p;
+  }
+
+  std::uint8_t sketch_store::sparse_precision() const {
+    return sp;
+  }
+
+  std::uint8_t sketch_store::hash_id() const {
+    return hash;
+  }
+
+  std::uint64_t sketch_store::seed() const {
+    return hash_seed;
+  }
+
+  const std::vector<std::uint64_t>& sketch_store::rollups() const {
+    return widths;
+  }
+
+  std::size_t sketch_store::size() const {
+    return sketches;
+  }
+
+  bool sketch_store::contains(const std::string& series) const {
+    return series_ids.find(series) != series_ids.end();
+  }
+
+  std::size_t sketch_store::registers() const {
+    return std::size_t{1} << p;
+  }
+
+  std::size_t sketch_store::entry_bytes() const {
+    return sp + format::rank_bits <= 32 ? 4 : 8;
+  }
+
+  std::uint64_t sketch_store::end() const {
+    return load_le(file->data + end_offset, 8);
+  }
+
+  void sketch_store::set_end(std::uint64_t end) {
+    store_le(file->data + end_offset, end, 8);
+  }
+
+  void sketch_store::load() {
+    const std::uint8_t* header = file->data;
+    if (file->capacity < file_header_size ||
+        std::memcmp(header, store_magic, sizeof(store_magic)) != 0)
+      throw std::invalid_argument("file is not a sketch store");
+    if (header[8] != store_version)
+      throw std::invalid_argument("unsupported sketch store version");
+
+    p = header[9];
+    sp = header[10];
+    hash = header[11];
+    if (p < 4 || p > 18 || sp <= p || sp > 58)
+      throw std::invalid_argument("invalid sketch store precision");
+    if (header[12] > max_rollup_levels)
+      throw std::invalid_argument("invalid sketch store rollups");
+    hash_seed = load_le(header + 16, 8);
+    widths.clear();
+    for (std::size_t l = 0; l < header[12]; l++)
+      widths.push_back(load_le(header + 32 + 8*l, 8));
+
+    std::uint64_t last = end();
+    if (last < file_header_size || last > file->capacity)
+      throw std::invalid_argument("truncated sketch store");
+
+    series_ids.clear();
+    index.clear();
+    sketches = 0;
+    for (std::uint64_t offset = file_header_size; offset < last;) {
+      if (last - offset < record_header_size)
+        throw std::invalid_argument("truncated sketch store record");
+      std::uint64_t payload = load_le(file->data + offset + 16, 8);
+      if (payload > last - offset - record_header_size)
+        throw std::invalid_argument("truncated sketch store record");
+      index_record(offset);
+      offset += record_header_size + padded(payload);
+    }
+  }
+
+  void sketch_store::index_record(std::uint64_t offset) {
+    const std::uint8_t* record = file->data + offset;
+    std::uint8_t level = record[1];
+    auto series = static_cast<std::uint32_t>(load_le(record + 4, 4));
+    std::uint64_t time = load_le(record + 8, 8);
+    std::uint64_t payload = load_le(record + 16, 8);
+    std::uint64_t entries = load_le(record + 24, 8);
+
+    auto kind = static_cast<record_kind>(record[0]);
+    if (kind == record_kind::series) {
+      if (series != index.size())
+        throw std::invalid_argument("invalid sketch store series");
+      series_ids.emplace(
+          std::string(reinterpret_cast<const char*>(record) +
+            record_header_size, static_cast<std::size_t>(payload)),
+          series);
+      index.emplace_back();
+      index.back().rollups.resize(widths.size());
+      return;
+    }
+
+    if (series >= index.size())
+      throw std::invalid_argument("invalid sketch store series");
+    switch (kind) {
+      case record_kind::sparse:
+        if (payload != entries*entry_bytes())
+          throw std::invalid_argument("invalid sparse sketch record");
+        break;
+      case record_kind::dense:
+        if (payload != registers())
+          throw std::invalid_argument("invalid dense sketch record");
+        break;
+      case record_kind::rollup:
+        if (payload != registers() || level >= widths.size())
+          throw std::invalid_argument("invalid rollup record");
+        index[series].rollups[level][time] = offset;
+        return;
+      default:
+        throw std::invalid_argument("invalid sketch store record");
+    }
+    index[series].sketches.emplace(time, offset);
+    sketches++;
+  }
+
+  template <typename Fill>
+  std::uint64_t sketch_store::append_record(record_kind kind,
+      std::uint8_t level, std::uint32_t series, std::uint64_t time,
+      std::uint64_t payload, std::uint64_t entries, Fill fill) {
+    std::uint64_t offset = end();
+    std::uint64_t next = offset + record_header_size + padded(payload);
+    if (next > file->capacity)
+      file->resize(static_cast<std::size_t>(
+            std::max<std::uint64_t>(next, 2*file->capacity)));
+
+    std::uint8_t* record = file->data + offset;
+    std::memset(record, 0, record_header_size);
+    record[0] = static_cast<std::uint8_t>(kind);
+    record[1] = level;
+    store_le(record + 4, series, 4);
+    store_le(record + 8, time, 8);
+    store_le(record + 16, payload, 8);
+    store_le(record + 24, entries, 8);
+    std::memset(record + record_header_size, 0,
+        static_cast<std::size_t>(padded(payload)));
+    fill(record + record_header_size);
+
+    // the record only becomes part of the store once it is complete
+    set_end(next);
+    index_record(offset);
+    return offset;
+  }
+
+  std::uint32_t sketch_store::series_id(const std::string& series) {
+    auto it = series_ids.find(series);
+    if (it != series_ids.end())
+      return it->second;
+    if (index.size() >= std::numeric_limits<std::uint32_t>::max())
+      throw std::length_error("too many series in the sketch store");
+
+    auto id = static_cast<std::uint32_t>(index.size());
+    append_record(record_kind::series, 0, id, 0, series.size(), 0,
+        [&series](std::uint8_t* payload) {
+          std::memcpy(payload, series.data(), series.size());
+        });
+    return id;
+  }
+
+  std::uint8_t* sketch_store::rollup_registers(std::uint32_t series,
+      std::size_t level, std::uint64_t start) {
+    const auto& rollups = index[series].rollups[level];
+    auto it = rollups.find(start);
+    std::uint64_t offset = it != rollups.end() ? it->second
+      : append_record(record_kind::rollup, static_cast<std::uint8_t>(level),
+          series, start, registers(), 0, [](std::uint8_t*) {});
+    return file->data + offset + record_header_size;
+  }
+
+  void sketch_store::append(const std::string& series, std::uint64_t time,
+      const hll::sketch_view& sketch) {
+    if (read_only)
+      throw std::logic_error("the sketch store is read-only");
+    if (sketch.precision() != p || sketch.sparse_precision() != sp)
+      throw std::invalid_argument(
+          "the sketch should have the precisions of the store");
+    if (sketch.hash_id() != hash || sketch.seed() != hash_seed)
+      throw std::invalid_argument(
+          "the sketch should have the hash function and seed of the store");
+
+    std::uint32_t id = series_id(series);
+    std::size_t eb = entry_bytes();
+    std::uint64_t offset;
+    if (sketch.is_sparse()) {
+      offset = append_record(record_kind::sparse, 0, id, time,
+          sketch.sparse_size()*eb, sketch.sparse_size(),
+          [&sketch, eb](std::uint8_t* payload) {
+            sketch.for_each_sparse([&](std::uint64_t index,
+                  std::uint8_t rank) {
+              store_le(payload, index << format::rank_bits | rank, eb);
+              payload += eb;
+            });
+          });
+    } else {
+      offset = append_record(record_kind::dense, 0, id, time, registers(), 0,
+          [&sketch, this](std::uint8_t* payload) {
+            for (std::size_t i = 0; i < registers(); i++)
+              payload[i] = sketch.dense_register(i);
+          });
+    }
+
+    for (std::size_t level = 0; level < widths.size(); level++) {
+      std::uint8_t* rollup = rollup_registers(
+          id, level, time - time % widths[level]);
+      // appending the rollup may have moved the mapping
+      const std::uint8_t* payload = file->data + offset + record_header_size;
+      if (!sketch.is_sparse()) {
+        simd::max_registers(rollup, payload, registers());
+        continue;
+      }
+      for (std::size_t i = 0; i < sketch.sparse_size(); i++) {
+        std::uint64_t entry = load_le(payload + i*eb, eb);
+        std::uint64_t index;
+        std::uint8_t rank;
+        std::tie(index, rank) = detail::sparse_to_dense(
+            entry >> format::rank_bits,
+            static_cast<std::uint8_t>(entry & ((1u << format::rank_bits) - 1)),
+            p, sp);
+        rollup[index] = std::max(rollup[index], rank);
+      }
+    }
+  }
+
+  void sketch_store::flush() {
+    file->sync();
+  }
+
+  void sketch_store::merge_range(const std::string& series,
+      std::uint64_t from, std::uint64_t to, range_union& result) const {
+    auto it = series_ids.find(series);
+    if (it == series_ids.end())
+      return;
+    const series_index& s = index[it->second];
+    const std::uint8_t* data = file->data;
+
+    std::uint64_t time = from;
+    while (time < to) {
+      // the longest whole rollup period that starts here, if any
+      bool rolled_up = false;
+      for (std::size_t level = widths.size(); level > 0; level--) {
+        std::uint64_t width = widths[level - 1];
+        if (time % width != 0 || width > to - time)
+          continue;
+        // no rollup means no sketches in the period
+        auto rollup = s.rollups[level - 1].find(time);
+        if (rollup != s.rollups[level - 1].end())
+          result.add_dense(data + rollup->second + record_header_size);
+        time += width;
+        rolled_up = true;
+        break;
+      }
+      if (rolled_up)
+        continue;
+
+      // sketches up to the next period of the first level
+      std::uint64_t next = to;
+      if (!widths.empty() && to - time > widths[0] - time % widths[0])
+        next = time + (widths[0] - time % widths[0]);
+      for (auto sketch = s.sketches.lower_bound(time);
+          sketch != s.sketches.end() && sketch->first < next; ++sketch) {
+        const std::uint8_t* record = data + sketch->second;
+        const std::uint8_t* payload = record + record_header_size;
+        if (static_cast<record_kind>(record[0]) == record_kind::dense)
+          result.add_dense(payload);
+        else
+          result.add_sparse(payload,
+              static_cast<std::size_t>(load_le(record + 24, 8)),
+              entry_bytes());
+      }
+      time = next;
+    }
+  }
+
+  std::vector<std::uint8_t> sketch_store::union_range(
+      const std::string& series, std::uint64_t from, std::uint64_t to) const {
+    range_union result(p, sp, entry_bytes());
+    merge_range(series, from, to, result);
+    return result.serialize(hash, hash_seed);
+  }
+
+  double sketch_store::estimate(const std::string& series,
+      std::uint64_t from, std::uint64_t to) const {
+    range_union result(p, sp, entry_bytes());
+    merge_range(series, from, to, result);
+    return result.estimate();
+  }
+}  // namespace hll
@@ -0,0 +1,96 @@
+// Time of range union queries over a year of hourly sketches of one series,
+// read from a `hll::sketch_store` with and without day and week rollups, and
+// by deserializing every sketch of the range and merging it on the heap.
+//
+// usage: sketch_store_benchmark [items_per_hour [path]]
+//
+// The stores are written to `path` (sketch_store_benchmark.bin by default) and
+// removed afterwards.
+
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../include/hll/dynamic_hyperloglog.hpp"
+#include "../include/hll/sketch_store.hpp"
+#include "benchmark.hpp"
+
+namespace {
+  constexpr std::uint64_t hours = 24*365;
+
+  struct range {
+    const char* name;
+    std::uint64_t from, to;
+  };
+
+  void report(const std::string& name, const range& r, double seconds,
+      double estimate) {
+    std::cout << std::fixed << std::setprecision(1) << name << ", " << r.name
+      << ": " << seconds*1e6 << " us, estimate " << estimate << "\n";
+  }
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::uint64_t items_per_hour = 20'000;
+  std::string path = "sketch_store_benchmark.bin";
+  if (argc > 1)
+    items_per_hour = std::stoul(argv[1]);
+  if (argc > 2)
+    path = argv[2];
+
+  // half of the items of an hour are new
+  std::vector<std::vector<std::uint8_t>> sketches;
+  for (std::uint64_t hour = 0; hour < hours; hour++) {
+    hll::dynamic_hyperloglog<std::uint64_t> h(14, 25);
+    for (std::uint64_t i = 0; i < items_per_hour; i++)
+      h.insert(hour*items_per_hour/2 + i);
+    sketches.push_back(h.serialize());
+  }
+
+  const range ranges[] = {
+    {"one day", 24*100 + 5, 24*101 + 5},
+    {"one week", 24*100 + 5, 24*107 + 5},
+    {"one month", 24*100 + 5, 24*130 + 5},
+    {"one year", 0, hours},
+  };
+
+  for (auto r: ranges) {
+    double estimate = 0;
+    double seconds = bench::best_of(3, [&]() {
+      auto h = hll::dynamic_hyperloglog<std::uint64_t>::deserialize(
+          sketches[r.from].data(), sketches[r.from].size());
+      for (std::uint64_t hour = r.from + 1; hour < r.to; hour++)
+        h.merge(hll::dynamic_hyperloglog<std::uint64_t>::deserialize(
+              sketches[hour].data(), sketches[hour].size()));
+      estimate = h.estimate();
+    });
+    report("deserialize and merge", r, seconds, estimate);
+  }
+
+  for (bool rollups: {false, true}) {
+    std::remove(path.c_str());
+    hll::sketch_store::settings settings;
+    settings.precision = 14;
+    settings.sparse_precision = 25;
+    if (rollups)
+      settings.rollups = {24, 24*7};
+    auto store = hll::sketch_store::create(path, settings);
+    for (std::uint64_t hour = 0; hour < hours; hour++)
+      store.append("series", hour,
+          hll::sketch_view(sketches[hour].data(), sketches[hour].size()));
+
+    std::string name = rollups ? "store with rollups" : "store";
+    for (auto r: ranges) {
+      double estimate = 0;
+      double seconds = bench::best_of(3, [&]() {
+        estimate = store.estimate("series", r.from, r.to);
+      });
+      report(name, r, seconds, estimate);
+    }
+  }
+  std::remove(path.c_str());
+  return 0;
+}
@@ -0,0 +1,131 @@
+#include <limits>
+#include <stdexcept>
+
+#include "../include/hll/hyperloglog.hpp"
+#include "../include/hll/sketch_view.hpp"
+
+namespace hll {
+  sketch_view::sketch_view(const void* buffer, std::size_t size)
+      : data(static_cast<const std::uint8_t*>(buffer)), entries(0) {
+    if (size < format::header_size)
+      throw std::invalid_argument("buffer is too small to hold a sketch");
+    if (data[0] != format::magic[0] || data[1] != format::magic[1])
+      throw std::invalid_argument("buffer does not hold a sketch");
+    if (data[2] != format::version)
+      throw std::invalid_argument("unsupported sketch format version");
+
+    p = data[3];
+    sp = data[4];
+    if (p < 4 || p > 18 || sp <= p || sp > 58)
+      throw std::invalid_argument("invalid sketch precision");
+
+    if (data[5] == static_cast<std::uint8_t>(format::representation::sparse))
+      sparse = true;
+    else if (data[5] ==
+        static_cast<std::uint8_t>(format::representation::dense))
+      sparse = false;
+    else
+      throw std::invalid_argument("invalid sketch representation");
+
+    payload_offset = format::header_size;
+    if (sparse) {
+      std::uint64_t count;
+      if (!format::read_varint(data, size, payload_offset, count))
+        throw std::invalid_argument("truncated sparse sketch");
+
+      std::size_t offset = payload_offset;
+      std::uint64_t entry = 0;
+      for (std::uint64_t i = 0; i < count; i++) {
+        std::uint64_t delta;
+        if (!format::read_varint(data, size, offset, delta))
+          throw std::invalid_argument("truncated sparse sketch");
+        // every entry has a higher index than the one before
+        if (delta > std::numeric_limits<std::uint64_t>::max() - entry ||
+            (i > 0 && ((entry + delta) >> format::rank_bits) ==
+                          (entry >> format::rank_bits)))
+          throw std::invalid_argument(
+              "sparse entries are not sorted and deduplicated");
+        entry += delta;
+
+        std::uint64_t rank = entry & ((1u << format::rank_bits) - 1);
+        if ((entry >> format::rank_bits) >= (1ul << sp) ||
+            rank == 0 || rank > 64u - sp)
+          throw std::invalid_argument("invalid sparse entry");
+      }
+      entries = static_cast<std::size_t>(count);
+      total_size = offset;
+    } else {
+      total_size = payload_offset + format::dense_payload_size(p);
+      if (size < total_size)
+        throw std::invalid_argument("truncated dense sketch");
+
+      // as for sparse entries, no hash has a rank above 64 - p
+      for (std::size_t i = 0; i < (std::size_t{1} << p); i++)
+        if (dense_register(i) > 64u - p)
+          throw std::invalid_argument("invalid dense register");
+    }
+  }
+
+  std::uint8_t sketch_view::precision() const {
+    return p;
+  }
+
+  std::uint8_t sketch_view::sparse_precision() const {
+    return sp;
+  }
+
+  std::uint64_t sketch_view::seed() const {
+    std::uint64_t seed = 0;
+    for (int i = 7; i >= 0; i--)
+      seed = (seed << 8) | data[8 + i];
+    return seed;
+  }
+
+  std::uint8_t sketch_view::hash_id() const {
+    return data[6];
+  }
+
+  bool sketch_view::is_sparse() const {
+    return sparse;
+  }
+
+  std::size_t sketch_view::size() const {
+    return total_size;
+  }
+
+  std::size_t sketch_view::sparse_size() const {
+    return entries;
+  }
+
+  std::uint8_t sketch_view::dense_register(std::size_t index) const {
+    std::size_t bit = index*format::rank_bits;
+    const std::uint8_t* byte = data + payload_offset + bit/8;
+    unsigned shift = static_cast<unsigned>(bit % 8);
+    unsigned word = byte[0];
+    if (shift + format::rank_bits > 8)
+      word |= static_cast<unsigned>(byte[1]) << 8;
+    return static_cast<std::uint8_t>(
+        (word >> shift) & ((1u << format::rank_bits) - 1));
+  }
+
+  double sketch_view::estimate() const {
+    if (sparse)
+      return detail::linear_estimate(sp, entries);
+
+    // every three bytes hold four registers
+    const std::uint8_t* payload = data + payload_offset;
+    simd::register_sums sums;
+    for (std::size_t i = 0; i < format::dense_payload_size(p); i += 3) {
+      std::uint32_t word = static_cast<std::uint32_t>(payload[i]) |
+        static_cast<std::uint32_t>(payload[i+1]) << 8 |
+        static_cast<std::uint32_t>(payload[i+2]) << 16;
+      for (int j = 0; j < 4; j++)
+        sums.add(static_cast<std::uint8_t>(
+              (word >> (j*format::rank_bits)) &
+              ((1u << format::rank_bits) - 1)));
+    }
+
+    return detail::dense_estimate(
+        p, detail::raw_estimate(p, sums.harmonic_sum()), sums.non_zeros);
+  }
+}  // namespace hll
@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+template <typename T, std::uint8_t p, typename H>
+hll::sliding_hyperloglog<T, p, H>::sliding_hyperloglog(timestamp max_window,
+                                                       std::uint64_t seed)
+    : window(max_window), newest(0), seed(seed), registers(1ul << p),
+      free_blocks(size_classes), sweep(0) {}
+
+template <typename T, std::uint8_t p, typename H>
+auto hll::sliding_hyperloglog<T, p, H>::max_window() const -> timestamp {
+  return window;
+}
+
+template <typename T, std::uint8_t p, typename H>
+auto hll::sliding_hyperloglog<T, p, H>::latest() const -> timestamp {
+  return newest;
+}
+
+template <typename T, std::uint8_t p, typename H>
+auto hll::sliding_hyperloglog<T, p, H>::oldest_kept() const -> timestamp {
+  return newest > window ? newest - window : 0;
+}
+
+template <typename T, std::uint8_t p, typename H>
+void hll::sliding_hyperloglog<T, p, H>::check_window(timestamp since) const {
+  if (since < oldest_kept())
+    throw std::invalid_argument(
+        "the window should not be longer than `max_window()`");
+}
+
+template <typename T, std::uint8_t p, typename H>
+std::size_t hll::sliding_hyperloglog<T, p, H>::candidates() const {
+  std::size_t count = 0;
+  for (const auto &pairs : registers)
+    count += pairs.size;
+  return count;
+}
+
+// Freed blocks are reused, so there are at most 2^p blocks of each size and
+// offsets always fit in 32 bits.
+template <typename T, std::uint8_t p, typename H>
+std::uint32_t
+hll::sliding_hyperloglog<T, p, H>::allocate_block(std::uint8_t size_class) {
+  std::vector<std::uint32_t> &blocks = free_blocks[size_class];
+  if (!blocks.empty()) {
+    std::uint32_t offset = blocks.back();
+    blocks.pop_back();
+    return offset;
+  }
+
+  std::size_t offset = arena.size();
+  arena.resize(offset + (min_block << size_class));
+  return static_cast<std::uint32_t>(offset);
+}
+
+// drops the pairs that left the longest window, and the block once empty
+template <typename T, std::uint8_t p, typename H>
+void hll::sliding_hyperloglog<T, p, H>::evict(std::size_t index) {
+  pair_list &pairs = registers[index];
+  std::uint64_t oldest = oldest_kept() << rank_bits;
+  if (pairs.size == 0 || arena[pairs.offset] >= oldest)
+    return;
+  std::uint64_t *first = arena.data() + pairs.offset;
+  std::uint64_t *last = first + pairs.size;
+  std::uint64_t *kept = std::lower_bound(first + 1, last, oldest);
+  std::copy(kept, last, first);
+  pairs.size = static_cast<std::uint8_t>(last - kept);
+  if (pairs.size == 0)
+    free_blocks[pairs.size_class].push_back(pairs.offset);
+}
+
+template <typename T, std::uint8_t p, typename H>
+void hll::sliding_hyperloglog<T, p, H>::insert(const T &item, timestamp time) {
+  insert_hash(H{}(item, seed), time);
+}
+
+template <typename T, std::uint8_t p, typename H>
+template <typename U, typename>
+void hll::sliding_hyperloglog<T, p, H>::insert(const char *data,
+                                               std::size_t size,
+                                               timestamp time) {
+  insert_hash(H{}(data, size, seed), time);
+}
+
+template <typename T, std::uint8_t p, typename H>
+template <typename InputIt>
+void hll::sliding_hyperloglog<T, p, H>::insert(InputIt first, InputIt last,
+                                               timestamp time) {
+  std::uint64_t hashes[batch_size];
+  while (first != last) {
+    std::size_t count = 0;
+    for (; count < batch_size && first != last; ++first)
+      hashes[count++] = H{}(*first, seed);
+    insert_hashes(hashes, count, time);
+  }
+}
+
+template <typename T, std::uint8_t p, typename H>
+void hll::sliding_hyperloglog<T, p, H>::insert_hash(std::uint64_t hash,
+                                                    timestamp time) {
+  insert_hashes(&hash, 1, time);
+}
+
+template <typename T, std::uint8_t p, typename H>
+void hll::sliding_hyperloglog<T, p, H>::insert_hashes(
+    const std::uint64_t *hashes, std::size_t count, timestamp time) {
+  if (time >> (64 - rank_bits))
+    throw std::invalid_argument("timestamps should be less than 2^58");
+  newest = std::max(newest, time);
+
+  // The pair list of a register and its block are two dependent random
+  // accesses, so both are prefetched for a whole block of hashes before any
+  // register is updated.
+  std::uint64_t indices[batch_size];
+  std::uint8_t ranks[batch_size];
+  while (count > 0) {
+    std::size_t block = std::min(count, batch_size);
+    for (std::size_t i = 0; i < block; i++) {
+      std::tie(indices[i], ranks[i]) = detail::hash_rank(hashes[i], p);
+      hll_prefetch(registers.data() + indices[i]);
+    }
+    for (std::size_t i = 0; i < block; i++)
+      hll_prefetch(arena.data() + registers[indices[i]].offset);
+
+    for (std::size_t i = 0; i < block; i++) {
+      update_register(indices[i], ranks[i], time);
+      evict(sweep);
+      sweep = (sweep + 1) % registers.size();
+    }
+    hashes += block;
+    count -= block;
+  }
+}
+
+// Keeps the pairs of a register sorted by timestamp with strictly decreasing
+// ranks, so that the maximum rank of any window is that of its first pair.
+template <typename T, std::uint8_t p, typename H>
+void hll::sliding_hyperloglog<T, p, H>::update_register(std::uint64_t index,
+                                                        std::uint8_t rank,
+                                                        timestamp time) {
+  constexpr std::uint64_t rank_mask = (1u << rank_bits) - 1;
+  evict(index);
+  if (time < oldest_kept())
+    return;
+
+  pair_list &pairs = registers[index];
+  std::uint64_t pair = time << rank_bits | rank;
+  if (pairs.size == 0) {
+    pairs.size_class = 0;
+    pairs.offset = allocate_block(0);
+    arena[pairs.offset] = pair;
+    pairs.size = 1;
+    return;
+  }
+
+  // a pair that is not older and not lower hides this one from every window
+  std::uint64_t *begin = arena.data() + pairs.offset;
+  std::uint64_t *end = begin + pairs.size;
+  std::uint64_t *later =
+      std::upper_bound(begin, end, time << rank_bits | rank_mask);
+  if (later != end && (*later & rank_mask) >= rank)
+    return;
+  if (later != begin && (*(later - 1) >> rank_bits) == time &&
+      (*(later - 1) & rank_mask) >= rank)
+    return;
+
+  // and this one hides the pairs that are not newer and not higher
+  std::uint64_t *first = later;
+  while (first != begin && (*(first - 1) & rank_mask) <= rank)
+    --first;
+  if (first != later) {
+    *first = pair;
+    std::copy(later, end, first + 1);
+    pairs.size = static_cast<std::uint8_t>(pairs.size - (later - first - 1));
+    return;
+  }
+
+  std::size_t position = static_cast<std::size_t>(later - begin);
+  if (pairs.size == min_block << pairs.size_class) {
+    // moves to a block of the next size, which may reallocate the arena
+    pair_list grown = pairs;
+    grown.size_class++;
+    grown.offset = allocate_block(grown.size_class);
+    std::copy_n(arena.data() + pairs.offset, pairs.size,
+                arena.data() + grown.offset);
+    free_blocks[pairs.size_class].push_back(pairs.offset);
+    pairs = grown;
+  }
+  begin = arena.data() + pairs.offset;
+  std::copy_backward(begin + position, begin + pairs.size,
+                     begin + pairs.size + 1);
+  begin[position] = pair;
+  pairs.size++;
+}
+
+template <typename T, std::uint8_t p, typename H>
+void hll::sliding_hyperloglog<T, p, H>::merge(
+    const hll::sliding_hyperloglog<T, p, H> &other) {
+  if (seed != other.seed)
+    throw std::invalid_argument(
+        "two counters should have the same seed to merge");
+  if (&other == this)
+    return;
+
+  // pairs older than the shorter window may already be evicted from one of
+  // the counters, so longer windows of the union would undercount
+  window = std::min(window, other.window);
+  newest = std::max(newest, other.newest);
+  for (std::size_t i = 0; i < registers.size(); i++) {
+    evict(i);
+    const pair_list &pairs = other.registers[i];
+    for (std::size_t j = 0; j < pairs.size; j++) {
+      std::uint64_t pair = other.arena[pairs.offset + j];
+      update_register(i,
+                      static_cast<std::uint8_t>(pair & ((1u << rank_bits) - 1)),
+                      pair >> rank_bits);
+    }
+  }
+}
+
+template <typename T, std::uint8_t p, typename H>
+std::uint8_t hll::sliding_hyperloglog<T, p, H>::rank_since(
+    const pair_list &pairs, timestamp since) const {
+  // no pair is that recent, and `since << rank_bits` would wrap past 2^58
+  if (since > newest || pairs.size == 0)
+    return 0;
+  const std::uint64_t *end = arena.data() + pairs.offset + pairs.size;
+  const std::uint64_t *it = std::lower_bound(
+      arena.data() + pairs.offset, end, since << rank_bits);
+  if (it == end)
+    return 0;
+  return static_cast<std::uint8_t>(*it & ((1u << rank_bits) - 1));
+}
+
+template <typename T, std::uint8_t p, typename H>
+std::vector<std::uint8_t>
+hll::sliding_hyperloglog<T, p, H>::dense_vec(timestamp since) const {
+  check_window(since);
+  std::vector<std::uint8_t> dense(registers.size());
+  for (std::size_t i = 0; i < registers.size(); i++)
+    dense[i] = rank_since(registers[i], since);
+  return dense;
+}
+
+template <typename T, std::uint8_t p, typename H>
+double hll::sliding_hyperloglog<T, p, H>::estimate(timestamp since) const {
+  check_window(since);
+  simd::register_sums sums;
+  for (const auto &pairs : registers)
+    sums.add(rank_since(pairs, since));
+  return detail::dense_estimate(
+      p, detail::raw_estimate(p, sums.harmonic_sum()), sums.non_zeros);
+}
+
+template <typename T, std::uint8_t p, typename H>
+double hll::sliding_hyperloglog<T, p, H>::estimate() const {
+  return estimate(oldest_kept());
+}
@@ -160,3 +160,1461 @@ TEST_CASE("counts after transitioning from sparse to dense", "[transition]") {
     REQUIRE(count*(1.0 - relative_error) < est);
   }
 }
+
+TEST_CASE("batch inserts match single inserts", "[batch]") {
+  std::size_t m = (1ul << p);
+  std::vector<std::size_t> items(3*m);
+  for (std::size_t i = 0; i < items.size(); i++)
+    items[i] = i + 1;
+
+  SECTION("range insert") {
+    hll::hyperloglog<std::size_t, p, sp> single, batched;
+    for (auto i: items)
+      single.insert(i);
+    batched.insert(items.begin(), items.end());
+    REQUIRE(single.is_sparse() == batched.is_sparse());
+    REQUIRE(single.dense_vec() == batched.dense_vec());
+    REQUIRE(single.estimate() == batched.estimate());
+  }
+
+  SECTION("range insert staying sparse") {
+    hll::hyperloglog<std::size_t, p, sp> single, batched;
+    for (std::size_t i = 0; i < 1000; i++)
+      single.insert(items[i]);
+    batched.insert(items.begin(), items.begin() + 1000);
+    REQUIRE(batched.is_sparse());
+    REQUIRE(single.estimate() == batched.estimate());
+  }
+
+  SECTION("pre-hashed insert") {
+    std::uint64_t seed = 42;
+    hll::hyperloglog<std::size_t, p, sp> single(true, seed), hashed(true, seed);
+    std::vector<std::uint64_t> hashes;
+    for (auto i: items) {
+      single.insert(i);
+      hashes.push_back(hll::hash<std::size_t>{}(i, seed));
+    }
+    hashed.insert_hashes(hashes.data(), hashes.size()/2);
+    for (std::size_t i = hashes.size()/2; i < hashes.size(); i++)
+      hashed.insert_hash(hashes[i]);
+    REQUIRE(single.dense_vec() == hashed.dense_vec());
+  }
+}
+
+TEST_CASE("serialization round trips", "[serialization]") {
+  hll::hyperloglog<std::size_t, p, sp> h(false, 1234);
+  std::size_t m = (1ul << p);
+
+  SECTION("sparse counters") {
+    for (std::size_t i = 1; i <= 1000; i++)
+      h.insert(i);
+    REQUIRE(h.is_sparse());
+    auto bytes = h.serialize();
+    REQUIRE(bytes.size() < 1000*sizeof(std::uint64_t));
+
+    hll::sketch_view view(bytes.data(), bytes.size());
+    REQUIRE(view.is_sparse());
+    REQUIRE(view.seed() == 1234);
+    REQUIRE(view.size() == bytes.size());
+    REQUIRE(view.estimate() == h.estimate());
+
+    auto h2 = hll::hyperloglog<std::size_t, p, sp>::deserialize(
+        bytes.data(), bytes.size());
+    REQUIRE(h2.is_sparse());
+    REQUIRE(h2.estimate() == h.estimate());
+  }
+
+  SECTION("dense counters") {
+    for (std::size_t i = 1; i <= 2*m; i++)
+      h.insert(i);
+    REQUIRE_FALSE(h.is_sparse());
+    auto bytes = h.serialize();
+    REQUIRE(bytes.size() == hll::format::header_size + m*6/8);
+
+    hll::sketch_view view(bytes.data(), bytes.size());
+    REQUIRE_FALSE(view.is_sparse());
+    REQUIRE(view.estimate() == h.estimate());
+
+    auto h2 = hll::hyperloglog<std::size_t, p, sp>::deserialize(
+        bytes.data(), bytes.size());
+    REQUIRE(h2.dense_vec() == h.dense_vec());
+  }
+
+  SECTION("merging views") {
+    hll::hyperloglog<std::size_t, p, sp> sparse_other(false, 1234);
+    hll::hyperloglog<std::size_t, p, sp> dense_other(true, 1234);
+    for (std::size_t i = 1; i <= 20; i++) {
+      h.insert(i);
+      sparse_other.insert(i+5);
+      dense_other.insert(i+10);
+    }
+    auto sparse_bytes = sparse_other.serialize();
+    auto dense_bytes = dense_other.serialize();
+
+    auto expected = h;
+    expected.merge(sparse_other);
+    h.merge(hll::sketch_view(sparse_bytes.data(), sparse_bytes.size()));
+    REQUIRE(h.is_sparse());
+    REQUIRE(h.estimate() == expected.estimate());
+
+    expected.merge(dense_other);
+    h.merge(hll::sketch_view(dense_bytes.data(), dense_bytes.size()));
+    REQUIRE(h.dense_vec() == expected.dense_vec());
+  }
+
+  SECTION("rejecting malformed buffers") {
+    h.insert(1);
+    auto bytes = h.serialize();
+    REQUIRE_THROWS_AS(hll::sketch_view(bytes.data(), 4),
+        std::invalid_argument);
+    REQUIRE_THROWS_AS(hll::sketch_view(bytes.data(), bytes.size() - 1),
+        std::invalid_argument);
+    bytes[0] = 'X';
+    REQUIRE_THROWS_AS(hll::sketch_view(bytes.data(), bytes.size()),
+        std::invalid_argument);
+
+    hll::hyperloglog<std::size_t, p, sp> other_seed(false, 1);
+    auto other_bytes = other_seed.serialize();
+    REQUIRE_THROWS_AS(
+        h.merge(hll::sketch_view(other_bytes.data(), other_bytes.size())),
+        std::invalid_argument);
+
+    // the sketch of one item with `count` entries, the rest given by deltas
+    auto one = h.serialize();
+    REQUIRE(one[hll::format::header_size] == 1);
+    auto with_entries = [&one](std::uint8_t count,
+        std::initializer_list<std::uint64_t> deltas) {
+      std::vector<std::uint8_t> bytes = one;
+      bytes.at(hll::format::header_size) = count;
+      for (auto delta: deltas)
+        hll::format::write_varint(bytes, delta);
+      return bytes;
+    };
+
+    // the same index again with higher ranks
+    auto duplicates = with_entries(3, {1, 1});
+    REQUIRE_THROWS_AS(hll::sketch_view(duplicates.data(), duplicates.size()),
+        std::invalid_argument);
+    REQUIRE_THROWS_AS((hll::hyperloglog<std::size_t, p, sp>::deserialize(
+            duplicates.data(), duplicates.size())),
+        std::invalid_argument);
+
+    // a delta that wraps around to the entry of the previous index
+    auto wrapped = with_entries(2, {0 - (std::uint64_t{1} << 6)});
+    REQUIRE_THROWS_AS(hll::sketch_view(wrapped.data(), wrapped.size()),
+        std::invalid_argument);
+
+    // a dense first register with the highest rank, then one rank higher
+    hll::hyperloglog<std::size_t, p, sp> dense(true, 1234);
+    auto highest = dense.serialize();
+    highest[hll::format::header_size] = 64 - p;
+    REQUIRE(hll::sketch_view(highest.data(), highest.size())
+        .dense_register(0) == 64 - p);
+    auto too_high = highest;
+    too_high[hll::format::header_size]++;
+    REQUIRE_THROWS_AS(hll::sketch_view(too_high.data(), too_high.size()),
+        std::invalid_argument);
+    REQUIRE_THROWS_AS((hll::hyperloglog<std::size_t, p, sp>::deserialize(
+            too_high.data(), too_high.size())),
+        std::invalid_argument);
+  }
+}
+
+TEST_CASE("packed registers", "[registers]") {
+  SECTION("set and get registers straddling words") {
+    hll::packed_registers r(1ul << 6);
+    for (std::size_t i = 0; i < r.size(); i++)
+      r.update(i, static_cast<std::uint8_t>((i*7 + 3) % 64));
+    for (std::size_t i = 0; i < r.size(); i++)
+      REQUIRE(r.get(i) == (i*7 + 3) % 64);
+    REQUIRE(r.size_in_bytes() == 48);
+  }
+
+  SECTION("merge takes register-wise maximum") {
+    std::size_t m = 1ul << 10;
+    hll::packed_registers a(m), b(m);
+    std::vector<std::uint8_t> expected(m);
+    std::uint64_t state = 88172645463325252ul;
+    for (std::size_t i = 0; i < m; i++) {
+      state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+      auto x = static_cast<std::uint8_t>(state % 64);
+      auto y = static_cast<std::uint8_t>((state >> 8) % 64);
+      a.update(i, x);
+      b.update(i, y);
+      expected[i] = std::max(x, y);
+    }
+    a.merge(b);
+    REQUIRE(a.values() == expected);
+  }
+
+  SECTION("counters with packed registers match byte registers") {
+    hll::hyperloglog<std::size_t, p, sp> bytes;
+    hll::hyperloglog<std::size_t, p, sp, hll::packed_registers> packed;
+    hll::hyperloglog<std::size_t, p, sp, hll::packed_registers> other(true);
+    std::size_t m = (1ul << p);
+    for (std::size_t i = 1; i <= 2*m; i++) {
+      bytes.insert(i);
+      packed.insert(i);
+      other.insert(i + m);
+    }
+    REQUIRE(packed.dense_vec() == bytes.dense_vec());
+    REQUIRE(packed.estimate() == bytes.estimate());
+
+    packed.merge(other);
+    REQUIRE(packed.estimate() > bytes.estimate());
+    auto merged = packed.dense_vec();
+    auto others = other.dense_vec();
+    for (std::size_t i = 0; i < m; i++)
+      REQUIRE(merged[i] == std::max(bytes.dense_vec()[i], others[i]));
+  }
+}
+
+#include <hll/simd.hpp>
+
+TEST_CASE("vectorised register kernels", "[simd]") {
+  std::size_t count = 1000;  // not a multiple of any vector width
+  std::vector<std::vector<std::uint8_t>> sources(5,
+      std::vector<std::uint8_t>(count));
+  std::uint64_t state = 88172645463325252ul;
+  for (auto& source: sources)
+    for (auto& r: source) {
+      state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+      r = static_cast<std::uint8_t>(state % 5 == 0 ? 0 : state % 64);
+    }
+
+  std::vector<std::uint8_t> expected = sources[0];
+  for (std::size_t s = 1; s < sources.size(); s++)
+    for (std::size_t i = 0; i < count; i++)
+      expected[i] = std::max(expected[i], sources[s][i]);
+
+  double expected_sum = 0;
+  std::size_t expected_non_zeros = 0;
+  for (auto r: sources[0]) {
+    expected_sum += std::ldexp(1.0, -r);
+    expected_non_zeros += (r > 0);
+  }
+
+  for (auto isa: {hll::simd::instruction_set::portable,
+      hll::simd::instruction_set::sse2, hll::simd::instruction_set::avx2,
+      hll::simd::instruction_set::avx512}) {
+    if (!hll::simd::is_supported(isa))
+      continue;
+    const auto& kernels = hll::simd::kernels_for(isa);
+
+    std::vector<std::uint8_t> pairwise = sources[0];
+    for (std::size_t s = 1; s < sources.size(); s++)
+      kernels.max_registers(pairwise.data(), sources[s].data(), count);
+    REQUIRE(pairwise == expected);
+
+    std::vector<std::uint8_t> many = sources[0];
+    std::vector<const std::uint8_t*> srcs;
+    for (std::size_t s = 1; s < sources.size(); s++)
+      srcs.push_back(sources[s].data());
+    kernels.max_registers_many(many.data(), srcs.data(), srcs.size(), count);
+    REQUIRE(many == expected);
+
+    hll::simd::register_sums sums;
+    kernels.accumulate(sources[0].data(), count, sums);
+    REQUIRE(sums.non_zeros == expected_non_zeros);
+    REQUIRE(std::abs(sums.harmonic_sum() - expected_sum) < 1e-9);
+
+    hll::simd::register_sums portable_sums;
+    hll::simd::kernels_for(hll::simd::instruction_set::portable).accumulate(
+        sources[0].data(), count, portable_sums);
+    REQUIRE(sums.harmonic_sum() == portable_sums.harmonic_sum());
+  }
+}
+
+TEST_CASE("incrementally maintained estimates", "[estimate]") {
+  std::size_t m = (1ul << p);
+
+  SECTION("dense register sums match a full pass") {
+    hll::hyperloglog<std::size_t, p, sp> h(true);
+    for (std::size_t i = 1; i <= 3*m; i++) {
+      h.insert(i);
+      if (i % (m/2) == 0) {
+        hll::hyperloglog<std::size_t, p, sp> recomputed(true);
+        recomputed.merge(h);
+        REQUIRE(h.estimate() == recomputed.estimate());
+      }
+    }
+  }
+
+  SECTION("sparse counts follow inserts and merges") {
+    hll::hyperloglog<std::size_t, p, sp> h, other;
+    for (std::size_t i = 1; i <= 100; i++) {
+      h.insert(i);
+      double est = h.estimate();
+      REQUIRE(est < static_cast<double>(i+1));
+      REQUIRE(static_cast<double>(i-1) < est);
+      REQUIRE(h.estimate() == est);
+      other.insert(i + 1000);
+    }
+    h.merge(other);
+    REQUIRE(h.estimate() > 199);
+    REQUIRE(h.estimate() < 201);
+  }
+}
+
+#include <thread>
+
+#include <hll/concurrent_hyperloglog.hpp>
+
+TEST_CASE("concurrent inserts", "[concurrent]") {
+  constexpr std::size_t threads = 4;
+
+  for (std::size_t count : {100ul, 1000ul, 5*(1ul << p)}) {
+    hll::concurrent_hyperloglog<std::size_t, p, sp> shared;
+    hll::hyperloglog<std::size_t, p, sp> expected;
+    for (std::size_t i = 0; i < count; i++)
+      expected.insert(i);
+
+    std::vector<std::thread> workers;
+    for (std::size_t t = 0; t < threads; t++)
+      workers.emplace_back([&shared, count, t]() {
+        for (std::size_t i = t; i < count; i += threads) {
+          shared.insert(i);
+          shared.insert(i);  // duplicates should not change anything
+        }
+      });
+    for (auto& w: workers)
+      w.join();
+
+    REQUIRE(shared.is_sparse() == expected.is_sparse());
+    REQUIRE(shared.estimate() == expected.estimate());
+  }
+
+  SECTION("estimates while inserting") {
+    hll::concurrent_hyperloglog<std::size_t, p, sp> shared;
+    std::vector<std::thread> workers;
+    for (std::size_t t = 0; t < threads; t++)
+      workers.emplace_back([&shared, t]() {
+        for (std::size_t i = t; i < 2*(1ul << p); i += threads)
+          shared.insert(i);
+      });
+    double last = 0;
+    for (int i = 0; i < 100; i++) {
+      double est = shared.estimate();
+      REQUIRE(est >= 0);
+      last = est;
+    }
+    for (auto& w: workers)
+      w.join();
+    REQUIRE(last <= shared.estimate() + 1);
+  }
+
+  SECTION("around the conversion point") {
+    // 2^p/4 entries of 32 bits, each item inserted once by one of the threads.
+    // hyperloglog converts on the next merge of its temporary list, which
+    // holds up to a tenth of that.
+    for (std::size_t count : {(1ul << p)/4 - 1000, (1ul << p)/4*5/4}) {
+      hll::concurrent_hyperloglog<std::size_t, p, sp> shared;
+      hll::hyperloglog<std::size_t, p, sp> expected;
+      for (std::size_t i = 0; i < count; i++)
+        expected.insert(i);
+
+      std::vector<std::thread> workers;
+      for (std::size_t t = 0; t < threads; t++)
+        workers.emplace_back([&shared, count, t]() {
+          for (std::size_t i = t; i < count; i += threads)
+            shared.insert(i);
+        });
+      for (auto& w: workers)
+        w.join();
+
+      REQUIRE(shared.is_sparse() == (count < (1ul << p)/4));
+      REQUIRE(shared.is_sparse() == expected.is_sparse());
+      REQUIRE(shared.estimate() == expected.estimate());
+    }
+  }
+
+  SECTION("converts to dense at the same size as hyperloglog") {
+    // between 2^p/8 and 2^p/4 entries of 32 bits
+    for (std::size_t count : {2500ul, 3000ul, 3500ul, 4000ul}) {
+      hll::concurrent_hyperloglog<std::size_t, 14, 25> shared;
+      hll::hyperloglog<std::size_t, 14, 25> expected;
+      for (std::size_t i = 0; i < count; i++) {
+        shared.insert(i);
+        expected.insert(i);
+      }
+      REQUIRE(expected.is_sparse());
+      REQUIRE(shared.is_sparse() == expected.is_sparse());
+      REQUIRE(shared.estimate() == expected.estimate());
+    }
+  }
+}
+
+#include <hll/thread_pool.hpp>
+
+TEST_CASE("merging many counters", "[merge]") {
+  // a mix of sparse counters of various sizes and a few dense ones
+  std::vector<hll::hyperloglog<std::size_t, p, sp>> counters;
+  std::size_t item = 0;
+  for (std::size_t c = 0; c < 40; c++) {
+    hll::hyperloglog<std::size_t, p, sp> h(c % 10 == 9);
+    for (std::size_t i = 0; i < 50*c; i++)
+      h.insert(item++ % 10000);
+    counters.push_back(h);
+  }
+
+  auto sequential = [](
+      const std::vector<hll::hyperloglog<std::size_t, p, sp>>& hs,
+      std::size_t count) {
+    hll::hyperloglog<std::size_t, p, sp> result = hs[0];
+    for (std::size_t i = 1; i < count; i++)
+      result.merge(hs[i]);
+    return result;
+  };
+
+  SECTION("sparse counters stay sparse") {
+    auto expected = sequential(counters, 9);
+    auto merged = hll::merge_all(counters.begin(), counters.begin() + 9);
+    REQUIRE(merged.is_sparse());
+    REQUIRE(merged.serialize() == expected.serialize());
+    REQUIRE(merged.estimate() == expected.estimate());
+  }
+
+  SECTION("mixed counters") {
+    auto expected = sequential(counters, counters.size());
+    auto merged = hll::merge_all(counters.begin(), counters.end());
+    REQUIRE_FALSE(merged.is_sparse());
+    REQUIRE(merged.dense_vec() == expected.dense_vec());
+    REQUIRE(merged.estimate() == expected.estimate());
+
+    hll::thread_pool pool(4);
+    auto parallel = hll::merge_all(counters.begin(), counters.end(), pool);
+    REQUIRE(parallel.dense_vec() == expected.dense_vec());
+    REQUIRE(parallel.estimate() == expected.estimate());
+
+    std::vector<const hll::hyperloglog<std::size_t, p, sp>*> pointers;
+    for (const auto& h: counters)
+      pointers.push_back(&h);
+    auto from_pointers = hll::merge_all(pointers.begin(), pointers.end());
+    REQUIRE(from_pointers.dense_vec() == expected.dense_vec());
+
+    auto three = hll::union_of(counters[3], counters[9], counters[20]);
+    hll::hyperloglog<std::size_t, p, sp> three_expected = counters[3];
+    three_expected.merge(counters[9]);
+    three_expected.merge(counters[20]);
+    REQUIRE(three.dense_vec() == three_expected.dense_vec());
+  }
+
+  SECTION("packed registers") {
+    std::vector<hll::hyperloglog<std::size_t, p, sp, hll::packed_registers>>
+      packed;
+    for (const auto& h: counters) {
+      std::vector<std::uint8_t> bytes = h.serialize();
+      packed.push_back(
+          hll::hyperloglog<std::size_t, p, sp, hll::packed_registers>
+          ::deserialize(bytes.data(), bytes.size()));
+    }
+    hll::thread_pool pool(3);
+    auto merged = hll::merge_all(packed.begin(), packed.end(), pool);
+    REQUIRE(merged.dense_vec() ==
+        sequential(counters, counters.size()).dense_vec());
+  }
+
+  SECTION("sparse counters with too many entries become dense") {
+    std::vector<hll::hyperloglog<std::size_t, p, sp>> many(20);
+    hll::hyperloglog<std::size_t, p, sp> all(true);
+    for (std::size_t i = 0; i < 20*((1ul << p)/40); i++) {
+      many[i % 20].insert(i);
+      all.insert(i);
+    }
+    REQUIRE(many[0].is_sparse());
+    auto merged = hll::merge_all(many.begin(), many.end());
+    REQUIRE_FALSE(merged.is_sparse());
+    REQUIRE(merged.dense_vec() == all.dense_vec());
+  }
+
+  SECTION("invalid merges") {
+    std::vector<hll::hyperloglog<std::size_t, p, sp>> none;
+    REQUIRE_THROWS_AS(hll::merge_all(none.begin(), none.end()),
+        std::invalid_argument);
+
+    hll::hyperloglog<std::size_t, p, sp> other_seed(false, 42);
+    REQUIRE_THROWS_AS(hll::union_of(counters[0], other_seed),
+        std::invalid_argument);
+  }
+}
+
+TEST_CASE("sparse memory budget", "[sparse]") {
+  // 2^14 byte registers, i.e. 16KiB, hold 4096 32-bit sparse entries but only
+  // 2048 64-bit entries
+  hll::hyperloglog<std::size_t, 14, 24> narrow;
+  hll::hyperloglog<std::size_t, 14, 30> wide;
+  hll::hyperloglog<std::size_t, 14, 24, hll::packed_registers> packed;
+  for (std::size_t i = 0; i < 3500; i++) {
+    narrow.insert(i);
+    wide.insert(i);
+    packed.insert(i);
+  }
+
+  REQUIRE(narrow.is_sparse());
+  REQUIRE_FALSE(wide.is_sparse());
+  REQUIRE_FALSE(packed.is_sparse());  // 12KiB of packed registers
+  REQUIRE(std::abs(narrow.estimate() - 3500) < 5);
+
+  std::vector<std::uint8_t> bytes = narrow.serialize();
+  auto restored =
+    hll::hyperloglog<std::size_t, 14, 24>::deserialize(
+        bytes.data(), bytes.size());
+  REQUIRE(restored.is_sparse());
+  REQUIRE(restored.estimate() == narrow.estimate());
+
+  for (std::size_t i = 3500; i < 5000; i++)
+    narrow.insert(i);
+  REQUIRE_FALSE(narrow.is_sparse());
+}
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+std::size_t counted_allocations = 0;
+// every allocation of the test program, including those of `std::allocator`
+std::atomic<std::size_t> global_allocations{0};
+
+void* operator new(std::size_t size) {
+  global_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* ptr = std::malloc(size == 0 ? 1 : size))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+// GCC takes the inlined `free()` for one of memory from the built-in `new`
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+template <typename U>
+struct counting_allocator {
+  using value_type = U;
+
+  counting_allocator() = default;
+  template <typename V>
+  counting_allocator(const counting_allocator<V>&) {}
+
+  U* allocate(std::size_t n) {
+    counted_allocations++;
+    return std::allocator<U>{}.allocate(n);
+  }
+
+  void deallocate(U* ptr, std::size_t n) {
+    std::allocator<U>{}.deallocate(ptr, n);
+  }
+};
+
+template <typename U, typename V>
+bool operator==(const counting_allocator<U>&, const counting_allocator<V>&) {
+  return true;
+}
+
+template <typename U, typename V>
+bool operator!=(const counting_allocator<U>&, const counting_allocator<V>&) {
+  return false;
+}
+
+TEST_CASE("allocation-free steady state", "[allocations]") {
+  using counted_hll = hll::hyperloglog<std::size_t, p, sp,
+        hll::byte_registers, counting_allocator<std::uint8_t>>;
+  std::vector<std::size_t> items(20000);
+  for (std::size_t i = 0; i < items.size(); i++)
+    items[i] = i;
+
+  SECTION("sparse") {
+    counted_hll h;
+    double estimates[3];
+    // the first round fills the lists and the per-thread sorting buffer
+    for (int round = 0; round < 4; round++) {
+      if (round == 1) {
+        counted_allocations = 0;
+        global_allocations = 0;
+      }
+      for (auto i: items)
+        h.insert(i);
+      h.estimate();
+      h.insert(items.begin(), items.end());
+      if (round > 0)
+        estimates[round - 1] = h.estimate();
+    }
+    REQUIRE(counted_allocations == 0);
+    REQUIRE(global_allocations == 0);
+    REQUIRE(h.is_sparse());
+    for (double e: estimates)
+      REQUIRE(e > 19000);
+  }
+
+  SECTION("dense") {
+    counted_hll h(true);
+    counted_allocations = 0;
+    global_allocations = 0;
+    for (std::size_t round = 0; round < 3; round++) {
+      for (auto i: items)
+        h.insert(i + round*items.size());
+      h.estimate();
+    }
+    REQUIRE(counted_allocations == 0);
+    REQUIRE(global_allocations == 0);
+  }
+
+  SECTION("merges") {
+    counted_hll h, other;
+    h.insert(items.begin(), items.begin() + 5000);
+    other.insert(items.begin() + 2000, items.begin() + 8000);
+    h.merge(other);
+    h.merge(other);
+
+    counted_allocations = 0;
+    h.merge(other);
+    REQUIRE(counted_allocations == 0);
+    REQUIRE(h.estimate() > 7800);
+    REQUIRE(h.estimate() < 8200);
+
+    hll::hyperloglog<std::size_t, p, sp> expected;
+    expected.insert(items.begin(), items.begin() + 8000);
+    REQUIRE(h.estimate() == expected.estimate());
+  }
+}
+
+TEST_CASE("reading a counter from many threads", "[allocations]") {
+  // a temporary list with entries left to sort in const methods
+  hll::hyperloglog<std::size_t, p, sp> shared;
+  for (std::size_t i = 0; i < 1000; i++)
+    shared.insert(i);
+  const auto bytes = shared.serialize();
+  hll::hyperloglog<std::size_t, p, sp> expected;
+  expected.merge(shared);
+  const double estimate = expected.estimate();
+
+  std::vector<std::thread> readers;
+  std::vector<int> agree(4, 0);
+  for (std::size_t t = 0; t < agree.size(); t++)
+    readers.emplace_back([&, t]() {
+      bool same = true;
+      for (int round = 0; round < 50; round++) {
+        hll::hyperloglog<std::size_t, p, sp> copy;
+        copy.merge(shared);
+        same = same && shared.serialize() == bytes &&
+          copy.serialize() == expected.serialize() &&
+          shared.estimate() == estimate;
+      }
+      agree[t] = same;
+    });
+  for (auto& r: readers)
+    r.join();
+  for (auto a: agree)
+    REQUIRE(a);
+}
+
+TEST_CASE("hashing terminated strings", "[murmurhash]") {
+  std::string data = "The quick brown fox jumps over the lazy dog";
+  for (std::size_t len = 0; len <= data.size(); len++) {
+    std::string prefix = data.substr(0, len);
+    REQUIRE(hll::murmurhash3_x64_128_terminated(prefix.data(), len, 42) ==
+        hll::murmurhash3_x64_128(
+          prefix.c_str(), static_cast<int>(len) + 1, 42));
+  }
+}
+
+#include <numeric>
+
+#include <hll/hash.hpp>
+
+TEST_CASE("hash policies", "[hash]") {
+  std::vector<std::uint64_t> keys(1003);  // not a multiple of any vector width
+  std::uint64_t state = 88172645463325252ul;
+  for (auto& k: keys) {
+    state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+    k = state;
+  }
+  std::vector<int> small_keys(100);
+  for (std::size_t i = 0; i < small_keys.size(); i++)
+    small_keys[i] = static_cast<int>(i) - 50;
+  std::uint64_t seed = 0x9E3779B97F4A7C15;
+  std::string text = "The quick brown fox jumps over the lazy dog";
+
+  SECTION("murmur_hash matches hll::hash") {
+    REQUIRE(hll::murmur_hash{}(keys[0], seed) ==
+        hll::hash<std::uint64_t>{}(keys[0], seed));
+    REQUIRE(hll::murmur_hash{}(text, seed) ==
+        hll::hash<std::string>{}(text, seed));
+    REQUIRE(hll::murmur_hash{}(text.data(), text.size(), seed) ==
+        hll::hash<std::string>{}(text, seed));
+
+    hll::basic_murmur_hash<false> unterminated;
+    REQUIRE(unterminated(text, seed) == hll::murmurhash3_x64_128(
+          text.data(), static_cast<int>(text.size()), seed));
+    REQUIRE(unterminated(text, seed) != hll::murmur_hash{}(text, seed));
+  }
+
+  SECTION("hash_many matches hashing one key at a time") {
+    auto check = [&](auto hash) {
+      using policy = decltype(hash);
+      for (std::size_t count: {std::size_t{0}, std::size_t{1}, std::size_t{7},
+           keys.size()}) {
+        std::vector<std::uint64_t> many(count);
+        hll::hash_many<policy>(keys.data(), count, seed, many.data());
+        for (std::size_t i = 0; i < count; i++)
+          REQUIRE(many[i] == hash(keys[i], seed));
+      }
+      std::vector<std::uint64_t> many(small_keys.size());
+      hll::hash_many<policy>(
+          small_keys.data(), small_keys.size(), seed, many.data());
+      for (std::size_t i = 0; i < small_keys.size(); i++)
+        REQUIRE(many[i] == hash(small_keys[i], seed));
+    };
+    check(hll::murmur_hash{});
+    check(hll::wy_hash{});
+    check(hll::integer_hash{});
+
+    bool flags[] = {false, true, true};
+    long long signed_keys[] = {-1, 0, 1ll << 40};
+    std::uint64_t many[3];
+    hll::hash_many<hll::integer_hash>(flags, 3, seed, many);
+    for (std::size_t i = 0; i < 3; i++)
+      REQUIRE(many[i] == hll::integer_hash{}(flags[i], seed));
+    hll::hash_many<hll::integer_hash>(signed_keys, 3, seed, many);
+    for (std::size_t i = 0; i < 3; i++)
+      REQUIRE(many[i] == hll::integer_hash{}(signed_keys[i], seed));
+    std::int64_t signed_words[] = {-1, 0, std::int64_t{1} << 40};
+    hll::hash_many<hll::integer_hash>(signed_words, 3, seed, many);
+    for (std::size_t i = 0; i < 3; i++)
+      REQUIRE(many[i] == hll::integer_hash{}(signed_words[i], seed));
+  }
+
+  SECTION("vectorised integer hashes") {
+    std::vector<std::uint64_t> expected(keys.size());
+    for (std::size_t i = 0; i < keys.size(); i++)
+      expected[i] = hll::integer_hash{}(keys[i], seed);
+
+    for (auto isa: {hll::simd::instruction_set::portable,
+        hll::simd::instruction_set::sse2, hll::simd::instruction_set::avx2,
+        hll::simd::instruction_set::avx512}) {
+      if (!hll::simd::is_supported(isa))
+        continue;
+      std::vector<std::uint64_t> hashes(keys.size());
+      hll::simd::kernels_for(isa).integer_hashes(
+          keys.data(), keys.size(), seed, hashes.data());
+      REQUIRE(hashes == expected);
+    }
+  }
+
+  SECTION("wy_hash of strings and numbers") {
+    std::vector<std::uint64_t> hashes;
+    for (std::size_t len = 0; len <= text.size(); len++) {
+      std::string prefix = text.substr(0, len);
+      REQUIRE(hll::wy_hash{}(prefix, seed) ==
+          hll::wy_hash{}(prefix.data(), len, seed));
+      hashes.push_back(hll::wy_hash{}(prefix, seed));
+    }
+    std::sort(hashes.begin(), hashes.end());
+    REQUIRE(std::unique(hashes.begin(), hashes.end()) == hashes.end());
+
+    REQUIRE(hll::wy_hash{}(-0.0, seed) == hll::wy_hash{}(0.0, seed));
+    REQUIRE(hll::wy_hash{}(keys[0], seed) != hll::wy_hash{}(keys[0], 1));
+  }
+
+  SECTION("counters with other hash policies") {
+    using integer_hll = hll::hyperloglog<std::uint64_t, 14, 25,
+          hll::byte_registers, std::allocator<std::uint8_t>,
+          hll::integer_hash>;
+    using wy_hll = hll::hyperloglog<std::string, 14, 25,
+          hll::byte_registers, std::allocator<std::uint8_t>, hll::wy_hash>;
+    double tolerance = 3*1.04/std::sqrt(1 << 14);
+
+    std::vector<std::uint64_t> sequence(200000);
+    std::iota(sequence.begin(), sequence.end(), 0);
+    integer_hll ih;
+    ih.insert(sequence.begin(), sequence.end());
+    REQUIRE(std::abs(ih.estimate() - 200000)/200000 < tolerance);
+
+    wy_hll wh;
+    for (std::size_t i = 0; i < 200000; i++) {
+      std::string key = std::to_string(i);
+      if (i % 2)
+        wh.insert(key);
+      else
+        wh.insert(key.data(), key.size());
+    }
+    REQUIRE(std::abs(wh.estimate() - 200000)/200000 < tolerance);
+
+    auto bytes = wh.serialize();
+    hll::sketch_view view(bytes.data(), bytes.size());
+    REQUIRE(view.hash_id() == hll::wy_hash::id);
+    REQUIRE(wy_hll::deserialize(bytes.data(), bytes.size()).estimate() ==
+        wh.estimate());
+
+    hll::hyperloglog<std::string, 14, 25> murmur_counter;
+    REQUIRE_THROWS_AS(murmur_counter.merge(view), std::invalid_argument);
+  }
+}
+
+#include <hll/dynamic_hyperloglog.hpp>
+
+TEST_CASE("runtime precision", "[dynamic]") {
+  std::vector<std::uint64_t> items(100000);
+  std::iota(items.begin(), items.end(), 0);
+
+  SECTION("same estimates as fixed precision counters") {
+    hll::dynamic_hyperloglog<std::uint64_t> dh(14, 25);
+    hll::hyperloglog<std::uint64_t, 14, 25> h;
+    for (std::size_t n: {std::size_t{10}, std::size_t{3000},
+         std::size_t{100000}}) {
+      dh.insert(items.begin(), items.begin() + static_cast<std::ptrdiff_t>(n));
+      h.insert(items.begin(), items.begin() + static_cast<std::ptrdiff_t>(n));
+      REQUIRE(dh.is_sparse() == h.is_sparse());
+      REQUIRE(dh.estimate() == h.estimate());
+    }
+    REQUIRE(dh.dense_vec() == h.dense_vec());
+
+    auto bytes = h.serialize();
+    REQUIRE(dh.serialize() == bytes);
+    auto restored = hll::dynamic_hyperloglog<std::uint64_t>::deserialize(
+        bytes.data(), bytes.size());
+    REQUIRE(restored.precision() == 14);
+    REQUIRE(restored.sparse_precision() == 25);
+    REQUIRE(restored.estimate() == h.estimate());
+  }
+
+  SECTION("reducing precision") {
+    hll::dynamic_hyperloglog<std::uint64_t> high(18, 25, true);
+    hll::dynamic_hyperloglog<std::uint64_t> low(14, 25, true);
+    high.insert(items.begin(), items.end());
+    low.insert(items.begin(), items.end());
+    high.reduce_precision(14);
+    REQUIRE(high.precision() == 14);
+    REQUIRE(high.dense_vec() == low.dense_vec());
+    REQUIRE(high.estimate() == low.estimate());
+
+    hll::dynamic_hyperloglog<std::uint64_t> sparse_high(16, 30);
+    hll::dynamic_hyperloglog<std::uint64_t> sparse_low(12, 25);
+    sparse_high.insert(items.begin(), items.begin() + 500);
+    sparse_low.insert(items.begin(), items.begin() + 500);
+    sparse_high.reduce_precision(12, 25);
+    REQUIRE(sparse_high.is_sparse());
+    REQUIRE(sparse_high.serialize() == sparse_low.serialize());
+
+    // too many entries for the sparse list of the lower precision
+    hll::dynamic_hyperloglog<std::uint64_t> converted(16, 25);
+    converted.insert(items.begin(), items.begin() + 3000);
+    REQUIRE(converted.is_sparse());
+    converted.reduce_precision(10);
+    REQUIRE_FALSE(converted.is_sparse());
+
+    REQUIRE_THROWS_AS(low.reduce_precision(15), std::invalid_argument);
+    REQUIRE_THROWS_AS(low.reduce_precision(3), std::invalid_argument);
+    REQUIRE_THROWS_AS(sparse_low.reduce_precision(12, 12),
+        std::invalid_argument);
+  }
+
+  SECTION("merging different precisions") {
+    for (bool dense: {false, true}) {
+      hll::dynamic_hyperloglog<std::uint64_t> a(16, 28, dense);
+      hll::dynamic_hyperloglog<std::uint64_t> b(12, 25, dense);
+      a.insert(items.begin(), items.begin() + 1000);
+      b.insert(items.begin() + 500, items.begin() + 1500);
+
+      hll::dynamic_hyperloglog<std::uint64_t> expected = a;
+      expected.reduce_precision(12, 25);
+      expected.merge(b);
+
+      hll::dynamic_hyperloglog<std::uint64_t> merged = b;
+      merged.merge(a);
+      REQUIRE(merged.precision() == 12);
+      REQUIRE(merged.serialize() == expected.serialize());
+
+      auto bytes = a.serialize();
+      hll::dynamic_hyperloglog<std::uint64_t> from_view = b;
+      from_view.merge(hll::sketch_view(bytes.data(), bytes.size()));
+      REQUIRE(from_view.serialize() == expected.serialize());
+      REQUIRE(std::abs(merged.estimate() - 1500) < 1500*0.05);
+    }
+
+    hll::dynamic_hyperloglog<std::uint64_t> other_seed(14, 25, false, 1);
+    hll::dynamic_hyperloglog<std::uint64_t> h;
+    REQUIRE_THROWS_AS(h.merge(other_seed), std::invalid_argument);
+  }
+
+  REQUIRE_THROWS_AS(hll::dynamic_hyperloglog<int>(19),
+      std::invalid_argument);
+  REQUIRE_THROWS_AS(hll::dynamic_hyperloglog<int>(14, 14),
+      std::invalid_argument);
+  REQUIRE_THROWS_AS(hll::dynamic_hyperloglog<int>(14, 59),
+      std::invalid_argument);
+}
+
+#include <limits>
+
+#include <hll/sliding_hyperloglog.hpp>
+
+TEST_CASE("sliding windows", "[sliding]") {
+  // 100 ticks of 1000 items, half of which were also seen in the tick before
+  auto items_at = [](std::uint64_t t) {
+    std::vector<std::uint64_t> items(1000);
+    std::iota(items.begin(), items.end(), t*500);
+    return items;
+  };
+  auto window_counter = [&](std::uint64_t since, std::uint64_t until) {
+    hll::hyperloglog<std::uint64_t, 12, 25> h(true);
+    for (std::uint64_t t = since; t <= until; t++) {
+      auto items = items_at(t);
+      h.insert(items.begin(), items.end());
+    }
+    return h;
+  };
+
+  hll::sliding_hyperloglog<std::uint64_t, 12> sliding(30);
+  for (std::uint64_t t = 0; t < 100; t++) {
+    auto items = items_at(t);
+    sliding.insert(items.begin(), items.end(), t);
+  }
+  REQUIRE(sliding.latest() == 99);
+
+  SECTION("windows match counters of the items in them") {
+    for (std::uint64_t since: {69ul, 80ul, 99ul}) {
+      auto expected = window_counter(since, 99);
+      REQUIRE(sliding.dense_vec(since) == expected.dense_vec());
+      REQUIRE(sliding.estimate(since) == expected.estimate());
+    }
+    REQUIRE(sliding.estimate() == sliding.estimate(69));
+    REQUIRE_THROWS_AS(sliding.estimate(68), std::invalid_argument);
+    REQUIRE(sliding.estimate(100) == 0);
+    REQUIRE(sliding.estimate(1ull << 58) == 0);
+    REQUIRE(sliding.estimate(std::numeric_limits<std::uint64_t>::max()) == 0);
+    REQUIRE(sliding.dense_vec(1ull << 58) ==
+            std::vector<std::uint8_t>(1ul << 12));
+  }
+
+  SECTION("expired pairs are evicted") {
+    // each register keeps a few pairs of the last 31 ticks, not one per tick
+    REQUIRE(sliding.candidates() < (1u << 12)*8);
+    hll::sliding_hyperloglog<std::uint64_t, 12> later = sliding;
+    later.insert(0, 1000);
+    later.insert(1, 1000);
+    REQUIRE(later.candidates() < sliding.candidates());
+
+    // registers that are not updated any more are evicted by later inserts
+    // and merges
+    hll::sliding_hyperloglog<std::uint64_t, 12> swept = sliding;
+    for (int i = 0; i < (1 << 12); i++)
+      swept.insert(0, 1000);
+    REQUIRE(swept.candidates() == 1);
+    hll::sliding_hyperloglog<std::uint64_t, 12> merged = sliding, recent(30);
+    recent.insert(0, 1000);
+    merged.merge(recent);
+    REQUIRE(merged.candidates() == 1);
+    REQUIRE(merged.estimate() == recent.estimate());
+  }
+
+  SECTION("out of order inserts and merges") {
+    hll::sliding_hyperloglog<std::uint64_t, 12> even(30), odd(30);
+    for (std::uint64_t t = 100; t-- > 0;) {
+      auto items = items_at(t);
+      (t % 2 ? odd : even).insert(items.begin(), items.end(), t);
+    }
+    REQUIRE(odd.latest() == 99);
+    even.merge(odd);
+    for (std::uint64_t since: {69ul, 80ul, 99ul})
+      REQUIRE(even.dense_vec(since) == sliding.dense_vec(since));
+
+    hll::sliding_hyperloglog<std::uint64_t, 12> other_seed(30, 1);
+    REQUIRE_THROWS_AS(even.merge(other_seed), std::invalid_argument);
+  }
+
+  SECTION("merges keep the shorter window") {
+    hll::sliding_hyperloglog<std::uint64_t, 12> longer(60);
+    for (std::uint64_t t = 0; t < 100; t++) {
+      auto items = items_at(t);
+      longer.insert(items.begin(), items.end(), t);
+    }
+    REQUIRE(longer.estimate(50) == window_counter(50, 99).estimate());
+
+    // either way round, the union only knows the last 30 ticks of `sliding`
+    hll::sliding_hyperloglog<std::uint64_t, 12> shorter = sliding;
+    shorter.merge(longer);
+    longer.merge(sliding);
+    for (const auto *merged: {&shorter, &longer}) {
+      REQUIRE(merged->max_window() == 30);
+      REQUIRE(merged->dense_vec(69) == sliding.dense_vec(69));
+      REQUIRE_THROWS_AS(merged->estimate(50), std::invalid_argument);
+    }
+  }
+}
+
+#include <hll/sketch_map.hpp>
+
+TEST_CASE("sketch maps", "[sketch_map]") {
+  // key k sees k*k items, so that large keys become dense
+  std::vector<std::pair<std::uint32_t, std::uint64_t>> pairs;
+  for (std::uint32_t k = 0; k < 100; k++)
+    for (std::uint64_t i = 0; i < std::uint64_t{k}*k; i++)
+      pairs.emplace_back(k, i*100 + k);
+
+  auto check = [&](const auto& map) {
+    REQUIRE(map.size() == 99);  // key 0 has no items
+    REQUIRE_FALSE(map.contains(0));
+    REQUIRE(map.estimate(0) == 0);
+    REQUIRE(map.dense_count() > 0);
+
+    std::size_t keys = 0;
+    map.for_each_estimate([&](std::uint32_t k, double estimate) {
+      keys++;
+      hll::hyperloglog<std::uint64_t, 10, 25> expected;
+      for (std::uint64_t i = 0; i < std::uint64_t{k}*k; i++)
+        expected.insert(i*100 + k);
+      // both are either sparse or dense well past the conversion point
+      if (k < 14 || k > 20) {
+        REQUIRE(estimate == expected.estimate());
+        REQUIRE(map.serialize(k) == expected.serialize());
+      }
+      REQUIRE(std::abs(estimate - k*k) <= k*k*0.1);
+    });
+    REQUIRE(keys == 99);
+  };
+
+  SECTION("inserting one item at a time") {
+    hll::sketch_map<std::uint32_t, std::uint64_t, 10, 25> map;
+    // interleaved, so that blocks of different keys are freed and reused
+    for (std::uint64_t i = 0; i < 99*99; i++)
+      for (std::uint32_t k = 1; k < 100; k++)
+        if (i < std::uint64_t{k}*k)
+          map.insert(k, i*100 + k);
+    check(map);
+    REQUIRE_THROWS_AS(map.serialize(0), std::invalid_argument);
+  }
+
+  SECTION("inserting in bulk") {
+    hll::sketch_map<std::uint32_t, std::uint64_t, 10, 25> map;
+    map.insert(pairs.begin(), pairs.end());
+    check(map);
+  }
+
+  SECTION("merging maps") {
+    hll::sketch_map<std::uint32_t, std::uint64_t, 10, 25> even, odd;
+    for (std::size_t i = 0; i < pairs.size(); i++)
+      (i % 2 ? odd : even).insert(pairs[i].first, pairs[i].second);
+    even.merge(odd);
+    check(even);
+  }
+
+  SECTION("string items") {
+    hll::sketch_map<std::string, std::string, 10, 25> map;
+    std::vector<std::pair<std::string, std::string>> visits = {
+      {"/", "alice"}, {"/", "bob"}, {"/about", "alice"}, {"/", "alice"}};
+    map.insert(visits.begin(), visits.end());
+    REQUIRE(map.size() == 2);
+    REQUIRE(std::abs(map.estimate("/") - 2) < 0.01);
+    REQUIRE(std::abs(map.estimate("/about") - 1) < 0.01);
+  }
+
+  SECTION("estimates from many threads") {
+    // blocks of more than 16 entries with unsorted entries left
+    hll::sketch_map<std::uint32_t, std::uint64_t, 10, 25> map;
+    for (std::uint64_t i = 0; i < 40; i++)
+      for (std::uint32_t key = 0; key < 10; key++)
+        map.insert(key, i*(key + 1));
+    std::vector<double> expected;
+    for (std::uint32_t key = 0; key < 10; key++)
+      expected.push_back(map.estimate(key));
+
+    std::vector<int> agree(4, 0);
+    std::vector<std::thread> readers;
+    for (std::size_t t = 0; t < agree.size(); t++)
+      readers.emplace_back([&, t]() {
+        bool same = true;
+        for (int round = 0; round < 50; round++)
+          for (std::uint32_t key = 0; key < 10; key++)
+            same = same && map.estimate(key) == expected[key];
+        agree[t] = same;
+      });
+    for (auto& r: readers)
+      r.join();
+    for (auto a: agree)
+      REQUIRE(a);
+  }
+}
+
+#include <cstdio>
+
+#include <hll/sketch_store.hpp>
+
+TEST_CASE("sketch stores", "[sketch_store]") {
+  using dhll_t = hll::dynamic_hyperloglog<std::uint64_t>;
+  const std::string path = "hll_tests_sketch_store.bin";
+  std::remove(path.c_str());
+
+  // hourly sketches of two series, mostly sparse for "small" and dense for
+  // "large", with overlapping items from one hour to the next
+  std::vector<std::vector<std::uint8_t>> small_sketches, large_sketches;
+  for (std::uint64_t hour = 0; hour < 24 * 7 * 3; hour++) {
+    dhll_t small(10, 20), large(10, 20);
+    for (std::uint64_t i = hour * 20; i < hour * 20 + 40; i++)
+      small.insert(i);
+    for (std::uint64_t i = hour * 500; i < hour * 500 + 2000; i++)
+      large.insert(i);
+    small_sketches.push_back(small.serialize());
+    large_sketches.push_back(large.serialize());
+  }
+
+  // union of the sketches of hours [from, to) merged on the heap
+  auto expected = [](const std::vector<std::vector<std::uint8_t>> &sketches,
+                     std::uint64_t from, std::uint64_t to, bool dense) {
+    dhll_t h(10, 20, dense);
+    for (std::uint64_t hour = from; hour < to; hour++)
+      h.merge(hll::sketch_view(sketches[hour].data(), sketches[hour].size()));
+    return h;
+  };
+
+  hll::sketch_store::settings settings;
+  settings.precision = 10;
+  settings.sparse_precision = 20;
+  settings.rollups = {24, 24 * 7};
+  {
+    auto store = hll::sketch_store::create(path, settings);
+    REQUIRE_THROWS_AS(hll::sketch_store::create(path, settings),
+                      std::runtime_error);
+    for (std::uint64_t hour = 0; hour < small_sketches.size(); hour++) {
+      store.append("small", hour,
+                   hll::sketch_view(small_sketches[hour].data(),
+                                    small_sketches[hour].size()));
+      store.append("large", hour,
+                   hll::sketch_view(large_sketches[hour].data(),
+                                    large_sketches[hour].size()));
+    }
+    REQUIRE(store.size() == 2 * small_sketches.size());
+
+    dhll_t other(12, 20);
+    other.insert(1);
+    auto bytes = other.serialize();
+    REQUIRE_THROWS_AS(
+        store.append("small", 0, hll::sketch_view(bytes.data(), bytes.size())),
+        std::invalid_argument);
+    store.flush();
+  }
+
+  {
+    hll::sketch_store store(path, true);
+    REQUIRE(store.precision() == 10);
+    REQUIRE(store.sparse_precision() == 20);
+    REQUIRE(store.rollups() == settings.rollups);
+    REQUIRE(store.size() == 2 * small_sketches.size());
+    REQUIRE(store.contains("small"));
+    REQUIRE_FALSE(store.contains("medium"));
+    REQUIRE(store.estimate("medium", 0, 1000) == 0);
+
+    SECTION("ranges within a day read the sketches") {
+      for (auto range : {std::make_pair(3, 8), std::make_pair(30, 36)}) {
+        auto from = static_cast<std::uint64_t>(range.first);
+        auto to = static_cast<std::uint64_t>(range.second);
+        dhll_t h = expected(small_sketches, from, to, false);
+        auto bytes = store.union_range("small", from, to);
+        REQUIRE(hll::sketch_view(bytes.data(), bytes.size()).is_sparse());
+        REQUIRE(bytes == h.serialize());
+        REQUIRE(store.estimate("small", from, to) == h.estimate());
+
+        dhll_t dense = expected(large_sketches, from, to, false);
+        REQUIRE(store.union_range("large", from, to) == dense.serialize());
+      }
+    }
+
+    SECTION("longer ranges read whole periods from the rollups") {
+      for (auto range : {std::make_pair(0, 24 * 7), std::make_pair(5, 400),
+                         std::make_pair(24, 24 * 7 * 3)}) {
+        auto from = static_cast<std::uint64_t>(range.first);
+        auto to = static_cast<std::uint64_t>(range.second);
+        for (const auto &series : {std::make_pair("small", &small_sketches),
+                                   std::make_pair("large", &large_sketches)}) {
+          dhll_t h = expected(*series.second, from, to, true);
+          auto bytes = store.union_range(series.first, from, to);
+          REQUIRE(bytes == h.serialize());
+          REQUIRE(store.estimate(series.first, from, to) == h.estimate());
+        }
+      }
+    }
+
+    SECTION("read-only stores") {
+      dhll_t h(10, 20);
+      h.insert(1);
+      auto bytes = h.serialize();
+      hll::sketch_view view(bytes.data(), bytes.size());
+      REQUIRE_THROWS_AS(store.append("small", 0, view), std::logic_error);
+    }
+  }
+
+  std::remove(path.c_str());
+}
+
+#include <hll/instrumentation.hpp>
+
+TEST_CASE("introspection", "[stats]") {
+  std::vector<std::uint64_t> items(20000);
+  std::iota(items.begin(), items.end(), 0);
+
+  SECTION("stats of sparse and dense counters") {
+    hll::hyperloglog<std::uint64_t, 12, 25> h;
+    hll::dynamic_hyperloglog<std::uint64_t> dh(12, 25);
+    auto empty = h.stats();
+    REQUIRE(empty.sparse);
+    REQUIRE(empty.sparse_entries == 0);
+    REQUIRE(empty.dense_bytes == 0);
+    REQUIRE(empty.register_histogram[0] == 4096);
+
+    h.insert(items.begin(), items.begin() + 100);
+    dh.insert(items.begin(), items.begin() + 100);
+    for (const auto &s : {h.stats(), dh.stats()}) {
+      REQUIRE(s.sparse);
+      REQUIRE(s.sparse_entries + s.temporary_entries >= 99);
+      REQUIRE(s.sparse_entries_max == 1024);
+      REQUIRE(s.temporary_entries_max == 102);
+      REQUIRE(s.sparse_bytes > 0);
+      REQUIRE(s.bytes() == s.sparse_bytes);
+      std::size_t registers = std::accumulate(
+          s.register_histogram.begin(), s.register_histogram.end(),
+          std::size_t{0});
+      REQUIRE(registers == 4096);
+      REQUIRE(4096 - s.register_histogram[0] <= 100);
+    }
+    // both keep 4-byte entries, so the sparse lists stay below 4096 bytes
+    REQUIRE(dh.stats().sparse_bytes == h.stats().sparse_bytes);
+
+    h.insert(items.begin(), items.end());
+    dh.insert(items.begin(), items.end());
+    auto s = h.stats();
+    REQUIRE_FALSE(s.sparse);
+    REQUIRE(s.sparse_bytes == 0);
+    REQUIRE(s.dense_bytes == 4096);
+    REQUIRE(dh.stats().register_histogram == s.register_histogram);
+
+    std::size_t non_zeros = 0;
+    for (auto r : h.dense_vec())
+      non_zeros += r > 0;
+    REQUIRE(4096 - s.register_histogram[0] == non_zeros);
+  }
+
+  SECTION("sparse histograms match the registers") {
+    // many sparse indices share each dense register at these precisions
+    hll::hyperloglog<std::uint64_t, 12, 14> h;
+    hll::hyperloglog<std::uint64_t, 12, 14> d(true);
+    hll::dynamic_hyperloglog<std::uint64_t> dh(12, 14);
+    h.insert(items.begin(), items.begin() + 600);
+    dh.insert(items.begin(), items.begin() + 600);
+    for (std::size_t i = 0; i < 700; i++) {
+      h.insert(items[i]);
+      dh.insert(items[i]);
+    }
+    d.insert(items.begin(), items.begin() + 700);
+
+    auto s = h.stats();
+    REQUIRE(s.sparse);
+    REQUIRE(s.temporary_entries > 0);
+    REQUIRE(s.register_histogram == d.stats().register_histogram);
+    REQUIRE(dh.stats().register_histogram == s.register_histogram);
+  }
+
+  SECTION("event names") {
+    using hll::instrumentation::event;
+    REQUIRE(std::string(hll::instrumentation::name(event::merge_temp)) ==
+            "merge_temp");
+    REQUIRE(std::string(hll::instrumentation::name(
+                event::merge_dense_dense)) == "merge_dense_dense");
+  }
+
+#ifdef HLL_ENABLE_INSTRUMENTATION
+  SECTION("counted events") {
+    using hll::instrumentation::event;
+    auto count = [](const std::array<hll::instrumentation::totals,
+                                     hll::instrumentation::event_count> &t,
+                    event e) { return t[static_cast<std::size_t>(e)].count; };
+
+    hll::instrumentation::reset();
+    hll::hyperloglog<std::uint64_t, 12, 25> a, b, c(true);
+    a.insert(items.begin(), items.begin() + 50);
+    b.insert(items.begin(), items.begin() + 50);
+    a.merge(b);
+    auto t = hll::instrumentation::snapshot();
+    REQUIRE(count(t, event::insert) == 100);
+    REQUIRE(count(t, event::merge_sparse_sparse) == 1);
+    REQUIRE(count(t, event::convert_to_dense) == 0);
+
+    a.insert(items.begin(), items.end());
+    c.merge(a);
+    c.merge(b);
+    std::thread([&]() { b.merge(c); }).join();
+    t = hll::instrumentation::snapshot();
+    REQUIRE(count(t, event::insert) == 100 + items.size());
+    REQUIRE(count(t, event::merge_temp) > 0);
+    REQUIRE(count(t, event::convert_to_dense) == 2);
+    REQUIRE(count(t, event::merge_dense_dense) == 1);
+    REQUIRE(count(t, event::merge_sparse_dense) == 2);
+
+    hll::instrumentation::reset();
+    REQUIRE(count(hll::instrumentation::snapshot(), event::insert) == 0);
+  }
+#endif
+}
+
+TEST_CASE("improved estimator", "[estimate]") {
+  using method = hll::estimation_method;
+
+  // the bias tables are initialized at compile time
+  static_assert(hll::detail::bias_tables<>::p4[0].estimate > 0,
+      "bias tables should be constant");
+
+  SECTION("sparse and empty counters") {
+    hll::hyperloglog<std::uint64_t, 10, 25> sparse, empty(true);
+    for (std::uint64_t i = 0; i < 100; i++)
+      sparse.insert(i);
+    REQUIRE(sparse.estimate(method::improved) == sparse.estimate());
+    REQUIRE(empty.estimate(method::improved) == 0);
+  }
+
+  SECTION("agrees with the bias corrected estimate") {
+    hll::hyperloglog<std::uint64_t, 10, 25> h(true);
+    hll::dynamic_hyperloglog<std::uint64_t> d(10, 25, true);
+    double m = 1 << 10;
+    double standard_error = 1.04/std::sqrt(m);
+    std::uint64_t inserted = 0;
+    for (double n: {m/10, m/2, 2*m, 5*m, 10*m, 100*m}) {
+      for (; static_cast<double>(inserted) < n; inserted++) {
+        h.insert(inserted);
+        d.insert(inserted);
+      }
+      double improved = h.estimate(method::improved);
+      REQUIRE(std::abs(improved - n) < 3*standard_error*n);
+      REQUIRE(std::abs(improved - h.estimate()) < standard_error*n);
+      REQUIRE(d.estimate(method::improved) == improved);
+    }
+  }
+}
+
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+
+#include "hll_count.hpp"
+
+TEST_CASE("counting lines of text", "[hll_count]") {
+  SECTION("chunks start at line boundaries") {
+    std::string text = "ab\ncd\n\nef";
+    const char* data = text.data();
+    REQUIRE(counting::line_start(data, text.size(), 0) == 0);
+    REQUIRE(counting::line_start(data, text.size(), 1) == 3);
+    REQUIRE(counting::line_start(data, text.size(), 3) == 3);
+    REQUIRE(counting::line_start(data, text.size(), 4) == 6);
+    REQUIRE(counting::line_start(data, text.size(), 6) == 6);
+    REQUIRE(counting::line_start(data, text.size(), 7) == 7);
+    REQUIRE(counting::line_start(data, text.size(), 8) == 9);
+    REQUIRE(counting::line_start(data, text.size(), 20) == 9);
+  }
+
+  SECTION("streams in small blocks") {
+    // the same 500 distinct lines, once plain and once with CR line endings,
+    // empty lines and repeats, without a newline at the very end
+    std::string plain, messy;
+    for (int i = 0; i < 500; i++) {
+      std::string line = "value-" + std::to_string(i);
+      plain += line + "\n";
+      messy += line + (i % 3 ? "\r\n" : "\n");
+      if (i % 7 == 0)
+        messy += "\n\r\n" + line + "\n";
+    }
+    messy += "value-499";
+
+    using set_t = counting::counter_set<12, hll::wy_hash>;
+    counting::options opts;
+    set_t expected(opts);
+    expected.count(plain.data(), plain.data() + plain.size());
+
+    // blocks much shorter than a line, so that lines are carried over
+    for (std::size_t block_size: {1ul, 7ul, 64ul}) {
+      opts.block_size = block_size;
+      hll::thread_pool pool(3);
+      std::vector<set_t> sets(pool.size(), set_t(opts));
+      std::istringstream in(messy);
+      counting::count_stream(in, opts, sets, pool);
+      for (std::size_t t = 1; t < sets.size(); t++)
+        sets[0].merge(sets[t]);
+      REQUIRE(sets[0].counters[0].serialize() ==
+          expected.counters[0].serialize());
+    }
+    REQUIRE(std::abs(expected.counters[0].estimate() - 500) < 500*0.05);
+  }
+
+  SECTION("sketches of two runs merge") {
+    // values 0 to 499 of keys 0 to 2, in two overlapping files
+    const std::string a = "hll_tests_count_a.csv", b = "hll_tests_count_b.csv";
+    for (auto file: {std::make_pair(a, 0), std::make_pair(b, 200)}) {
+      std::ofstream out(file.first, std::ios::trunc);
+      for (int i = file.second; i < file.second + 300; i++)
+        out << "key" << i % 3 << ",value" << i << "\n";
+    }
+    auto read = [](const std::string& path) {
+      std::ifstream in(path, std::ios::binary);
+      return std::vector<std::uint8_t>(std::istreambuf_iterator<char>(in),
+          std::istreambuf_iterator<char>());
+    };
+
+    counting::options opts;
+    opts.delimiter = ',';
+    opts.columns = {2};
+    for (const auto& file: {a, b}) {
+      opts.files = {file};
+      opts.sketches = file;
+      std::ostringstream ignored;
+      counting::run(opts, ignored);
+    }
+    opts.group_by = 1;
+    for (const auto& file: {a, b}) {
+      opts.files = {file};
+      opts.sketches = file;
+      std::ostringstream ignored;
+      counting::run(opts, ignored);
+    }
+
+    std::vector<std::vector<std::uint8_t>> single = {
+      read(a + ".2.hll"), read(b + ".2.hll")};
+    std::ostringstream merged;
+    counting::merge_sketches(single, merged);
+    REQUIRE(std::abs(std::stod(merged.str()) - 500) <= 2);
+
+    std::vector<std::vector<std::uint8_t>> grouped = {
+      read(a + ".2.hllg"), read(b + ".2.hllg")};
+    std::ostringstream per_key;
+    counting::merge_sketches(grouped, per_key);
+    std::map<std::string, double> estimates;
+    std::istringstream lines(per_key.str());
+    std::string key;
+    double estimate;
+    while (lines >> key >> estimate)
+      estimates[key] = estimate;
+    REQUIRE(estimates.size() == 3);
+    REQUIRE(std::abs(estimates["key0"] - 167) <= 2);
+    REQUIRE(std::abs(estimates["key1"] - 167) <= 2);
+    REQUIRE(std::abs(estimates["key2"] - 166) <= 2);
+
+    std::ostringstream ignored;
+    std::vector<std::vector<std::uint8_t>> mixed = {single[0], grouped[1]};
+    REQUIRE_THROWS_AS(counting::merge_sketches(mixed, ignored),
+        std::invalid_argument);
+    grouped[0].pop_back();
+    REQUIRE_THROWS_AS(counting::merge_sketches(grouped, ignored),
+        std::invalid_argument);
+
+    for (const auto& file: {a, b})
+      for (const auto& suffix: {"", ".2.hll", ".2.hllg"})
+        std::remove((file + suffix).c_str());
+  }
+}
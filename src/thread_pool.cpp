@@ -0,0 +1,80 @@
+#include "../include/hll/thread_pool.hpp"
+
+namespace hll {
+  thread_pool::thread_pool(std::size_t threads) {
+    if (threads == 0)
+      threads = std::thread::hardware_concurrency();
+    for (std::size_t i = 1; i < threads; i++)
+      workers.emplace_back([this]() { work(); });
+  }
+
+  thread_pool::~thread_pool() {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto& w: workers)
+      w.join();
+  }
+
+  std::size_t thread_pool::size() const {
+    return workers.size() + 1;
+  }
+
+  void thread_pool::run(
+      std::size_t count, const std::function<void(std::size_t)>& f) {
+    if (count == 0)
+      return;
+
+    std::lock_guard<std::mutex> serial(run_lock);
+    std::unique_lock<std::mutex> guard(lock);
+    job = &f;
+    job_size = count;
+    next = 0;
+    finished = 0;
+    error = nullptr;
+    wake.notify_all();
+
+    process(guard);
+    done.wait(guard, [this]() { return finished == job_size; });
+
+    job = nullptr;
+    std::exception_ptr e = error;
+    error = nullptr;
+    if (e)
+      std::rethrow_exception(e);
+  }
+
+  void thread_pool::work() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+      wake.wait(guard, [this]() {
+          return stopping || (job != nullptr && next < job_size); });
+      if (stopping)
+        return;
+      process(guard);
+    }
+  }
+
+  // claims and runs items of the current job until there are none left,
+  // with `guard` locked on entry and exit
+  void thread_pool::process(std::unique_lock<std::mutex>& guard) {
+    while (job != nullptr && next < job_size) {
+      std::size_t i = next++;
+      const std::function<void(std::size_t)>* f = job;
+      guard.unlock();
+      std::exception_ptr e;
+      try {
+        (*f)(i);
+      } catch (...) {
+        e = std::current_exception();
+      }
+      guard.lock();
+      if (e && !error)
+        error = e;
+      if (++finished == job_size)
+        done.notify_all();
+    }
+  }
+}  // namespace hll